@@ -0,0 +1,90 @@
+import socket
+import struct
+import sys
+
+src_addr = '129.82.45.252'
+src_port = 9009
+
+# AllBodies: every detected person in one packet. Only served by the wrapper's own stream server (-stream_server_port).
+stream_id = 8192
+
+person_central_flag = 1
+person_engaged_flag = 2
+
+
+def connect():
+    """
+    Connect to a specific port
+    """
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+
+    try:
+        sock.connect((src_addr, src_port))
+    except:
+        print "Error connecting to {}:{}".format(src_addr, src_port)
+        return None
+
+    try:
+        print "Sending stream info"
+        sock.sendall(struct.pack('<i', stream_id))
+    except:
+        print "Error: Stream rejected"
+        return None
+
+    print "Successfully connected to host"
+    return sock
+
+
+def decode_frame_all_bodies(raw_frame):
+    # Expect little endian byte order
+    endianness = "<"
+
+    # [ commonTimestamp | frame type | Person count ]
+    header_format = "qhH"
+
+    timestamp, frame_type, person_count = struct.unpack_from(endianness + header_format, raw_frame)
+    offset = struct.calcsize(endianness + header_format)
+
+    # For each person: [ Index | Centroid.X | Centroid.Y | AverageLimbLength | Flags | 18 x (X | Y | Confidence) ]
+    person_format = endianness + "IfffB" + "3f" * 18
+
+    people = []
+    for i in range(person_count):
+        person = struct.unpack_from(person_format, raw_frame, offset)
+        offset += struct.calcsize(person_format)
+        people.append({'index': person[0], 'centroid': (person[1], person[2]), 'limb_length': person[3],
+                       'central': bool(person[4] & person_central_flag), 'engaged': bool(person[4] & person_engaged_flag),
+                       'keypoints': person[5:]})
+    return timestamp, frame_type, people
+
+
+def recv_all(sock, size):
+    result = b''
+    while len(result) < size:
+        data = sock.recv(size - len(result))
+        if not data:
+            raise EOFError("Error: Received only {} bytes into {} byte message".format(len(data), size))
+        result += data
+    return result
+
+
+def recv_all_bodies_frame(sock):
+    """
+    To read each stream frame from the server
+    """
+    (load_size,) = struct.unpack("<i", recv_all(sock, struct.calcsize("<i")))
+    return recv_all(sock, load_size)
+
+
+if __name__ == '__main__':
+    s = connect()
+    if s is None:
+        sys.exit(0)
+
+    while True:
+        timestamp, frame_type, people = decode_frame_all_bodies(recv_all_bodies_frame(s))
+        print timestamp, frame_type, len(people), "people"
+        for person in people:
+            print "  person {index}: centroid ({centroid[0]:.1f}, {centroid[1]:.1f}), limb {limb_length:.1f}".format(**person), \
+                'Central' if person['central'] else '', 'Engaged' if person['engaged'] else ''
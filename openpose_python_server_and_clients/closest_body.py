@@ -7,6 +7,30 @@ src_port = 9009
 
 stream_id = 512
 
+# --batch N T: receive the frames in batches of up to N frames, flushed at least every T ms. Needs the wrapper's own
+# stream server (-stream_server_port).
+stream_options_flag = 0x40000000
+batch = (int(sys.argv[sys.argv.index('--batch') + 1]), int(sys.argv[sys.argv.index('--batch') + 2])) \
+    if '--batch' in sys.argv else None
+# --compact: quantized delta-encoded keypoints (see cwc/keypointCodec.hpp), also needs -stream_server_port
+compact = '--compact' in sys.argv
+# --trace: every frame comes with its capture time and pipeline stage times (see cwc/frameTrace.hpp). The latency is only
+# meaningful if this client runs on the same machine as the wrapper (same monotonic clock).
+trace = '--trace' in sys.argv
+trace_format = "<Q6q"  # sequence | producer start, captured, pose done, popped, crops extracted, serialized (ns)
+# --track: every frame comes with the track id of the body it carries, stable while that person stays in view
+track = '--track' in sys.argv
+track_format = "<I"
+no_track = 0xFFFFFFFF
+# --predict MS: the keypoints are extrapolated MS ms past the capture time (e.g. the latency measured with --trace), and
+# every frame ends with the bitmask of the keypoints that were (see makePredictedClosestBodyPacket)
+predict = int(sys.argv[sys.argv.index('--predict') + 1]) if '--predict' in sys.argv else 0
+predicted_format = "<I"
+# --camera N|all: the frames of camera N of the wrapper's -cameras (default 0), or of every camera, each with its index.
+# The frames of one synchronized set share their trace sequence.
+camera = sys.argv[sys.argv.index('--camera') + 1] if '--camera' in sys.argv else None
+camera_format = "<I"
+
 
 def connect():
     """
@@ -23,7 +47,14 @@ def connect():
 
     try:
         print "Sending stream info"
-        sock.sendall(struct.pack('<i', stream_id))
+        options = ';'.join((['batch_frames={};batch_ms={}'.format(*batch)] if batch is not None else []) +
+                           (['keypoints=compact'] if compact else []) + (['trace=1'] if trace else []) +
+                           (['track=1'] if track else []) + (['predict={}'.format(predict)] if predict else []) +
+                           (['camera={}'.format(camera)] if camera is not None else []))
+        if not options:
+            sock.sendall(struct.pack('<i', stream_id))
+        else:
+            sock.sendall(struct.pack('<iH', stream_id | stream_options_flag, len(options)) + options)
     except:
         print "Error: Stream rejected"
         return None
@@ -89,6 +120,42 @@ def decode_frame_openpose(raw_frame):
     return decoded
 
 
+class CompactKeypointDecoder():
+    """
+    Rebuilds the 18 (x, y, score) of the keypoints=compact stream. decode() returns None until the first keyframe and
+    after a missed frame, until the next keyframe.
+    """
+    keyframe_flag = 1
+    fixed_point_scale = 4.0
+    score_scale = 255.0
+
+    def __init__(self):
+        self._sequence = None
+        self._joints = [[0, 0, 0] for _ in range(18)]  # quantized x, y, score
+
+    def decode(self, raw_frame):
+        header_format = "<qhBBII"
+        timestamp, frame_type, flags, engaged, sequence, changed_mask = struct.unpack_from(header_format, raw_frame)
+        keyframe = flags & self.keyframe_flag
+        if not keyframe and (self._sequence is None or sequence != (self._sequence + 1) & 0xffffffff):
+            self._sequence = None  # missed a frame, wait for the next keyframe
+            return None
+        offset = struct.calcsize(header_format)
+        for joint in range(18):
+            if changed_mask & (1 << joint):
+                x, y, score = struct.unpack_from("<hhB", raw_frame, offset)
+                offset += struct.calcsize("<hhB")
+                if keyframe:
+                    self._joints[joint] = [x, y, score]
+                else:
+                    self._joints[joint] = [self._joints[joint][0] + x, self._joints[joint][1] + y, score]
+        self._sequence = sequence
+        keypoints = []
+        for x, y, score in self._joints:
+            keypoints += [x / self.fixed_point_scale, y / self.fixed_point_scale, score / self.score_scale]
+        return (timestamp, frame_type, sequence, float(engaged)) + tuple(keypoints)
+
+
 def decode_frame_2(raw_frame):
     # The format is given according to the following assumption of network data
 
@@ -131,25 +198,107 @@ def recv_all(sock, size):
     return result
 
 
+def monotonic_ns():
+    """
+    CLOCK_MONOTONIC in ns, the clock of the wrapper traces (Linux)
+    """
+    import ctypes
+
+    class timespec(ctypes.Structure):
+        _fields_ = [('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long)]
+
+    now = timespec()
+    ctypes.CDLL('librt.so.1', use_errno=True).clock_gettime(1, ctypes.byref(now))
+    return now.tv_sec * 1000000000 + now.tv_nsec
+
+
+def print_trace(raw_trace):
+    """
+    Prints the time of each pipeline stage and the capture-to-client latency of a frame
+    """
+    stage_times = struct.unpack(trace_format, raw_trace)
+    sequence, stage_times = stage_times[0], stage_times[1:] + (monotonic_ns(),)
+    names = ["producer", "pose", "output", "crops", "serialization", "send"]
+    print "trace", sequence, " ".join("{} {:.1f} ms".format(names[i], (stage_times[i + 1] - stage_times[i]) / 1e6)
+                                      for i in range(len(names)) if stage_times[i] and stage_times[i + 1]), \
+        "| capture to client {:.1f} ms".format((stage_times[-1] - stage_times[1]) / 1e6)
+
+
+def print_track(raw_track):
+    (track_id,) = struct.unpack(track_format, raw_track)
+    print "track", (track_id if track_id != no_track else "none")
+
+
 def recv_skeleton_frame(sock):
     """
-    To read each stream frame from the server
+    To read each stream frame from the server. Returns its camera index (None without --camera all) and its load.
     """
+    camera_index = None
+    if trace and batch is None:
+        print_trace(recv_all(sock, struct.calcsize(trace_format)))
+    if camera == 'all' and batch is None:
+        (camera_index,) = struct.unpack(camera_format, recv_all(sock, struct.calcsize(camera_format)))
+    if track and batch is None:
+        print_track(recv_all(sock, struct.calcsize(track_format)))
     (load_size,) = struct.unpack("<i", recv_all(sock, struct.calcsize("<i")))
     print "load_size = ", load_size
-    return recv_all(sock, load_size)
+    return camera_index, recv_all(sock, load_size)
+
+
+def split_batch(raw_batch):
+    """
+    Splits a batch ('<H' frame count, then '<i' load size + load of each frame, each after its trace with --trace, its
+    camera index with --camera all and its track id with --track) into (camera index, frame load) pairs
+    """
+    (frame_count,) = struct.unpack_from("<H", raw_batch)
+    offset = struct.calcsize("<H")
+    frames = []
+    for i in range(frame_count):
+        if trace:
+            print_trace(raw_batch[offset:offset + struct.calcsize(trace_format)])
+            offset += struct.calcsize(trace_format)
+        camera_index = None
+        if camera == 'all':
+            (camera_index,) = struct.unpack_from(camera_format, raw_batch, offset)
+            offset += struct.calcsize(camera_format)
+        if track:
+            print_track(raw_batch[offset:offset + struct.calcsize(track_format)])
+            offset += struct.calcsize(track_format)
+        (load_size,) = struct.unpack_from("<i", raw_batch, offset)
+        offset += struct.calcsize("<i")
+        frames.append((camera_index, raw_batch[offset:offset + load_size]))
+        offset += load_size
+    return frames
 
 
 if __name__ == '__main__':
     s = connect()
     if s is None:
         sys.exit(0)
+    # One per camera: each camera's keypoints are delta-encoded against its own previous frame
+    compact_decoders = {}
         
     while True:
         # try:
-        f = recv_skeleton_frame(s)
-        timestamp, frame_type, tracked_body_count, engaged = decode_frame_openpose(f)[:4]
-        print timestamp, frame_type, tracked_body_count, 'Engaged' if engaged == 1.0 else 'Not Engaged'
+        camera_index, f = recv_skeleton_frame(s)
+        for camera_index, frame in (split_batch(f) if batch is not None else [(camera_index, f)]):
+            if camera_index is not None:
+                print "camera", camera_index
+            if compact:
+                decoded = compact_decoders.setdefault(camera_index, CompactKeypointDecoder()).decode(frame)
+                if decoded is None:
+                    print "Waiting for a keyframe"
+                    continue
+                timestamp, frame_type, sequence, engaged = decoded[:4]
+                print timestamp, frame_type, sequence, 'Engaged' if engaged == 1.0 else 'Not Engaged'
+                continue
+            if predict:
+                predicted_size = struct.calcsize(predicted_format)
+                (predicted_mask,) = struct.unpack(predicted_format, frame[-predicted_size:])
+                frame = frame[:-predicted_size]
+                print "predicted", predict, "ms ahead:", [joint for joint in range(18) if predicted_mask & (1 << joint)]
+            timestamp, frame_type, tracked_body_count, engaged = decode_frame_openpose(frame)[:4]
+            print timestamp, frame_type, tracked_body_count, 'Engaged' if engaged == 1.0 else 'Not Engaged'
         # decode_frame_1(f)
         # except:
         #     s.close()
@@ -8,6 +8,18 @@ import matplotlib.pyplot as plt
 src_addr = '129.82.45.252'
 src_port = 9009
 
+# Crop encoding requested with --encoding raw|png|jpeg|tensor [--quality N]. Needs the wrapper's own stream server
+# (-stream_server_port); without --encoding the original uint16 layout is used and any server works.
+# tensor: the crop resampled and normalized by the wrapper (-crop_tensor_*), float32 B, G, R planes of width x height.
+stream_options_flag = 0x40000000
+encoding = sys.argv[sys.argv.index('--encoding') + 1] if '--encoding' in sys.argv else None
+quality = int(sys.argv[sys.argv.index('--quality') + 1]) if '--quality' in sys.argv else 90
+# --all-people: the crops of every detected person in one NHWC block per frame (raw uint8, see decode_batch_openpose)
+all_people = '--all-people' in sys.argv
+# --skip-unchanged: a crop that did not change since the last one is sent as a short packet (see decode_frame_openpose)
+skip_unchanged = '--skip-unchanged' in sys.argv
+last_crop = None  # (frame number, width, height, color data) of the last crop received, with --skip-unchanged
+
 stream_id = 2048  # head color stream
 
 
@@ -26,7 +38,12 @@ def connect():
 
     try:
         print "Sending stream info"
-        sock.sendall(struct.pack('<i', stream_id))
+        if encoding is None and not all_people and not skip_unchanged:
+            sock.sendall(struct.pack('<i', stream_id))
+        else:
+            options = ';'.join((['encoding={};quality={}'.format(encoding, quality)] if encoding is not None else [])
+                               + (['people=all'] if all_people else []) + (['unchanged=1'] if skip_unchanged else []))
+            sock.sendall(struct.pack('<iH', stream_id | stream_options_flag, len(options)) + options)
     except:
         print "Error: Stream rejected"
         return None
@@ -37,6 +54,13 @@ def connect():
 
 def decode_frame_openpose(raw_frame):
     # The format is given according to the following assumption of network data
+    global last_crop
+
+    # --skip-unchanged: [ frame number ] in front, and a 0x0 crop with [ frame number ] as payload when the crop is the
+    # same as the one of that frame
+    if skip_unchanged:
+        (frame_number,) = struct.unpack_from("<Q", raw_frame)
+        raw_frame = raw_frame[8:]
 
     # Expect little endian byte order
     endianness = "<"
@@ -47,16 +71,48 @@ def decode_frame_openpose(raw_frame):
     timestamp, frame_type, width, height = struct.unpack(endianness + header_format,
                                                                        raw_frame[:struct.calcsize(header_format)])
 
-    color_data_format = str(width*height*3) + "H"  # 1(image)*img_width*img_height*3(channels)
-
-    color_data = struct.unpack_from(endianness + color_data_format, raw_frame, header_size)
-
-    decoded = (timestamp, frame_type, width, height, list(color_data))
-
+    if skip_unchanged and width * height == 0 and len(raw_frame) == header_size + 8:
+        (same_as,) = struct.unpack_from("<Q", raw_frame, header_size)
+        if last_crop is not None and last_crop[0] == same_as:
+            return (timestamp, frame_type) + last_crop[1:]
+        # the crop it refers to was missed: unknown until the next full crop
+        return (timestamp, frame_type, 0, 0, [])
+
+    if encoding in ('png', 'jpeg'):
+        import cv2
+        # unknown region => 0x0 without payload
+        image = cv2.imdecode(np.frombuffer(raw_frame[header_size:], dtype=np.uint8), cv2.IMREAD_COLOR) if width * height > 0 else None
+        color_data = image.flatten() if image is not None else []
+    elif encoding == 'tensor':
+        # unknown region => 0x0 without payload
+        color_data = np.frombuffer(raw_frame[header_size:], dtype='<f4').reshape((3, height, width))
+    elif encoding == 'raw':
+        color_data = struct.unpack_from(endianness + str(width*height*3) + "B", raw_frame, header_size)
+    else:
+        color_data_format = str(width*height*3) + "H"  # 1(image)*img_width*img_height*3(channels)
+
+        color_data = struct.unpack_from(endianness + color_data_format, raw_frame, header_size)
+
+    decoded = (timestamp, frame_type, width, height, color_data if encoding == 'tensor' else list(color_data))
+
+    if skip_unchanged:
+        last_crop = (frame_number,) + decoded[2:]
     # print "decoded:", decoded
     return decoded
 
 
+def decode_batch_openpose(raw_frame):
+    # [ commonTimestamp | frame type | person count | img_width | img_height ], then count x [ person index | visible ],
+    # then the count x img_height x img_width x 3 BGR block (zeros where the region is unknown)
+    header_format = "<qiHHH"
+    timestamp, frame_type, count, width, height = struct.unpack_from(header_format, raw_frame)
+    offset = struct.calcsize(header_format)
+    people = [struct.unpack_from("<IB", raw_frame, offset + n*struct.calcsize("<IB")) for n in range(count)]
+    offset += count*struct.calcsize("<IB")
+    crops = np.frombuffer(raw_frame[offset:], dtype=np.uint8).reshape((count, height, width, 3))
+    return timestamp, frame_type, width, height, people, crops
+
+
 def recv_all(sock, size):
     result = b''
     while len(result) < size:
@@ -83,7 +139,7 @@ if __name__ == '__main__':
     
     i = 0
     avg_frame_time = 0.0
-    do_plot = True if len(sys.argv) > 1 and sys.argv[1] == '--plot' else False
+    do_plot = True if '--plot' in sys.argv and encoding != 'tensor' else False
     
     while True:
         try:
@@ -94,6 +150,12 @@ if __name__ == '__main__':
             break
         print "Time taken for this frame: {}".format(t_end - t_begin)
         avg_frame_time += (t_end - t_begin)
+        if all_people:
+            timestamp, frame_type, width, height, people, crops = decode_batch_openpose(f)
+            print timestamp, frame_type, width, height, "people (index, visible):", people
+            print "\n\n"
+            i += 1
+            continue
         timestamp, frame_type, width, height, color_data = decode_frame_openpose(f)
         print timestamp, frame_type, width, height
 
@@ -5,18 +5,33 @@ import struct
 import numpy as np
 import binascii
 
-import datetime
 import time
 
+import os
 import subprocess
+import collections
+import errno
 # USAGE:
 # cd C:\openpose-master\openpose-master\windows\x64\Release
 # python openpose_server_02.py
+# python openpose_server_02.py --binary  (POSIX only: reads binary frame records from a pipe instead of parsing stdout)
 
 
 HOST = ''
 PORT = 9009
 
+# outbound queue of each client: a lagging client loses frames instead of stalling OpenPose and the other clients
+# policies: 'drop_oldest', 'latest_only' (only the newest frame is kept) or 'block' (blocking sendall, old behaviour)
+SEND_QUEUE_SIZE = 8
+STREAM_QUEUE_POLICY = {
+    'ClosestBody': 'drop_oldest',
+    'HandColorLH': 'drop_oldest',
+    'HandColorRH': 'drop_oldest',
+    'HeadColor': 'drop_oldest'
+}
+
+OPENPOSE_COMMAND = '1_user_asynchronous_output.exe -model_folder C:\\openpose-master\\openpose-master\\models'
+
 stream_id_dict = {
     'ClosestBody': '512',
     'HandColorLH': '1024',
@@ -33,6 +48,12 @@ head_img_height = 64
 head_img_width = 64
 n_img_channel = 3
 
+# binary frame records written with -binary_output (see cwc/frameRecordWriter.hpp)
+frame_record_magic = 0x31435743
+frame_record_header_format = '<IHHQfHH3H3HI'
+frame_record_header_size = struct.calcsize(frame_record_header_format)
+n_crop_regions = 3  # LH, RH, Head
+
 
 # # dummy data
 # np.random.seed(10)
@@ -61,6 +82,54 @@ def get_stream_type(stream_id):
             return strm_type
 
 
+def read_exactly(stream, size):
+    result = b''
+    while len(result) < size:
+        data = stream.read(size - len(result))
+        if not data:
+            raise EOFError("Error: Received only {} bytes into {} byte record".format(len(result), size))
+        result += data
+    return result
+
+
+def read_frame_record(stream):
+    """
+    Reads one binary frame record. Returns (frame_number, engaged, keypoints, crops), where crops has one entry per
+    region (LH, RH, Head) that is either None (region unknown) or (width, height, raw BGR bytes)
+    """
+    (record_size,) = struct.unpack('<I', read_exactly(stream, 4))
+    record = read_exactly(stream, record_size)
+    header = struct.unpack_from(frame_record_header_format, record)
+    magic, version, crop_mask, frame_number, engaged, n_kp, values_per_kp = header[:7]
+    crop_widths = header[7:7 + n_crop_regions]
+    crop_heights = header[7 + n_crop_regions:7 + 2 * n_crop_regions]
+    assert magic == frame_record_magic, "Invalid binary frame record"
+
+    offset = frame_record_header_size
+    keypoints = struct.unpack_from('<' + str(n_kp * values_per_kp) + 'f', record, offset)
+    offset += struct.calcsize('<' + str(n_kp * values_per_kp) + 'f')
+
+    crops = []
+    for region in range(n_crop_regions):
+        if crop_mask & (1 << region):
+            crop_size = crop_widths[region] * crop_heights[region] * n_img_channel
+            crops.append((crop_widths[region], crop_heights[region], record[offset:offset + crop_size]))
+            offset += crop_size
+        else:
+            crops.append(None)
+    return frame_number, engaged, keypoints, crops
+
+
+def pack_color_frame(t_now_abs, frame_type, crop, width, height):
+    load_size = struct.calcsize('qiHH' + str(width * height * n_img_channel) + 'H')
+    if crop is None:
+        pixels = np.zeros(width * height * n_img_channel, dtype='<u2')
+    else:
+        # same 'H' per channel layout as the text mode
+        pixels = np.frombuffer(crop[2], dtype=np.uint8).astype('<u2')
+    return struct.pack('<iqiHH', load_size, t_now_abs, frame_type, width, height) + pixels.tostring()
+
+
 class OpenposeServer():
     """
 
@@ -73,6 +142,9 @@ class OpenposeServer():
         # threading.Thread.__init__(self)
         self._data_received = {}
         self._stopped = False
+        self._send_queues = {}  # socket -> deque of [frame_index, data not sent yet]
+        self._dropped = {}  # socket -> number of dropped packets
+        self._frame_index = 0
 
     def _recv_all(self, sock, size):
         result = b''
@@ -92,11 +164,115 @@ class OpenposeServer():
         else:
             return False
 
+    def _accept_client(self, server_socket, outputs):
+        client_sock, client_addr = server_socket.accept()
+        print "Client (%s, %s) connected" % client_addr
+
+        try:
+            stream_id_bytes = self._recv_all(client_sock, 4)
+            stream_id = struct.unpack('<i', stream_id_bytes)[0]
+            print "stream_id = ", stream_id  # , "stream_type = ".format(stream_id_dict[str(stream_id)])
+        except:
+            print "Unable to receive complete stream id. Ignoring the client"
+            client_sock.close()
+            return
+
+        print "Received stream id. Verifying ..."
+        if is_valid_stream_id(stream_id):
+            stream_str = get_stream_type(stream_id)
+            print "Stream is valid: ", stream_str
+            print "Checking if stream is already connected..."
+            if stream_str not in self._connected_clients.values():
+                print "New stream. Accepting the connection {}:{}".format(client_addr[0], client_addr[1])
+                # client_sock.shutdown(socket.SHUT_WR) #o
+                client_sock.shutdown(socket.SHUT_RD)  # shut down further reading on client socket
+                # inputs += [client_sock] #o
+                outputs += [client_sock]  # add the socket in output list
+                self._connected_clients[client_sock] = stream_str
+                self._send_queues[client_sock] = collections.deque()
+                self._dropped[client_sock] = 0
+                if STREAM_QUEUE_POLICY[stream_str] != 'block':
+                    client_sock.setblocking(0)
+            else:
+                print "Stream already exists. Rejecting the connection."
+                client_sock.close()
+        else:
+            print "Rejecting invalid stream with stream id: {}".format(stream_id)
+            client_sock.close()
+
+    def _remove_client(self, send_sock, outputs):
+        send_sock.close()
+        print "broken connection, removing {} ({} packets dropped)".format(send_sock, self._dropped.pop(send_sock, 0))
+        # broken socket, remove it from * *
+        self._connected_clients.pop(send_sock)
+        self._send_queues.pop(send_sock, None)
+        if send_sock in outputs:
+            outputs.remove(send_sock)
+
+    def _send(self, send_sock, packed_data, outputs):
+        policy = STREAM_QUEUE_POLICY[self._connected_clients[send_sock]]
+        if policy == 'block':
+            try:
+                send_sock.sendall(packed_data)
+            except:
+                # broken socket connection
+                self._remove_client(send_sock, outputs)
+            return
+
+        queue = self._send_queues[send_sock]
+        # queue[0] may be partially sent already: dropping it would corrupt the stream
+        in_flight = 1 if queue and queue[0][2] else 0
+        dropped = 0
+        while len(queue) > in_flight and (len(queue) >= SEND_QUEUE_SIZE or
+                                          (policy == 'latest_only' and queue[-1][0] != self._frame_index)):
+            # latest_only: drop every packet of older frames (HandColorLH gets 2 packets per frame)
+            del queue[in_flight]
+            dropped += 1
+        if dropped:
+            if self._dropped[send_sock] == 0 or (self._dropped[send_sock] + dropped) // 100 != self._dropped[send_sock] // 100:
+                print "{} is lagging: {} packets dropped so far".format(self._connected_clients[send_sock],
+                                                                         self._dropped[send_sock] + dropped)
+            self._dropped[send_sock] += dropped
+        queue.append([self._frame_index, packed_data, False])
+        self._flush(send_sock, outputs)
+
+    def _flush(self, send_sock, outputs):
+        """ Sends as much of the queue as the socket takes without blocking """
+        queue = self._send_queues[send_sock]
+        while queue:
+            try:
+                sent = send_sock.send(queue[0][1])
+            except socket.error as e:
+                if e.errno in (errno.EAGAIN, errno.EWOULDBLOCK):
+                    return
+                self._remove_client(send_sock, outputs)
+                return
+            if sent == len(queue[0][1]):
+                queue.popleft()
+            else:
+                queue[0][1] = queue[0][1][sent:]
+                queue[0][2] = True  # partially sent
+
+    def _flush_writable(self, write_socks, outputs):
+        """ Sends the queues of every client whose socket takes more now, not only of those getting a new packet """
+        for sock in write_socks:
+            if sock in self._send_queues:
+                self._flush(sock, outputs)
+
+    def _drain(self, timeout=1.0):
+        """ Sends what is left in the queues once the frames stopped, waiting at most timeout seconds per client """
+        for sock, queue in self._send_queues.items():
+            try:
+                sock.settimeout(timeout)
+                while queue:
+                    sock.sendall(queue.popleft()[1])
+            except socket.error:
+                queue.clear()
+
     def run(self):
 
         # opening up a cpp process
-        proc = subprocess.Popen('1_user_asynchronous_output.exe -model_folder C:\\openpose-master\\openpose-master\\models',
-            bufsize=4096, stdout=subprocess.PIPE, shell=True)
+        proc = subprocess.Popen(OPENPOSE_COMMAND, bufsize=4096, stdout=subprocess.PIPE, shell=True)
         person_new_frame_detected = False
         person_keypoints_detected = False
         person_lh_detected = False
@@ -125,6 +301,9 @@ class OpenposeServer():
 
             line = proc.stdout.readline()
             # print "line is -----------", line
+            if not line:
+                print "OpenPose process closed its output"
+                break
 
             if "Person new frame:" in line:
                 # print "new frame is: ", line
@@ -155,6 +334,7 @@ class OpenposeServer():
                 continue
 
             if "[End]" in line:
+                self._frame_index += 1
                 person_new_frame_detected = False
                 person_keypoints_detected = False
                 person_lh_detected = False
@@ -179,50 +359,25 @@ class OpenposeServer():
                             # self._unset_sync()  ###
                             # continue  # while -> if: solved SyntaxError: 'continue' not properly in loop
 
+                self._flush_writable(write_socks, outputs)
+
                 for sock in read_socks:
                     # a new connection request received on the server_socket
                     if sock == server_socket:
-                        client_sock, client_addr = server_socket.accept()
-                        print "Client (%s, %s) connected" % client_addr
-
-                        try:
-                            stream_id_bytes = self._recv_all(client_sock, 4)
-                            stream_id = struct.unpack('<i', stream_id_bytes)[0]
-                            print "stream_id = ", stream_id  # , "stream_type = ".format(stream_id_dict[str(stream_id)])
-                        except:
-                            print "Unable to receive complete stream id. Ignoring the client"
-                            client_sock.close()
-
-                        print "Received stream id. Verifying ..."
-                        if is_valid_stream_id(stream_id):
-                            stream_str = get_stream_type(stream_id)
-                            print "Stream is valid: ", stream_str
-                            print "Checking if stream is already connected..."
-                            if stream_str not in self._connected_clients.values():
-                                print "New stream. Accepting the connection {}:{}".format(client_addr[0], client_addr[1])
-                                # client_sock.shutdown(socket.SHUT_WR) #o
-                                client_sock.shutdown(socket.SHUT_RD)  # shut down further reading on client socket
-                                # inputs += [client_sock] #o
-                                outputs += [client_sock]  # add the socket in output list
-                                self._connected_clients[client_sock] = stream_str
-                            else:
-                                print "Stream already exists. Rejecting the connection."
-                                client_sock.close()
-                        else:
-                            print "Rejecting invalid stream with stream id: {}".format(stream_id)
-                            client_sock.close()
+                        self._accept_client(server_socket, outputs)
 
                     # a message from/to a client on new socket (sock), not a new connection on server_socket
                     else:
                         print "non-server-connect socket detected in the inputs"
                         break
 
-                t_now = datetime.datetime.now()
-                t_now_abs = time.mktime(t_now.timetuple())
+                # packet timestamp: wall-clock ms (as the C++ stream server, which sends the capture time)
+                t_now_abs = int(time.time() * 1000)
 
                 # send the data to the clients or process the data received from the clients
                 # send only if all the clients connected? No
-                for send_sock in write_socks:
+                # every client gets the frame (queued if its socket is full), not only the writable ones
+                for send_sock in list(outputs):
                     if send_sock in self._connected_clients:
                         # print "send socket is present in the connected clients dictionary"
 
@@ -247,16 +402,7 @@ class OpenposeServer():
                                     # print "keypoints in floats: ", [float(kp) for kp in line[:-3].split(' ')]  # -3 since it removes '\r', '\n', and ''
                                 person_keypoints_detected = False
 
-                                try:
-                                    send_sock.sendall(packed_data)
-                                except:
-                                    # broken socket connection
-                                    send_sock.close()
-                                    print "broken connection, removing {}".format(send_sock)
-                                    # broken socket, remove it from * *
-                                    self._connected_clients.pop(send_sock)
-                                    if send_sock in outputs:
-                                        outputs.remove(send_sock)
+                                self._send(send_sock, packed_data, outputs)
 
                         if "HandColorLH" in self._connected_clients[send_sock]:
                             # print "line", line
@@ -279,16 +425,7 @@ class OpenposeServer():
 
                                 person_lh_detected = False
 
-                                try:
-                                    send_sock.sendall(packed_data)
-                                except:
-                                    # broken socket connection
-                                    send_sock.close()
-                                    print "broken connection, removing {}".format(send_sock)
-                                    # broken socket, remove it from * *
-                                    self._connected_clients.pop(send_sock)
-                                    if send_sock in outputs:
-                                        outputs.remove(send_sock)
+                                self._send(send_sock, packed_data, outputs)
 
                             frame_type = 1  # => right hand
 
@@ -306,16 +443,7 @@ class OpenposeServer():
 
                                 person_rh_detected = False
 
-                                try:
-                                    send_sock.sendall(packed_data)
-                                except:
-                                    # broken socket connection
-                                    send_sock.close()
-                                    print "broken connection, removing {}".format(send_sock)
-                                    # broken socket, remove it from * *
-                                    self._connected_clients.pop(send_sock)
-                                    if send_sock in outputs:
-                                        outputs.remove(send_sock)
+                                self._send(send_sock, packed_data, outputs)
 
                         if "HeadColor" in self._connected_clients[send_sock]:
                             frame_type = int(stream_id_dict["HeadColor"])
@@ -335,26 +463,84 @@ class OpenposeServer():
 
                                 person_head_detected = False
 
-                                try:
-                                    send_sock.sendall(packed_data)
-                                except:
-                                    # broken socket connection
-                                    send_sock.close()
-                                    print "broken connection, removing {}".format(send_sock)
-                                    # broken socket, remove it from * *
-                                    self._connected_clients.pop(send_sock)
-                                    if send_sock in outputs:
-                                        outputs.remove(send_sock)
+                                self._send(send_sock, packed_data, outputs)
 
 
                 person_new_frame_detected = True
 
+        self._drain()
+        server_socket.close()
+
+    def run_binary(self):
+        """
+        Same streams as run(), but the frames come as binary records through a pipe (-binary_output) instead of
+        being parsed from the text printed on stdout
+        """
+        read_fd, write_fd = os.pipe()
+        proc = subprocess.Popen(OPENPOSE_COMMAND + ' -binary_output fd:{}'.format(write_fd), shell=True, close_fds=False)
+        os.close(write_fd)
+        records = os.fdopen(read_fd, 'rb')
+
+        # setting up sockets
+        server_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        server_socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server_socket.bind((HOST, PORT))
+        server_socket.listen(5)
+        print("Server socket:", server_socket)
+
+        inputs = [server_socket]
+        outputs = []
+        print("Waiting for clients to connect ...")
+
+        while not self.is_stopped():
+            try:
+                frame_number, engaged, keypoints, crops = read_frame_record(records)
+            except EOFError:
+                print "OpenPose process closed the binary output"
+                break
+
+            self._frame_index = frame_number
+
+            read_socks, write_socks, except_socks = select.select(inputs, outputs, [], 0)
+            self._flush_writable(write_socks, outputs)
+            if server_socket in read_socks:
+                self._accept_client(server_socket, outputs)
+
+            t_now_abs = int(time.time() * 1000)
+
+            for send_sock in list(outputs):
+                if send_sock not in self._connected_clients:
+                    continue
+
+                if "ClosestBody" in self._connected_clients[send_sock]:
+                    frame_type = int(stream_id_dict["ClosestBody"])
+                    tracked_body_count = 100
+                    load_size = struct.calcsize('qiHH54f')
+                    packed_data = struct.pack('<iqhH55f', load_size, t_now_abs, frame_type, tracked_body_count,
+                                              engaged, *keypoints)
+                    self._send(send_sock, packed_data, outputs)
+
+                elif "HandColorLH" in self._connected_clients[send_sock]:
+                    for frame_type, crop in ((0, crops[0]), (1, crops[1])):  # 0 => left hand; 1 => right hand
+                        self._send(send_sock, pack_color_frame(t_now_abs, frame_type, crop, img_width, img_height), outputs)
+                        if send_sock not in self._connected_clients:
+                            break
+
+                elif "HeadColor" in self._connected_clients[send_sock]:
+                    frame_type = int(stream_id_dict["HeadColor"])
+                    self._send(send_sock, pack_color_frame(t_now_abs, frame_type, crops[2], head_img_width, head_img_height),
+                               outputs)
+
+        self._drain()
+        proc.wait()
         server_socket.close()
 
 
 if __name__ == "__main__":
     print ""
     opserver = OpenposeServer()
+    if len(sys.argv) > 1 and sys.argv[1] == '--binary':
+        sys.exit(opserver.run_binary())
     sys.exit(opserver.run())
 
     # run_openpose()
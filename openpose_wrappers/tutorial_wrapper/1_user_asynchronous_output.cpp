@@ -24,7 +24,9 @@
 
 // cwc 
 #include <assert.h>
+#include <cstdlib>
 #include <map>
+#include <new>
 
 // Allow Google Flags in Ubuntu 14
 #ifndef GFLAGS_GFLAGS_H_
@@ -32,6 +34,28 @@
 #endif
 // OpenPose dependencies
 #include <openpose/headers.hpp>
+// CwC dependencies
+#include "cwc/benchmarks.hpp"
+#include "cwc/cropBatch.hpp"
+#include "cwc/cropBufferPool.hpp"
+#include "cwc/cropChangeDetector.hpp"
+#include "cwc/cropTensor.hpp"
+#include "cwc/datumPool.hpp"
+#include "cwc/decodeReduction.hpp"
+#include "cwc/frameArchive.hpp"
+#include "cwc/frameRecordWriter.hpp"
+#include "cwc/frameTrace.hpp"
+#include "cwc/imagePrefetcher.hpp"
+#include "cwc/keypointCodec.hpp"
+#include "cwc/keypointFilter.hpp"
+#include "cwc/keypointPredictor.hpp"
+#include "cwc/latestFrameCapture.hpp"
+#include "cwc/multiCameraCapture.hpp"
+#include "cwc/personTable.hpp"
+#include "cwc/personTracker.hpp"
+#include "cwc/roiEngine.hpp"
+#include "cwc/sharedMemoryRing.hpp"
+#include "cwc/streamServer.hpp"
 
 
 // See all the available parameter options withe the `--help` flag. E.g. `./build/examples/openpose/openpose.bin --help`.
@@ -51,6 +75,10 @@ DEFINE_string(video,                    "",             "Use a video file instea
                                                         " example video.");
 DEFINE_string(image_dir,                "",             "Process a directory of images. Use `examples/media/` for our default example folder with 20"
                                                         " images. Read all standard formats (jpg, png, bmp, etc.).");
+DEFINE_int32(image_prefetch_workers,    2,              "With `image_dir`, number of threads that read and decode the images ahead of the pose"
+                                                        " extraction (in order). Select 0 to read them one by one on the producer thread (OpenPose"
+                                                        " image directory reader).");
+DEFINE_int32(image_prefetch_depth,      8,              "... and maximum number of images decoded ahead.");
 DEFINE_string(ip_camera,                "",             "String with the IP camera URL. It supports protocols like RTSP and HTTP.");
 DEFINE_uint64(frame_first,              0,              "Start on desired frame number. Indexes are 0-based, i.e. the first frame has index 0.");
 DEFINE_uint64(frame_last,               -1,             "Finish on desired frame number. Select -1 to disable. Indexes are 0-based, e.g. if set to"
@@ -60,6 +88,36 @@ DEFINE_int32(frame_rotate,              0,              "Rotate each frame, 4 po
 DEFINE_bool(frames_repeat,              false,          "Repeat frames when finished.");
 DEFINE_bool(process_real_time,          false,          "Enable to keep the original source frame rate (e.g. for video). If the processing time is"
                                                         " too long, it will skip frames. If it is too fast, it will slow it down.");
+DEFINE_bool(latest_frame_only,          false,          "Read the camera (or video, IP camera) on its own thread and always give the pose extraction"
+                                                        " its newest frame: the frames that arrive while OpenPose is busy are dropped (counted in"
+                                                        " the `trace_log_interval` log) instead of queued, so the skeleton never lags behind.");
+DEFINE_string(cameras,                  "",             "Comma-separated webcam indices or IP camera URLs read together, e.g. `0,1,2`, instead of"
+                                                        " `camera`: one pose extraction processes a frame of each (one datum per camera, see"
+                                                        " `cwc/multiCameraCapture.hpp`), and every output tells the camera index apart.");
+DEFINE_int32(camera_sync_ms,            15,             "... and the most their frames' capture times can differ: an older frame is dropped and its"
+                                                        " camera read again. Select 0 to take the newest frame of each camera as it is.");
+DEFINE_string(archive_input,            "",             "Replay a frame archive (see `cwc/frameArchive.hpp`) instead of the camera, video or image"
+                                                        " directory. With `process_real_time`, at the rate it was recorded, else as fast as possible.");
+DEFINE_string(archive_output,           "",             "Record the frames read by the producer (e.g. the camera) into a frame archive, to replay"
+                                                        " them later with `archive_input`.");
+DEFINE_string(archive_encoding,         "jpg",          "... and how its frames are stored: `jpg` (smaller) or `bgr` (pre-decoded, faster to replay).");
+DEFINE_int32(archive_jpeg_quality,      90,             "... and the JPEG quality [0, 100].");
+DEFINE_int32(decode_reduction,          1,              "The `image_dir` images and `archive_input` frames can be decoded at 1/2, 1/4 or 1/8 of"
+                                                        " their size (much faster for JPEG, see `cwc/decodeReduction.hpp`). The keypoints are still"
+                                                        " output in source coordinates and the pixel thresholds (engaged person, tracking,"
+                                                        " smoothing, unchanged crops) still apply to source pixels, but the hand/head crops are"
+                                                        " cut from the reduced frame, so they cover a larger region, and their x/y (text output"
+                                                        " and `shared_memory_name` ring) are in reduced frame pixels. Select 0 to use the largest"
+                                                        " reduction that keeps the frame at least as large as `net_resolution` and"
+                                                        " `decode_min_resolution`, 1 (default) to disable it.");
+DEFINE_string(decode_min_resolution,    "320x240",      "... and the smallest frame the hand/head crops (a fixed number of pixels) keep enough"
+                                                        " detail on. Use \"-1x-1\" to only keep the `net_resolution`.");
+DEFINE_int32(datum_pool_size,           16,             "Number of frame containers (datums and their frame buffers) recycled from one frame to the"
+                                                        " next instead of allocated, at least the frames in flight (OpenPose queues and output);"
+                                                        " `image_dir` and `archive_input` frames are decoded into the recycled buffers (see"
+                                                        " `cwc/datumPool.hpp`). `trace_log_interval` logs its high-water mark and"
+                                                        " `benchmark_producer` the allocations left per frame. Select 0 to allocate them for"
+                                                        " every frame.");
 // OpenPose
 DEFINE_string(model_folder,             "models/",      "Folder path (absolute or relative) where the models (pose, face, ...) are located.");
 DEFINE_string(output_resolution,        "320x240",        "The image resolution (display and output). Use \"-1x-1\" to force the program to use the"
@@ -170,6 +228,162 @@ DEFINE_string(write_heatmaps,           "",             "Directory to write body
                                                         " must be enabled.");
 DEFINE_string(write_heatmaps_format,    "png",          "File extension and format for `write_heatmaps`, analogous to `write_images_format`."
                                                         " Recommended `png` or any compressed and lossless format.");
+// CwC Output
+DEFINE_string(binary_output,            "",             "Write each frame as one length-prefixed binary record (keypoints as float32 and raw BGR"
+                                                        " crops, see `cwc/frameRecordWriter.hpp`) instead of logging it as text. Use `fd:N` for an"
+                                                        " inherited file descriptor (e.g. a pipe) or give a file / named pipe path. Leave it empty"
+                                                        " to keep the text output.");
+DEFINE_int32(stream_server_port,        0,              "Serve the ClosestBody / HandColorLH / HandColorRH / HeadColor streams directly from this"
+                                                        " process on this TCP port (e.g. 9009), replacing openpose_server_01.1.py, plus the"
+                                                        " AllBodies stream (every detected person in one packet). Linux only."
+                                                        " Select 0 (default) to disable it.");
+DEFINE_int32(stream_queue_size,         8,              "Maximum number of frames queued for each `stream_server_port` client. A client that falls"
+                                                        " further behind is handled as set in `stream_queue_policy`.");
+DEFINE_string(stream_queue_policy,      "drop_oldest",  "What to do when a client's queue is full: `drop_oldest`, `latest_only` (keep only the"
+                                                        " newest frame) or `block` (wait for the client, it slows down OpenPose). Add"
+                                                        " `stream=policy` entries to override it per stream, e.g."
+                                                        " `drop_oldest,HandColorLH=latest_only,ClosestBody=block`.");
+DEFINE_int32(keypoint_keyframe_interval, 30,             "Clients of `stream_server_port` that request compact keypoints (`keypoints=compact`)"
+                                                        " receive deltas against the previous frame and a full keyframe every this many"
+                                                        " frames, so a client that joins late or drops a packet resyncs within that time.");
+DEFINE_string(shared_memory_name,       "",             "Publish every frame into a POSIX shared-memory ring with this name (e.g. `/cwc_openpose`),"
+                                                        " so consumers on the same machine can read the newest frame without sockets or copies"
+                                                        " (see `cwc/sharedMemoryRing.hpp`). Leave it empty to disable it.");
+DEFINE_int32(shared_memory_slots,       4,              "Number of frames kept in the `shared_memory_name` ring. More slots give slow readers more"
+                                                        " time before the frame they are reading gets overwritten.");
+DEFINE_int32(trace_log_interval,        0,              "Log the mean/max time spent by the frames in each pipeline stage (producer, pose, output,"
+                                                        " crops, serialization and the `stream_server_port` send queues) every this many frames."
+                                                        " Select 0 (default) to disable it. Stream clients can also receive the stage times of"
+                                                        " every frame with the `trace=1` handshake option.");
+DEFINE_int32(crop_tensor_size,          64,             "Side of the hand/head tensors sent to the `stream_server_port` clients that ask for"
+                                                        " `encoding=tensor`: the crop resampled to this size and normalized, as float32 B, G, R"
+                                                        " planes ready for the classifiers (see `cwc/cropTensor.hpp`).");
+DEFINE_double(crop_tensor_scale,        0,              "Side of the region sampled for those tensors, as a multiple of the person's average limb"
+                                                        " length, so they do not depend on the distance to the camera. Select 0 (default) to"
+                                                        " sample the fixed-size crop.");
+DEFINE_string(crop_tensor_mean,         "0,0,0",        "Per-channel mean (B,G,R, in pixel values 0-255) subtracted from the tensor values.");
+DEFINE_string(crop_tensor_std,          "1,1,1",        "Per-channel standard deviation (B,G,R, in pixel values 0-255) the tensor values are divided"
+                                                        " by, after subtracting `crop_tensor_mean`.");
+DEFINE_double(crop_unchanged_threshold, 3,              "Crops of the `stream_server_port` clients that ask for `unchanged=1` are replaced by a"
+                                                        " short packet while they stay the same as the last one sent: mean absolute difference"
+                                                        " (0-255) of their 8x8 thumbnails up to this value...");
+DEFINE_int32(crop_unchanged_max_shift,  2,              "... and the region moved by at most this many pixels (along x and y).");
+DEFINE_int32(crop_unchanged_refresh,    30,             "Those crops are still sent at least every this many frames, so a client that missed one"
+                                                        " resyncs within that time.");
+DEFINE_double(tracking_max_distance,    64,             "People are followed from frame to frame (stable AllBodies indices and `track=1` stream ids,"
+                                                        " and the engaged person stays engaged): maximum mean keypoint displacement (pixels)"
+                                                        " between two frames of the same person...");
+DEFINE_int32(tracking_max_missed,       5,              "... and number of frames a person can go undetected (e.g. occluded) and keep its id.");
+DEFINE_double(smoothing_min_cutoff,     1.0,            "The keypoints of every tracked person are smoothed (One Euro filter, which removes most of"
+                                                        " the jitter of a low `net_resolution`) before they are output: cutoff frequency (Hz) of"
+                                                        " a still keypoint. Lower is smoother but lags more. Select 0 to output the raw keypoints.");
+DEFINE_double(smoothing_beta,           0.007,          "Increase of that cutoff frequency per pixel/second of keypoint speed. Higher lags less"
+                                                        " on fast movements.");
+DEFINE_double(smoothing_derivative_cutoff, 1.0,         "Cutoff frequency (Hz) of the keypoint speed estimate of the filter.");
+DEFINE_int32(prediction_history,        4,              "Frames (2-8) the keypoint velocities are fitted on, for the `stream_server_port` ClosestBody"
+                                                        " client that asks for keypoints extrapolated to its presentation time (`predict=<ms>`).");
+// CwC Benchmarks
+DEFINE_int32(benchmark_crops,           0,              "Instead of running OpenPose, time this many crop extractions (per-pixel access, cv::Mat"
+                                                        " copy, pooled row copies and text formatting) on a synthetic `camera_resolution` frame"
+                                                        " and exit. Select 0 (default) to run normally.");
+DEFINE_int32(benchmark_people,          0,              "Instead of running OpenPose, time the per-frame person table (centroids, limb lengths and"
+                                                        " central-frame flags) of this many synthetic people (e.g. 50 for a crowded scene) in a"
+                                                        " `camera_resolution` frame, against the previous std::map code, and exit.");
+DEFINE_int32(benchmark_producer,        0,              "Instead of running OpenPose, read twice this many frames of the input (e.g. `image_dir`"
+                                                        " or `archive_input`, with `frames_repeat`) through the producer and `datum_pool_size`,"
+                                                        " keeping as many in flight as the pool holds, and log the time and frame buffer"
+                                                        " allocations per frame of the second half, then exit. The heap allocations are only"
+                                                        " counted in a build with CWC_COUNT_ALLOCATIONS defined.");
+
+
+#ifdef CWC_COUNT_ALLOCATIONS
+// Benchmark builds only (compiled with -DCWC_COUNT_ALLOCATIONS): every heap allocation of the program is counted for
+// benchmark_producer (cwc::getHeapAllocations), one relaxed atomic increment on top of malloc/free. The plain, array,
+// nothrow and (C++17) aligned forms are all replaced, so the count covers OpenPose and the other libraries too.
+namespace
+{
+    // alignment 0: that of malloc
+    void* allocateCounted(const std::size_t size, const std::size_t alignment)
+    {
+        cwc::getHeapAllocations().fetch_add(1ull, std::memory_order_relaxed);
+        const auto bytes = (size == 0 ? 1 : size);
+        while (true)
+        {
+            void* memory = nullptr;
+            if (alignment == 0)
+                memory = std::malloc(bytes);
+            else
+            {
+                #ifdef _WIN32
+                    memory = _aligned_malloc(bytes, alignment);
+                #else
+                    if (posix_memalign(&memory, alignment, bytes) != 0)
+                        memory = nullptr;
+                #endif
+            }
+            if (memory != nullptr)
+                return memory;
+            const auto newHandler = std::get_new_handler();
+            if (newHandler == nullptr)
+                throw std::bad_alloc{};
+            newHandler();
+        }
+    }
+
+    void* allocateCountedNoThrow(const std::size_t size, const std::size_t alignment) noexcept
+    {
+        try
+        {
+            return allocateCounted(size, alignment);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return nullptr;
+        }
+    }
+}
+
+void* operator new(std::size_t size) { return allocateCounted(size, 0); }
+void* operator new[](std::size_t size) { return allocateCounted(size, 0); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocateCountedNoThrow(size, 0); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocateCountedNoThrow(size, 0); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+#ifdef __cpp_sized_deallocation
+    void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+    void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+#endif
+#ifdef __cpp_aligned_new
+    // _aligned_malloc memory needs _aligned_free
+    static void freeAligned(void* memory) noexcept
+    {
+        #ifdef _WIN32
+            _aligned_free(memory);
+        #else
+            std::free(memory);
+        #endif
+    }
+
+    void* operator new(std::size_t size, std::align_val_t alignment) { return allocateCounted(size, (std::size_t)alignment); }
+    void* operator new[](std::size_t size, std::align_val_t alignment) { return allocateCounted(size, (std::size_t)alignment); }
+    void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+    {
+        return allocateCountedNoThrow(size, (std::size_t)alignment);
+    }
+    void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+    {
+        return allocateCountedNoThrow(size, (std::size_t)alignment);
+    }
+    void operator delete(void* memory, std::align_val_t) noexcept { freeAligned(memory); }
+    void operator delete[](void* memory, std::align_val_t) noexcept { freeAligned(memory); }
+    void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { freeAligned(memory); }
+    void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { freeAligned(memory); }
+    void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { freeAligned(memory); }
+    void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { freeAligned(memory); }
+#endif
+#endif
 
 
 // If the user needs his own variables, he can inherit the op::Datum struct and add them
@@ -177,10 +391,16 @@ DEFINE_string(write_heatmaps_format,    "png",          "File extension and form
 // Wrapper<op::Datum>
 struct UserDatum : public op::Datum
 {
-    bool boolThatUserNeedsForSomeReason;
-
-    UserDatum(const bool boolThatUserNeedsForSomeReason_ = false) :
-        boolThatUserNeedsForSomeReason{boolThatUserNeedsForSomeReason_}
+    // Sequence number and monotonic stage times, from the capture (WUserInput) to the serialization (UserOutputClass)
+    cwc::FrameTrace trace;
+    // Source pixels per pixel of cvInputData (decoded reduced, see cwc/decodeReduction.hpp)
+    float sourceScale;
+    // Camera of the frame (its index in FLAGS_cameras, 0 with a single camera). The frames of one set share their sequence.
+    unsigned int cameraIndex;
+
+    UserDatum() :
+        sourceScale{1.f},
+        cameraIndex{0u}
     {}
 };
 
@@ -188,149 +408,309 @@ struct UserDatum : public op::Datum
 // that the user usually knows which kind of data he will move between the queues,
 // in this case we assume a std::shared_ptr of a std::vector of UserDatum
 
-// This worker will just read and return all the jpg files in a directory
-class UserOutputClass
+// This worker reads the frames of the producer selected by the flags (what the wrapper does itself when it receives the
+// producer in WrapperStructInput), of the image prefetcher, of a frame archive or of several cameras at once, so that each
+// frame gets its sequence number and capture time. It can also record them into a frame archive.
+class WUserInput : public op::WorkerProducer<std::shared_ptr<std::vector<UserDatum>>>
 {
 public:
+    // latestFrameOnly: the producer is read by a cwc::LatestFrameCapture thread
+    WUserInput(const std::shared_ptr<op::Producer>& producerSharedPtr, const unsigned long long frameFirst,
+               const unsigned long long frameLast, const bool processRealTime, const bool frameFlip, const int frameRotate,
+               const bool framesRepeat, const bool latestFrameOnly = false) :
+        spProducer{producerSharedPtr},
+        mFrameLast{frameLast},
+        mFrameNumber{frameFirst},
+        mSequence{0ull}
+    {
+        if (spProducer == nullptr || !spProducer->isOpened())
+            op::error("The frame producer could not be opened.", __LINE__, __FUNCTION__, __FILE__);
+        spProducer->setProducerFpsMode(processRealTime ? op::ProducerFpsMode::OriginalFps
+                                                       : op::ProducerFpsMode::RetrieveAsFastAsPossible);
+        spProducer->set(op::ProducerProperty::Flip, frameFlip);
+        spProducer->set(op::ProducerProperty::Rotation, frameRotate);
+        spProducer->set(op::ProducerProperty::AutoRepeat, framesRepeat);
+        if (frameFirst > 0)
+            spProducer->set(CV_CAP_PROP_POS_FRAMES, (double)frameFirst);
+        if (latestFrameOnly)
+            upLatestFrameCapture.reset(new cwc::LatestFrameCapture{spProducer});
+    }
 
-	struct DetectedPerson {
-		bool isWithinCentralFrame;
-		float averageLimbLength;
-		float meanKeypointX;
-		float meanKeypointY;
-	};
+    // imagePrefetcher: images from frameFirst on (flip, rotation and repeat are applied by the prefetcher)
+    WUserInput(const std::shared_ptr<cwc::ImagePrefetcher>& imagePrefetcher, const unsigned long long frameFirst,
+               const unsigned long long frameLast) :
+        spImagePrefetcher{imagePrefetcher},
+        mFrameLast{frameLast},
+        mFrameNumber{frameFirst},
+        mSequence{0ull}
+    {
+        if (spImagePrefetcher == nullptr || spImagePrefetcher->isFinished())
+            op::error("No images to read.", __LINE__, __FUNCTION__, __FILE__);
+    }
 
-	std::map<int, DetectedPerson> PersonMap;
+    // frameArchiveReplay: frames from frameFirst on (given to the replay)
+    WUserInput(const std::shared_ptr<cwc::FrameArchiveReplay>& frameArchiveReplay, const unsigned long long frameFirst,
+               const unsigned long long frameLast) :
+        spFrameArchiveReplay{frameArchiveReplay},
+        mFrameLast{frameLast},
+        mFrameNumber{frameFirst},
+        mSequence{0ull}
+    {
+        if (spFrameArchiveReplay == nullptr || spFrameArchiveReplay->isFinished())
+            op::error("No frames to replay.", __LINE__, __FUNCTION__, __FILE__);
+    }
 
-	void populatePersonMap(const op::Array<float>& poseKeypoints, const unsigned res_x)
-	{
-		// {personId: InsideCentralFrame?, AverageLimbLength, CentroidOfKeypoints} 
-		//std::map<int, DetectedPerson> PersonMap;
-
-		// central window of the camera frame along x resolution
-		unsigned central_window_x_start = (unsigned)(res_x / 3), central_window_x_end = (unsigned)(2 * res_x / 3);  // [--|--|--]
-		//op::log("central_window_x_start and end: " + std::to_string(central_window_x_start) + " " + std::to_string(central_window_x_end));
-
-		int middleJoints[] = {0, 1, 2, 5};  // joint to be considered to find the mean keypoint
-		
-		for (auto person = 0; person < poseKeypoints.getSize(0); person++) {
-			float temp_meanKeypointX = 0;
-			//float temp_meanKeypointY = 0;
-			int kpCountX = 0, kpCountY = 0;
-			// temp points for limb length calculations
-			cv::Vec2f pointA, pointB;
-			float temp_averageLimbLength = 0;
-			int limbCount = 0;
-
-			for (auto bodyPartIndex = 0; bodyPartIndex < sizeof(middleJoints)/sizeof(middleJoints[0]); bodyPartIndex++)
-			{
-				if (poseKeypoints[{person, middleJoints[bodyPartIndex], 0}] > 0.00001) {
-					temp_meanKeypointX = temp_meanKeypointX + poseKeypoints[{person, middleJoints[bodyPartIndex], 0}];
-					kpCountX++;
-				}  // if X not zero
-
-				//if (bodyPart == 0 || bodyPart == 1 || bodyPart == 2 || bodyPart == 5) {
-				//	if (poseKeypoints[{person, bodyPart, 0}] > 0.00001) {
-				//		temp_meanKeypointX = temp_meanKeypointX + poseKeypoints[{person, bodyPart, 0}];
-				//		kpCountX++;
-				//	}  // if X not zero
-
-				//	//if (poseKeypoints[{person, bodyPart, 1}] > 0.00001) {
-				//	//	temp_meanKeypointY = temp_meanKeypointY + poseKeypoints[{person, bodyPart, 1}];
-				//	//	kpCountY++;
-				//	//}  // if Y not zero
-				//} // if the bodyPart is one of 0, 1, 2, 5
-
-			}  // for body parts
-
-			temp_meanKeypointX = temp_meanKeypointX / kpCountX;
-			PersonMap[person].meanKeypointX = temp_meanKeypointX;
-			//temp_meanKeypointY = temp_meanKeypointY / kpCountY;
-			//PersonMap[person].meanKeypointY = temp_meanKeypointY;
-
-			if (temp_meanKeypointX >= central_window_x_start && temp_meanKeypointX <= central_window_x_end) {
-				PersonMap[person].isWithinCentralFrame = true;
-			}
-			else {
-				PersonMap[person].isWithinCentralFrame = false;
-			}
+    // multiCameraCapture: one datum per camera, the newest synchronized set of frames (flip and rotation are set on the
+    // producers, the capture threads read them)
+    WUserInput(const std::shared_ptr<cwc::MultiCameraCapture>& multiCameraCapture, const unsigned long long frameLast) :
+        spMultiCameraCapture{multiCameraCapture},
+        mFrameLast{frameLast},
+        mFrameNumber{0ull},
+        mSequence{0ull}
+    {
+        if (spMultiCameraCapture == nullptr)
+            op::error("No cameras to read.", __LINE__, __FUNCTION__, __FILE__);
+    }
 
-			// average limb length calculation per person
-			// limbs are: | 0-1 | 2-1 | 5-1 | 8-1 | 11-1 | 3-2 | 6-5 | and not considered following: | 4-3 | 7-6 | and not considered following: | 14-0 | 15-0 | 16-14 | 17-15 |
+    // Records every frame read (after its flip and rotation) with its capture time
+    void setFrameArchiveWriter(const std::shared_ptr<cwc::FrameArchiveWriter>& frameArchiveWriter)
+    {
+        spFrameArchiveWriter = frameArchiveWriter;
+    }
 
-			if (poseKeypoints[{person, 1, 0}] > 0.00001 && poseKeypoints[{person, 1, 1}] > 0.00001)  // if x and y both are not zero
-			{
-				pointA[0] = poseKeypoints[{person, 1, 0}];  // X1
-				pointA[1] = poseKeypoints[{person, 1, 1}];  // Y1
-				if (poseKeypoints[{person, 0, 0}] > 0.00001 && poseKeypoints[{person, 0, 1}] > 0.00001)  // | 0-1 |
-				{
-					pointB[0] = poseKeypoints[{person, 0, 0}];  // X0
-					pointB[1] = poseKeypoints[{person, 0, 1}];  // Y0
-					temp_averageLimbLength = temp_averageLimbLength + norm(pointB -pointA);  // | 0-1 |
-					limbCount++;
-				}
-				if (poseKeypoints[{person, 2, 0}] > 0.00001 && poseKeypoints[{person, 2, 1}] > 0.00001)  // | 2-1 |
-				{
-					pointB[0] = poseKeypoints[{person, 2, 0}];  // X2
-					pointB[1] = poseKeypoints[{person, 2, 1}];  // Y2
-					temp_averageLimbLength = temp_averageLimbLength + norm(pointB - pointA);  // | 2-1 |
-					limbCount++;
-				}
-				if (poseKeypoints[{person, 5, 0}] > 0.00001 && poseKeypoints[{person, 5, 1}] > 0.00001)  // | 5-1 |
-				{
-					pointB[0] = poseKeypoints[{person, 5, 0}];  // X5
-					pointB[1] = poseKeypoints[{person, 5, 1}];  // Y5
-					temp_averageLimbLength = temp_averageLimbLength + norm(pointB - pointA);  // | 5-1 |
-					limbCount++;
-				}
-				if (poseKeypoints[{person, 8, 0}] > 0.00001 && poseKeypoints[{person, 8, 1}] > 0.00001)  // | 8-1 |
-				{
-					pointB[0] = poseKeypoints[{person, 8, 0}];  // X8
-					pointB[1] = poseKeypoints[{person, 8, 1}];  // Y8
-					temp_averageLimbLength = temp_averageLimbLength + norm(pointB - pointA);  // | 8-1 |
-					limbCount++;
-				}
-				if (poseKeypoints[{person, 11, 0}] > 0.00001 && poseKeypoints[{person, 11, 1}] > 0.00001)  // | 11-1 |
-				{
-					pointB[0] = poseKeypoints[{person, 11, 0}];  // X11
-					pointB[1] = poseKeypoints[{person, 11, 1}];  // Y11
-					temp_averageLimbLength = temp_averageLimbLength + norm(pointB - pointA);  // | 11-1 |
-					limbCount++;
-				}
+    // Takes the datum vectors from datumPool (and decodes the images/archived frames into their recycled frames) instead
+    // of allocating them for every frame
+    void setDatumPool(const std::shared_ptr<cwc::DatumPool<UserDatum>>& datumPool)
+    {
+        spDatumPool = datumPool;
+    }
 
-			}  // if joint 1 is not zero
+    void initializationOnThread() {}
 
-			// if joints | 3-2 | are not zero
-			if (poseKeypoints[{person, 3, 0}] > 0.00001 && poseKeypoints[{person, 3, 1}] > 0.00001 && poseKeypoints[{person, 2, 0}] > 0.00001 && poseKeypoints[{person, 2, 1}]) 
+    std::shared_ptr<std::vector<UserDatum>> workProducer()
+    {
+        try
+        {
+            // Close program when the last frame was read
+            if (mFrameNumber > mFrameLast || isFinished())
+            {
+                op::log("Last frame read and added to queue. Closing program after it is processed.", op::Priority::High);
+                this->stop();
+                return nullptr;
+            }
+            if (spMultiCameraCapture != nullptr)
+                return readCameras();
+            // Create new datum
+            auto datumsPtr = newDatums(1);
+            auto& datum = datumsPtr->at(0);
+
+            // Fill datum
+            datum.trace.stamp(cwc::TraceStage::ProducerStart);
+            if (spImagePrefetcher != nullptr)
+            {
+                spImagePrefetcher->next(datum.cvInputData, mImagePath);
+                datum.trace.stamp(cwc::TraceStage::Captured);
+                // Unreadable image: skipped
+                if (datum.cvInputData.empty())
+                {
+                    op::log("Image " + mImagePath + " could not be read, skipped.", op::Priority::High);
+                    mFrameNumber++;
+                    return nullptr;
+                }
+                cwc::getFileNameNoExtension(mImagePath, datum.name);
+                datum.sourceScale = (float)spImagePrefetcher->getReduction();
+            }
+            else if (spFrameArchiveReplay != nullptr)
+            {
+                auto index = 0ull;
+                spFrameArchiveReplay->next(datum.cvInputData, index);
+                datum.trace.stamp(cwc::TraceStage::Captured);
+                if (datum.cvInputData.empty())
+                {
+                    op::log("Frame " + std::to_string(index) + " of the archive could not be decoded, skipped.",
+                            op::Priority::High);
+                    mFrameNumber++;
+                    return nullptr;
+                }
+                datum.name = std::to_string(index);
+                datum.sourceScale = (float)spFrameArchiveReplay->getReduction();
+            }
+            // Newest frame of the capture thread (with its capture times)
+            else if (upLatestFrameCapture != nullptr)
+            {
+                if (!upLatestFrameCapture->next(datum.cvInputData, datum.name, datum.trace))
+                {
+                    op::log("Frame capture closed (" + std::to_string(upLatestFrameCapture->getTotalDroppedFrames())
+                            + " frames dropped). Closing program after the queued frames are processed.", op::Priority::High);
+                    this->stop();
+                    return nullptr;
+                }
+            }
+            else
+            {
+                datum.name = spProducer->getFrameName();
+                datum.cvInputData = spProducer->getFrame();
+                datum.trace.stamp(cwc::TraceStage::Captured);
+            }
+            // Empty frame: end of a video or image directory, or a camera error
+            if (datum.cvInputData.empty())
+            {
+                if (!spProducer->isOpened())
+                {
+                    op::log("Empty frame detected. Closing program after the queued frames are processed.", op::Priority::High);
+                    this->stop();
+                }
+                return nullptr;
+            }
+            if (spFrameArchiveWriter != nullptr)
+                spFrameArchiveWriter->write(datum.cvInputData, datum.trace.getCaptureTime());
+            datum.cvOutputData = datum.cvInputData;
+            datum.id = mSequence;
+            datum.trace.sequence = mSequence++;
+            mFrameNumber++;
+            return datumsPtr;
+        }
+        catch (const std::exception& e)
+        {
+            op::log("Some kind of unexpected error happened.");
+            this->stop();
+            op::error(e.what(), __LINE__, __FUNCTION__, __FILE__);
+            return nullptr;
+        }
+    }
+
+private:
+    const std::shared_ptr<op::Producer> spProducer;
+    const std::shared_ptr<cwc::ImagePrefetcher> spImagePrefetcher;
+    const std::shared_ptr<cwc::FrameArchiveReplay> spFrameArchiveReplay;
+    std::shared_ptr<cwc::FrameArchiveWriter> spFrameArchiveWriter;
+    std::shared_ptr<cwc::DatumPool<UserDatum>> spDatumPool;
+    std::unique_ptr<cwc::LatestFrameCapture> upLatestFrameCapture;
+    const std::shared_ptr<cwc::MultiCameraCapture> spMultiCameraCapture;
+    const unsigned long long mFrameLast;
+    unsigned long long mFrameNumber;
+    unsigned long long mSequence;
+    // Last set of spMultiCameraCapture
+    std::vector<cv::Mat> mCameraFrames;
+    std::vector<std::string> mCameraNames;
+    // Path of the last image read (its memory reused from frame to frame)
+    std::string mImagePath;
+    std::vector<cwc::FrameTrace> mCameraTraces;
+
+    // One datum per camera of spMultiCameraCapture, all with the same sequence
+    std::shared_ptr<std::vector<UserDatum>> readCameras()
+    {
+        if (!spMultiCameraCapture->next(mCameraFrames, mCameraNames, mCameraTraces))
+        {
+            op::log("Camera closed (" + std::to_string(spMultiCameraCapture->getTotalDroppedFrames())
+                    + " frames dropped). Closing program after the queued frames are processed.", op::Priority::High);
+            this->stop();
+            return nullptr;
+        }
+        auto datumsPtr = newDatums(mCameraFrames.size());
+        for (auto camera = 0u ; camera < datumsPtr->size() ; camera++)
+        {
+            auto& datum = datumsPtr->at(camera);
+            datum.cameraIndex = camera;
+            datum.name = mCameraNames[camera];
+            datum.cvInputData = mCameraFrames[camera];
+            datum.cvOutputData = datum.cvInputData;
+            datum.trace = mCameraTraces[camera];
+            datum.id = mSequence;
+            datum.trace.sequence = mSequence;
+        }
+        mSequence++;
+        mFrameNumber++;
+        return datumsPtr;
+    }
+
+    std::shared_ptr<std::vector<UserDatum>> newDatums(const std::size_t numberDatums)
+    {
+        if (spDatumPool != nullptr)
+            return spDatumPool->acquire(numberDatums);
+        return std::make_shared<std::vector<UserDatum>>(numberDatums);
+    }
+
+    bool isFinished() const
+    {
+        if (spMultiCameraCapture != nullptr)
+            return spMultiCameraCapture->isClosed();
+        if (upLatestFrameCapture != nullptr)
+            return upLatestFrameCapture->isClosed();
+        if (spProducer != nullptr)
+            return !spProducer->isOpened();
+        if (spImagePrefetcher != nullptr)
+            return spImagePrefetcher->isFinished();
+        return spFrameArchiveReplay->isFinished();
+    }
+};
+
+// This worker only timestamps the frames once OpenPose is done with them. The 1.x wrapper has no hook between its input
+// queue and the pose extraction, so the trace measures both together (cwc::TraceStage::PoseDone).
+class WUserPostProcessing : public op::Worker<std::shared_ptr<std::vector<UserDatum>>>
+{
+public:
+    void initializationOnThread() {}
+
+    void work(std::shared_ptr<std::vector<UserDatum>>& datumsPtr)
+    {
+        if (datumsPtr != nullptr)
+            for (auto& datum : *datumsPtr)
+                datum.trace.stamp(cwc::TraceStage::PoseDone);
+    }
+};
+
+// This worker will just read and return all the jpg files in a directory
+class UserOutputClass
+{
+public:
+	// binaryOutput, sharedMemoryName, sharedMemorySlots, keypointKeyframeInterval and traceLogInterval: see the FLAGS_ with
+	// the same name. Frames are only logged as text if there is neither a binary output, a stream server nor a shared-memory ring.
+	// cropTensorizer: builds the tensors of the encoding=tensor stream clients (none without it). cropChangeSettings: when the
+	// crops of the unchanged=1 stream clients count as unchanged. trackerSettings: how people are followed across frames.
+	// keypointFilterSettings: how the keypoints are smoothed along each track (output as they are if disabled).
+	// keypointPredictorSettings: how the keypoint velocities of the predict=... stream clients are estimated. The tracks,
+	// keypoint codec and crop history are kept for each camera (UserDatum::cameraIndex).
+	UserOutputClass(const std::string& binaryOutput = "", const std::shared_ptr<cwc::StreamServer>& streamServer = nullptr,
+	                const std::string& sharedMemoryName = "", const unsigned int sharedMemorySlots = 4,
+	                const unsigned int keypointKeyframeInterval = 30, const unsigned int traceLogInterval = 0,
+	                const std::shared_ptr<cwc::CropTensorizer>& cropTensorizer = nullptr,
+	                const cwc::CropChangeSettings& cropChangeSettings = cwc::CropChangeSettings{},
+	                const cwc::TrackerSettings& trackerSettings = cwc::TrackerSettings{},
+	                const cwc::KeypointFilterSettings& keypointFilterSettings = cwc::KeypointFilterSettings{},
+	                const cwc::KeypointPredictorSettings& keypointPredictorSettings = cwc::KeypointPredictorSettings{},
+	                const std::shared_ptr<cwc::DatumPool<UserDatum>>& datumPool = nullptr) :
+		spStreamServer{streamServer},
+		spCropTensorizer{cropTensorizer},
+		spDatumPool{datumPool},
+		mKeypointKeyframeInterval{keypointKeyframeInterval},
+		mCropChangeSettings{cropChangeSettings},
+		mTrackerSettings{trackerSettings},
+		mKeypointFilterSettings{keypointFilterSettings},
+		mKeypointPredictorSettings{keypointPredictorSettings},
+		mFrameCounter{0ull},
+		mCropBuffers{mRoiEngine.getMaxCropBytes()},
+		mTraceLogInterval{traceLogInterval}
+	{
+		if (!binaryOutput.empty())
+			upFrameRecordWriter.reset(new cwc::FrameRecordWriter{binaryOutput});
+		if (spCropTensorizer != nullptr)
+			mTensorBuffers.resize(cwc::CROP_NUMBER_REGIONS * spCropTensorizer->getNumberValues());
+		if (!sharedMemoryName.empty())
+		{
+			try
 			{
-				pointA[0] = poseKeypoints[{person, 2, 0}];  // X2
-				pointA[1] = poseKeypoints[{person, 2, 1}];  // Y2
-				pointB[0] = poseKeypoints[{person, 3, 0}];  // X3
-				pointB[1] = poseKeypoints[{person, 3, 1}];  // Y3
-				temp_averageLimbLength = temp_averageLimbLength + norm(pointB - pointA);  // | 3-2 |
-				limbCount++;
-			}  // if joints | 3-2 | are not zero
-
-			// if joints | 6-5 | are not zero
-			if (poseKeypoints[{person, 6, 0}] > 0.00001 && poseKeypoints[{person, 6, 1}] > 0.00001 && poseKeypoints[{person, 5, 0}] > 0.00001 && poseKeypoints[{person, 5, 1}])
+				upSharedMemoryRing.reset(new cwc::SharedMemoryRingWriter{
+					sharedMemoryName, sharedMemorySlots, (unsigned int)mRoiEngine.getMaxCropBytes()});
+			}
+			catch (const std::exception& e)
 			{
-				pointA[0] = poseKeypoints[{person, 5, 0}];  // X5
-				pointA[1] = poseKeypoints[{person, 5, 1}];  // Y5
-				pointB[0] = poseKeypoints[{person, 6, 0}];  // X6
-				pointB[1] = poseKeypoints[{person, 6, 1}];  // Y6
-				temp_averageLimbLength = temp_averageLimbLength + norm(pointB - pointA);  // | 6-5 |
-				limbCount++;
-			}  // if joints | 6-5 | are not zero
-
-			if (limbCount != 0) {
-				PersonMap[person].averageLimbLength = temp_averageLimbLength / limbCount;
+				op::error(e.what(), __LINE__, __FUNCTION__, __FILE__);
 			}
-			
-		}  // for person
-
+		}
 	}
-	
-    bool display(const std::shared_ptr<std::vector<op::Datum>>& datumsPtr)
+
+    bool display(const std::shared_ptr<std::vector<UserDatum>>& datumsPtr)
     {
         // User's displaying/saving/other processing here
             // datum.cvOutputData: rendered frame with pose or heatmaps
@@ -339,7 +719,8 @@ public:
 		//op::log();
         if (datumsPtr != nullptr && !datumsPtr->empty())
         {
-            cv::imshow("User worker GUI", datumsPtr->at(0).cvOutputData);  // (cv::Rect(1, 1, 200, 200))
+            for (const auto& datum : *datumsPtr)
+                cv::imshow(getWindowName("User worker GUI", datum.cameraIndex), datum.cvOutputData);  // (cv::Rect(1, 1, 200, 200))
             // Display image and sleeps at least 1 ms (it usually sleeps ~5-10 msec to display the image)
             key = (char)cv::waitKey(1);
         }
@@ -349,341 +730,218 @@ public:
     }
 
 
-    bool printKeypoints(const std::shared_ptr<std::vector<op::Datum>>& datumsPtr)
+    bool printKeypoints(const std::shared_ptr<std::vector<UserDatum>>& datumsPtr)
     {	
 		char key = ' ';
         // Example: How to use the pose keypoints
         if (datumsPtr != nullptr && !datumsPtr->empty())
         {
-			// cwc // for LH RH image cropping
-			unsigned int hand_img_width = 64, hand_img_height = 64;
-			unsigned int head_img_width = 64, head_img_height = 64;
-			unsigned int res_x, res_y;
-			int left_hand_img_x_start = 0, left_hand_img_y_start = 0, left_hand_img_x_end = 0, left_hand_img_y_end = 0;  // LH: upper left x and y; lower right x and y
-			int right_hand_img_x_start = 0, right_hand_img_y_start = 0, right_hand_img_x_end = 0, right_hand_img_y_end = 0;  // RH: upper left x and y; lower right x and y
-			int head_img_x_start = 0, head_img_y_start = 0, head_img_x_end = 0, head_img_y_end = 0;  // Head: upper left x and y; lower right x and y
-			
-			// for palm keypoint calculations
-			float lhForearmLength = 0, rhForearmLength = 0;
-			cv::Vec2f lhForearmVect, rhForearmVect;
-			float palmRatio = 0.50;  // ideally 0.167
-
-			// { 0,  "Nose" },
-			cv::Vec2f noseXY;
-			// { 4,  "RWrist" }, { 7,  "LWrist" }, 
-			cv::Vec2f lhWrist, rhWrist;
-			// { 3,  "RElbow" }, { 6,  "LElbow" },
-			cv::Vec2f lhElbow, rhElbow;
-			cv::Vec2f lhPalm, rhPalm;
-
-			// Accessing the image pixels (RGB)
-			// const auto& rgbImage = datumsPtr->at(0).cvOutputData;
-			const auto& rgbImage = datumsPtr->at(0).cvInputData;
-			const auto& rgbImageOut = datumsPtr->at(0).cvOutputData;
-			//op::log("rgbImage dimesions:" + std::to_string(rgbImage.size[0]) + " " + std::to_string(rgbImage.size[1]) + " " + std::to_string(rgbImage.size[2]));  // 240 x 320
-			//op::log("rgbImageOut dimesions:" + std::to_string(rgbImageOut.size[0]) + " " + std::to_string(rgbImageOut.size[1]) + " " + std::to_string(rgbImageOut.size[2]));  // 240 x 320
-			res_x = rgbImage.size[1]; 
-			res_y = rgbImage.size[0];
-
+			// Each camera of the set (UserDatum::cameraIndex) is output as its own frame, with its own tracks and crop history
+			for (const auto& datum : *datumsPtr)
+			{
+				// cwc // image resolution, for the LH RH head image cropping
+				unsigned int res_x, res_y;
+
+				// Accessing the image pixels (RGB)
+				// const auto& rgbImage = datum.cvOutputData;
+				const auto& rgbImage = datum.cvInputData;
+				const auto& rgbImageOut = datum.cvOutputData;
+				//op::log("rgbImage dimesions:" + std::to_string(rgbImage.size[0]) + " " + std::to_string(rgbImage.size[1]) + " " + std::to_string(rgbImage.size[2]));  // 240 x 320
+				//op::log("rgbImageOut dimesions:" + std::to_string(rgbImageOut.size[0]) + " " + std::to_string(rgbImageOut.size[1]) + " " + std::to_string(rgbImageOut.size[2]));  // 240 x 320
+				res_x = rgbImage.size[1]; 
+				res_y = rgbImage.size[0];
+
+				// binary output / stream server: the frame is collected here and sent at the end
+				const auto textOutput = (upFrameRecordWriter == nullptr && spStreamServer == nullptr && upSharedMemoryRing == nullptr);
+				// Only the stream server knows which parts of the frame are needed (the other outputs want everything): a crop
+				// nobody receives is neither extracted, formatted nor displayed. Read every frame, clients come and go, and
+				// only those of this camera: each camera can have its own client (and options) per stream.
+				const auto allOutputs = (spStreamServer == nullptr || upFrameRecordWriter != nullptr || upSharedMemoryRing != nullptr);
+				const auto subscribedStreams = (spStreamServer != nullptr ? spStreamServer->getSubscribedStreams(datum.cameraIndex) : 0);
+				// The encoding=tensor and people=all clients only receive the tensor / the crops of every person, not the crop
+				const auto tensorStreams = (spStreamServer != nullptr && spCropTensorizer != nullptr
+				                            ? spStreamServer->getTensorStreams(datum.cameraIndex) : 0);
+				const auto batchStreams = (spStreamServer != nullptr ? spStreamServer->getBatchStreams(datum.cameraIndex) : 0);
+				const auto cropRegions = (allOutputs ? cwc::ALL_CROP_REGIONS
+				                                     : cwc::getSubscribedRegions(subscribedStreams & ~tensorStreams & ~batchStreams));
+				const auto tensorRegions = cwc::getSubscribedRegions(tensorStreams);
+				const auto batchRegions = cwc::getSubscribedRegions(batchStreams);
+				// The unchanged=1 clients get a short packet instead of a crop that did not change (a new client has no crop yet)
+				const auto unchangedRegions = cwc::getSubscribedRegions(spStreamServer != nullptr ? spStreamServer->getUnchangedStreams(datum.cameraIndex) : 0);
+				auto& camera = getCamera(datum.cameraIndex, datum.sourceScale);
+				for (auto region = 0; region < cwc::CROP_NUMBER_REGIONS; region++)
+					if ((unchangedRegions & ~camera.unchangedRegions) & (1 << region))
+						camera.cropChangeDetectors[region].reset();
+				camera.unchangedRegions = unchangedRegions;
+				const auto needClosestBody = (subscribedStreams & (int)cwc::StreamId::ClosestBody) != 0;
+				// every person (and its track id), for AllBodies and the people=all crops
+				const auto needAllPeople = ((subscribedStreams & (int)cwc::StreamId::AllBodies) != 0 || batchRegions != 0);
+				mFrameData = cwc::FrameData{};
+				// The frame number is the camera's own sequence (its crop_unchanged_refresh interval counts its frames)
+				mFrameData.frameNumber = camera.frameCounter++;
+				mFrameCounter++;
+				mFrameData.cameraIndex = datum.cameraIndex;
+				mFrameData.trace = datum.trace;
 						
-            // op::log("\nKeypoints:");
-            // Accesing each element of the keypoints 
-            const auto& poseKeypoints = datumsPtr->at(0).poseKeypoints;
-            op::log("Person new frame:"); 
+	            // op::log("\nKeypoints:");
+	            // Accesing each element of the keypoints 
+	            const auto& rawKeypoints = datum.poseKeypoints;
+				// Everything is computed on the decoded frame (with the pixel thresholds converted, see getCamera), the
+				// keypoints are output in source coordinates. The crop positions stay in decoded pixels: they index the
+				// crop pixels cut from the decoded frame.
+				const auto sourceScale = datum.sourceScale;
+				if (textOutput)
+					op::log("Person new frame:"); 
 			
-			// currently sending only one person Person 0 (Person 0 is (most probably) on the left of a image).
-			int bestPersonIndex = 0;  // cwc // change this later after finding the best person to send information about
-			float calibrationLimbLength = 51;
-			int engagedBit = 0;
-
-			// Find the best (closest) person index in the frame 
-			populatePersonMap(poseKeypoints, res_x);
-
-			// ietrate over PersonMap
-			for (auto mp = 0; mp < PersonMap.size(); mp++){
-				if (PersonMap[mp].isWithinCentralFrame && PersonMap[mp].averageLimbLength > calibrationLimbLength) {
-					bestPersonIndex = mp;
-					engagedBit = 1;
-				}
-				else { engagedBit = 0; }
-
-				//op::log("person map " + std::to_string(mp) + " =====> " + std::to_string(PersonMap[mp].averageLimbLength) + " " + std::to_string(PersonMap[mp].meanKeypointX) + " " + std::to_string(PersonMap[mp].isWithinCentralFrame));
-			}
-			// clear the PersonMap
-			PersonMap.clear();
-			
-			for (auto person = bestPersonIndex ; person < bestPersonIndex+1; person++)
-            //for (auto person = 0 ; person < poseKeypoints.getSize(0) ; person++)
-            {
-                op::log("Person " + std::to_string(person) + " (x, y, score):");
-				std::string valueToPrint;
-				valueToPrint += std::to_string(engagedBit) + " ";  // first value is the engaged bit and then 18*3 keypoints
-
-                for (auto bodyPart = 0 ; bodyPart < poseKeypoints.getSize(1) ; bodyPart++)
-                {
-                    //std::string valueToPrint; // to print 3 at a time on a line
-                    for (auto xyscore = 0 ; xyscore < poseKeypoints.getSize(2) ; xyscore++)
-                    {
-                        valueToPrint += std::to_string(poseKeypoints[{person, bodyPart, xyscore}]) + " ";
-						
-						// find LH and RH x, y locations
-						if (bodyPart == 4) {
-							rhWrist[0] = poseKeypoints[{person, bodyPart, 0}];
-							rhWrist[1] = poseKeypoints[{person, bodyPart, 1}];
-						}
-						if (bodyPart == 7) {
-							lhWrist[0] = poseKeypoints[{person, bodyPart, 0}];
-							lhWrist[1] = poseKeypoints[{person, bodyPart, 1}];
-						}
-
-						if (bodyPart == 3) {
-							rhElbow[0] = poseKeypoints[{person, bodyPart, 0}];
-							rhElbow[1] = poseKeypoints[{person, bodyPart, 1}];
-						}
-						if (bodyPart == 6) {
-							lhElbow[0] = poseKeypoints[{person, bodyPart, 0}];
-							lhElbow[1] = poseKeypoints[{person, bodyPart, 1}];
-						}
-
-						if (bodyPart == 0) {
-							noseXY[0] = poseKeypoints[{person, bodyPart, 0}];
-							noseXY[1] = poseKeypoints[{person, bodyPart, 1}];
-						}
-                    }  // for syscore
-                }  // for bodyPart
-
-				op::log(valueToPrint);
-				valueToPrint = "";
-
-				// palm keypoints calculations
-				int forearmThreshold = 10;
-				lhForearmVect = lhWrist - lhElbow;
-				rhForearmVect = rhWrist - rhElbow;
-				lhForearmLength = norm(lhForearmVect);
-				rhForearmLength = norm(rhForearmVect);
-				if (lhForearmLength > forearmThreshold) {
-					lhPalm[0] = lhWrist[0] + lhForearmVect[0] * (0.75*palmRatio);  // no need for lhForearmLength since it is to be divided for norm and multiplied for palm 
-					lhPalm[1] = lhWrist[1] + lhForearmVect[1] * (1.5*palmRatio);  // 
-				}
-				else {
-					lhPalm[0] = lhWrist[0] + lhForearmVect[0] * (palmRatio);
-					lhPalm[1] = lhWrist[1] + lhForearmVect[1] * (palmRatio);
-				}
-				
-				if (rhForearmLength > forearmThreshold) {
-					rhPalm[0] = rhWrist[0] + rhForearmVect[0] * (0.75*palmRatio);
-					rhPalm[1] = rhWrist[1] + rhForearmVect[1] * (1.5*palmRatio);
-				}
-				else {
-					rhPalm[0] = rhWrist[0] + rhForearmVect[0] * (palmRatio);
-					rhPalm[1] = rhWrist[1] + rhForearmVect[1] * (palmRatio);
+				// currently sending only one person Person 0 (Person 0 is (most probably) on the left of a image).
+				int bestPersonIndex = 0;  // cwc // change this later after finding the best person to send information about
+				float calibrationLimbLength = 51 / sourceScale;  // source pixels
+				int engagedBit = 0;
+
+				// Find the best (closest) person index in the frame: the tracker keeps the same person engaged while it
+				// qualifies, instead of whichever qualifying person OpenPose lists last
+				cwc::computePersonTable(rawKeypoints, res_x, mPersonTable);
+				camera.personTracker.update(rawKeypoints, mPersonTable);
+				// Everything after the tracker uses the keypoints smoothed along each track (the table too, so the centroids
+				// and limb lengths sent match them)
+				if (camera.keypointFilter.isEnabled())
+				{
+					camera.keypointFilter.filter(rawKeypoints, camera.personTracker.getTrackIds(), mFrameData.trace.getCaptureTime(), camera.filteredKeypoints);
+					cwc::computePersonTable(camera.filteredKeypoints, res_x, mPersonTable);
 				}
-				
-
-				//op::log("Wrist points: " + std::to_string(lhWrist[0]) + " " + std::to_string(lhWrist[1]) + " " + std::to_string(rhWrist[0]) + " " + std::to_string(rhWrist[1]));
-				//op::log("Elbow points: " + std::to_string(lhElbow[0]) + " " + std::to_string(lhElbow[1]) + " " + std::to_string(rhElbow[0]) + " " + std::to_string(rhElbow[1]));
-				//op::log("Forearm vectors: " + std::to_string(lhForearmVect[0]) + " " + std::to_string(lhForearmVect[1]) + " " + std::to_string(rhForearmVect[0]) + " " + std::to_string(rhForearmVect[1]));
-				//op::log("Forearm length: " + std::to_string(lhForearmLength) + " " + std::to_string(rhForearmLength));
-				//op::log("Palm points: " + std::to_string(lhPalm[0]) + " " + std::to_string(lhPalm[1]) + " " + std::to_string(rhPalm[0]) + " " + std::to_string(rhPalm[1]));
-
-
-				// print image pixels; image res = "656 x 368" == "width x height" 
-				// print image pixels; image res = "320 x 176" == "width x height"
-				// print image pixels; image res = "320 x 240" == "width x height"
-				// LH
-				left_hand_img_x_start = (int)((int)(lhPalm[0]) - (hand_img_width / 2));
-				left_hand_img_y_start = (int)((int)(lhPalm[1]) - (hand_img_height / 2));
-				left_hand_img_x_end = (int)((int)(lhPalm[0]) + (hand_img_width / 2));
-				left_hand_img_y_end = (int)((int)(lhPalm[1]) + (hand_img_height / 2));
-
-				assert((left_hand_img_x_end - left_hand_img_x_start) == hand_img_width && "Assertion on left hand image width failed.");
-				assert((left_hand_img_y_end - left_hand_img_y_start) == hand_img_height && "Assertion on left hand image height failed.");
-
-				op::log("ImageLeftHand: hand_img_x_start, hand_img_y_start, hand_img_x_end, hand_img_y_end: " + std::to_string(left_hand_img_x_start) + " " + std::to_string(left_hand_img_y_start) + " " + std::to_string(left_hand_img_x_end) + " " + std::to_string(left_hand_img_y_end) + " ");
-				
-				if (left_hand_img_y_start >= (0 - 0.45*hand_img_height) && left_hand_img_x_start >= (0 - 0.45*hand_img_width) && left_hand_img_y_end < (res_y + 0.45*hand_img_height) && left_hand_img_x_end < (res_x + 0.45*hand_img_width))  // if the entire hand image is within the screen  /// *!* cwc access the image res somehow
+				const auto& poseKeypoints = (camera.keypointFilter.isEnabled() ? camera.filteredKeypoints : rawKeypoints);
+				const auto engagedPerson = camera.personTracker.selectEngaged(mPersonTable, calibrationLimbLength);
+				if (engagedPerson >= 0)
 				{
-					if (left_hand_img_y_start >= 0 && left_hand_img_x_start >= 0 && left_hand_img_y_end < res_y && left_hand_img_x_end < res_x) // if the entire hand image is within the screen
-					{
-						int doNothing = 1;
-					}
-					if (left_hand_img_y_start < 0)
-					{
-						left_hand_img_y_start = 0;
-						left_hand_img_y_end = left_hand_img_y_start + hand_img_height;
-					}
-					if (left_hand_img_x_start < 0)
-					{
-						left_hand_img_x_start = 0;
-						left_hand_img_x_end = left_hand_img_x_start + hand_img_width;
-					}
-					if (left_hand_img_y_end > res_y)
-					{
-						left_hand_img_y_end = res_y;
-						left_hand_img_y_start = left_hand_img_y_end - hand_img_height;
-					}
-					if (left_hand_img_x_end > res_x)
-					{
-						left_hand_img_x_end = res_x;
-						left_hand_img_x_start = left_hand_img_x_end - hand_img_width;
-					}
-
-					cv::imshow("Left Hand", datumsPtr->at(0).cvInputData(cv::Rect(left_hand_img_x_start, left_hand_img_y_start, hand_img_width, hand_img_height)));  // (cv::Rect(1, 1, 200, 200))
-					std::string valueToPrintLH;
-					for (int row = left_hand_img_y_start; row < left_hand_img_y_end; row++)       
-					{
-						for (int column = left_hand_img_x_start; column < left_hand_img_x_end; column++)
-						{
-							//cv::Vec3b pixelBGR; //cvPoint pixelPoint = cvPoint(row, column);
-							valueToPrintLH += std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[0]) + " " +
-								std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[1]) + " " +
-								std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[2]) + " ";  // (cv::Rect(1, 1, 2, 2))
-						}  // for column
-					}  // for row
-
-					// hand_img_width*hand_img_height*3*4 (3=> 3 channels; 4=> 4 charecters including space e.g., "235 ")
-					assert(valueToPrintLH.length() <= hand_img_width*hand_img_height*3*4 && "Left hand string valueToPrintLH has more length that expected");  // op::log("length of string " + std::to_string(valueToPrintLH.length()));
-					op::log(valueToPrintLH);
-					valueToPrintLH = "";
-
-				}  // if left hand is visible in the frame
-				else 
+					bestPersonIndex = engagedPerson;
+					engagedBit = 1;
+				}
+				const auto& trackIds = camera.personTracker.getTrackIds();
+				mFrameData.trackId = (bestPersonIndex < (int)trackIds.size() ? trackIds[bestPersonIndex] : cwc::PERSON_NO_TRACK);
+				// keypoint velocities of the sent person, for the predict=... clients
+				if (spStreamServer != nullptr && spStreamServer->getPredictedStreams(datum.cameraIndex) != 0)
 				{
-					op::log("[left hand unknown]");
+					camera.keypointPredictor.update(poseKeypoints, trackIds, mFrameData.trace.getCaptureTime());
+					camera.keypointPredictor.getVelocities(bestPersonIndex, mFrameData.keypointVelocities, mFrameData.predictableKeypoints);
 				}
-
-
-				// RH
-				right_hand_img_x_start = (int)((int)(rhPalm[0])-(hand_img_width / 2));
-				right_hand_img_y_start = (int)((int)(rhPalm[1])-(hand_img_height / 2));
-				right_hand_img_x_end = (int)((int)(rhPalm[0])+(hand_img_width / 2));
-				right_hand_img_y_end = (int)((int)(rhPalm[1])+(hand_img_height / 2));
-
-				assert((right_hand_img_x_end - right_hand_img_x_start) == hand_img_width && "Assertion on right hand image width failed.");
-				assert((right_hand_img_y_end - right_hand_img_y_start) == hand_img_height && "Assertion on right hand image height failed.");
-
-				op::log("ImageRightHand: hand_img_x_start, hand_img_y_start, hand_img_x_end, hand_img_y_end: " + std::to_string(right_hand_img_x_start) + " " + std::to_string(right_hand_img_y_start) + " " + std::to_string(right_hand_img_x_end) + " " + std::to_string(right_hand_img_y_end) + " ");
-
-				if (right_hand_img_y_start >= (0 - 0.45*hand_img_height) && right_hand_img_x_start >= (0 - 0.45*hand_img_width) && right_hand_img_y_end < (res_y + 0.45*hand_img_height) && right_hand_img_x_end < (res_x + 0.45*hand_img_width))  // if the entire hand image is within the screen and 30 pixels buffer around the screen /// *!* cwc access the image res somehow
+				// limb length of the selected person, for the scale-invariant crop tensors
+				const auto bestLimbLength = (bestPersonIndex < mPersonTable.size ? mPersonTable.averageLimbLength[bestPersonIndex] : 0.f);
+				if (needAllPeople)
 				{
-					if (right_hand_img_y_start >= 0 && right_hand_img_x_start >= 0 && right_hand_img_y_end < res_y && right_hand_img_x_end < res_x) // if the entire hand image is within the screen
-					{
-						int doNothing = 1;
-					}
-					if (right_hand_img_y_start < 0)
-					{
-						right_hand_img_y_start = 0;
-						right_hand_img_y_end = right_hand_img_y_start + hand_img_height;
-					}
-					if (right_hand_img_x_start < 0)
-					{
-						right_hand_img_x_start = 0;
-						right_hand_img_x_end = right_hand_img_x_start + hand_img_width;
-					}
-					if (right_hand_img_y_end > res_y) 
-					{
-						right_hand_img_y_end = res_y;
-						right_hand_img_y_start = right_hand_img_y_end - hand_img_height;
-					}
-					if (right_hand_img_x_end > res_x)
+					cwc::fillPeople(poseKeypoints, mPersonTable, mFrameData.people);
+					for (auto person = 0u; person < mFrameData.people.size(); person++)
+						mFrameData.people[person].index = trackIds[person];
+					if (engagedBit)
+						mFrameData.people[bestPersonIndex].flags |= cwc::PERSON_ENGAGED_FLAG;
+				}
+			
+				for (auto person = bestPersonIndex ; person < bestPersonIndex+1; person++)
+	            //for (auto person = 0 ; person < poseKeypoints.getSize(0) ; person++)
+	            {
+					if (textOutput)
+						op::log("Person " + std::to_string(person) + " (x, y, score):");
+					std::string valueToPrint;
+					if (textOutput)
+						valueToPrint += std::to_string(engagedBit) + " ";  // first value is the engaged bit and then 18*3 keypoints
+					mFrameData.engaged = (float)engagedBit;
+
+	                for (auto bodyPart = 0 ; bodyPart < poseKeypoints.getSize(1) ; bodyPart++)
+	                {
+	                    //std::string valueToPrint; // to print 3 at a time on a line
+	                    for (auto xyscore = 0 ; xyscore < poseKeypoints.getSize(2) ; xyscore++)
+	                    {
+							if (textOutput)
+								valueToPrint += std::to_string(poseKeypoints[{person, bodyPart, xyscore}] * (xyscore < 2 ? sourceScale : 1.f)) + " ";
+							else if (bodyPart < cwc::POSE_NUMBER_KEYPOINTS)
+								mFrameData.keypoints[bodyPart*cwc::POSE_VALUES_PER_KEYPOINT + xyscore] = poseKeypoints[{person, bodyPart, xyscore}];
+	                    }  // for syscore
+	                }  // for bodyPart
+					cwc::scaleKeypoints(mFrameData, sourceScale);
+
+					// compact keypoints for the keypoints=compact clients, encoded once per frame as soon as the keypoints are known
+					if (needClosestBody)
+						camera.keypointEncoder.encode(mFrameData, mFrameData.compactKeypoints);
+
+					if (textOutput)
+						op::log(valueToPrint);
+					valueToPrint = "";
+
+					// hand and head crops (see cwc/roiEngine.hpp), only those of the regions some output needs
+					mRoiPersons.assign(1, person);
+					mRoiEngine.evaluate(poseKeypoints, mRoiPersons, (int)res_x, (int)res_y, cropRegions | tensorRegions, mRoiResults);
+					for (const auto& roi : mRoiResults)
 					{
-						right_hand_img_x_end = res_x;
-						right_hand_img_x_start = right_hand_img_x_end - hand_img_width;
-					}
+						const auto& spec = mRoiEngine.getSpecs()[roi.spec];
+						if (textOutput)
+							op::log("Image" + spec.textName + ": " + spec.textSize + "_img_x_start, " + spec.textSize + "_img_y_start, " + spec.textSize + "_img_x_end, " + spec.textSize + "_img_y_end: " + std::to_string(roi.xStart) + " " + std::to_string(roi.yStart) + " " + std::to_string(roi.xEnd) + " " + std::to_string(roi.yEnd) + " ");
 
-					cv::imshow("Right Hand", datumsPtr->at(0).cvInputData(cv::Rect(right_hand_img_x_start, right_hand_img_y_start, hand_img_width, hand_img_height)));  // (cv::Rect(1, 1, 200, 200))
-					std::string valueToPrintRH;
-					for (int row = right_hand_img_y_start; row < right_hand_img_y_end; row++)
-					{
-						for (int column = right_hand_img_x_start; column < right_hand_img_x_end; column++)
+						if (!roi.visible)  // too far outside the frame (or no output needs it)
 						{
-							valueToPrintRH += std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[0]) + " " +
-									std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[1]) + " " +
-									std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[2]) + " ";  // (cv::Rect(1, 1, 2, 2))
-						}  // for column
-					}  // for row
-
-					// hand_img_width*hand_img_height*3*4 (3=> 3 channels; 4=> 4 charecters including space e.g., "235 ")
-					assert(valueToPrintRH.length() <= hand_img_width*hand_img_height * 3 * 4 && "Right hand string valueToPrinRH has more length that expected");  // op::log("length of string " + std::to_string(valueToPrintRH.length()));
-					op::log(valueToPrintRH);
-					valueToPrintRH = "";
-
-				}  // if right hand is visible in the frame
-				else
-				{
-					op::log("[right hand unknown]");
-				}
-
-				// Head
-				head_img_x_start = (int)((int)(noseXY[0]) - (head_img_width / 2));
-				head_img_y_start = (int)((int)(noseXY[1]) - (head_img_height / 2));
-				head_img_x_end = (int)((int)(noseXY[0]) + (head_img_width / 2));
-				head_img_y_end = (int)((int)(noseXY[1]) + (head_img_height / 2));
+							if (textOutput)
+								op::log("[" + spec.unknownName + " unknown]");
+							continue;
+						}
+						const auto regionBit = 1 << (int)spec.region;
+						auto& crop = mFrameData.crops[(int)spec.region];
+						if ((unchangedRegions & regionBit)
+							&& camera.cropChangeDetectors[(int)spec.region].isUnchanged(rgbImage, roi.x, roi.y, spec.width, spec.height, mFrameData.frameNumber, crop.sameAs))
+						{
+							// same as the last crop sent: not extracted again, unless another output needs its pixels
+							crop.visible = true;
+							crop.unchanged = true;
+							crop.x = roi.x;
+							crop.y = roi.y;
+							crop.width = spec.width;
+							crop.height = spec.height;
+							if (!allOutputs)
+								continue;
+						}
+						if (cropRegions & regionBit)  // the region (mostly) within the frame, shifted inside it
+						{
+							cv::imshow(getWindowName(spec.windowName, datum.cameraIndex), rgbImage(cv::Rect(roi.x, roi.y, spec.width, spec.height)));
+							setCrop(rgbImage, spec.region, roi.x, roi.y, spec.width, spec.height);
+							if (textOutput)
+							{
+								cwc::formatCropText(mFrameData.crops[(int)spec.region], mCropText);
+								// width*height*3*4 (3=> 3 channels; 4=> 4 charecters including space e.g., "235 ")
+								assert(mCropText.length() <= spec.width*spec.height*3*4 && "Crop text has more length than expected");
+								op::log(mCropText);
+							}
+						}
+						if (tensorRegions & regionBit)
+							setTensor(rgbImage, spec, roi, bestLimbLength);
+					}
 
-				assert((head_img_x_end - head_img_x_start) == head_img_width && "Assertion on head image width failed.");
-				assert((head_img_y_end - head_img_y_start) == head_img_height && "Assertion on head image height failed.");
 
-				op::log("ImageHead: head_img_x_start, head_img_y_start, head_img_x_end, head_img_y_end: " + std::to_string(head_img_x_start) + " " + std::to_string(head_img_y_start) + " " + std::to_string(head_img_x_end) + " " + std::to_string(head_img_y_end) + " ");
+					// display
+					//cv::imshow("User worker GUI", datum.cvOutputData);  // (cv::Rect(1, 1, 200, 200))
+					// Display image and sleeps at least 1 ms (it usually sleeps ~5-10 msec to display the image)
+					if ((char)cv::waitKey(1) == 27)
+						key = 27;
+	            } // for person
 
-				if (head_img_y_start >= (0 - 0.45*head_img_height) && head_img_x_start >= (0 - 0.45*head_img_width) && head_img_y_end < (res_y + 0.45*head_img_height) && head_img_x_end < (res_x + 0.45*head_img_width))  // if the entire head image is within the screen and 30 pixels buffer around the screen
+				// hand and head crops of every person, one block per region (people=all clients)
+				if (batchRegions != 0)
 				{
-					if (head_img_y_start >= 0 && head_img_x_start >= 0 && head_img_y_end < res_y && head_img_x_end < res_x) // if the entire head image is within the screen
-					{
-						int doNothing = 1;
-					}
-					if (head_img_y_start < 0)
-					{
-						head_img_y_start = 0;
-						head_img_y_end = head_img_y_start + head_img_height;
-					}
-					if (head_img_x_start < 0)
-					{
-						head_img_x_start = 0;
-						head_img_x_end = head_img_x_start + head_img_width;
-					}
-					if (head_img_y_end > res_y)
-					{
-						head_img_y_end = res_y;
-						head_img_y_start = head_img_y_end - head_img_height;
-					}
-					if (head_img_x_end > res_x)
-					{
-						head_img_x_end = res_x;
-						head_img_x_start = head_img_x_end - head_img_width;
-					}
-
-					cv::imshow("Head", datumsPtr->at(0).cvInputData(cv::Rect(head_img_x_start, head_img_y_start, head_img_width, head_img_height)));  // (cv::Rect(1, 1, 200, 200))
-					std::string valueToPrintHead;
-					for (int row = head_img_y_start; row < head_img_y_end; row++)
-					{
-						for (int column = head_img_x_start; column < head_img_x_end; column++)
-						{
-							valueToPrintHead += std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[0]) + " " +
-								std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[1]) + " " +
-								std::to_string(datumsPtr->at(0).cvInputData.at<cv::Vec3b>(row, column)[2]) + " ";
-						}  // for column
-					}  // for row
-
-					   // head_img_width*head_img_height*3*4 (3=> 3 channels; 4=> 4 charecters including space e.g., "235 ")
-					assert(valueToPrintHead.length() <= head_img_width*head_img_height * 3 * 4 && "Head string valueToPrintHead has more length that expected");
-					op::log(valueToPrintHead);
-					valueToPrintHead = "";
-
-				}  // if head is visible in the frame
-				else
-				{
-					op::log("[head unknown]");
+					mRoiPersons.resize(mFrameData.people.size());
+					for (auto person = 0u; person < mRoiPersons.size(); person++)
+						mRoiPersons[person] = (int)person;
+					mRoiEngine.evaluate(poseKeypoints, mRoiPersons, (int)res_x, (int)res_y, batchRegions, mRoiResults);
+					mCropBatcher.fill(rgbImage, mRoiEngine, mRoiResults, mFrameData.people, batchRegions, mFrameData);
 				}
 
-
-				// display
-				//cv::imshow("User worker GUI", datumsPtr->at(0).cvOutputData);  // (cv::Rect(1, 1, 200, 200))
-				// Display image and sleeps at least 1 ms (it usually sleeps ~5-10 msec to display the image)
-				key = (char)cv::waitKey(1);
-            } // for person
-
-            op::log("[End]");
-
+				if (textOutput)
+					op::log("[End]");
+				mFrameData.trace.stamp(cwc::TraceStage::CropsExtracted);
+				if (upFrameRecordWriter != nullptr)
+					upFrameRecordWriter->write(mFrameData);
+				if (spStreamServer != nullptr)
+					spStreamServer->publish(mFrameData);
+				if (upSharedMemoryRing != nullptr)
+					upSharedMemoryRing->write(mFrameData);
+				mFrameData.trace.stamp(cwc::TraceStage::Serialized);
+				logTrace();
+			}  // for datum
         }  // if (datumsPtr != nullptr && !datumsPtr->empty())
 
         else
@@ -691,7 +949,136 @@ public:
 		return (key == 27);
     }
 
+private:
+	std::unique_ptr<cwc::FrameRecordWriter> upFrameRecordWriter;
+	std::shared_ptr<cwc::StreamServer> spStreamServer;
+	const std::shared_ptr<cwc::CropTensorizer> spCropTensorizer;
+	// Only for its statistics
+	const std::shared_ptr<cwc::DatumPool<UserDatum>> spDatumPool;
+	std::unique_ptr<cwc::SharedMemoryRingWriter> upSharedMemoryRing;
+
+	// What a camera carries over from one of its frames to the next
+	struct CameraState
+	{
+		cwc::KeypointEncoder keypointEncoder;
+		cwc::PersonTracker personTracker;
+		cwc::KeypointFilter keypointFilter;
+		op::Array<float> filteredKeypoints;
+		cwc::KeypointPredictor keypointPredictor;
+		std::vector<cwc::CropChangeDetector> cropChangeDetectors;
+		int unchangedRegions;   // Regions of the unchanged=1 clients on the last frame
+		unsigned long long frameCounter;    // Frames of this camera output so far
+
+		CameraState(const unsigned int keypointKeyframeInterval, const cwc::CropChangeSettings& cropChangeSettings,
+		            const cwc::TrackerSettings& trackerSettings, const cwc::KeypointFilterSettings& keypointFilterSettings,
+		            const cwc::KeypointPredictorSettings& keypointPredictorSettings) :
+			keypointEncoder{keypointKeyframeInterval},
+			personTracker{trackerSettings},
+			keypointFilter{keypointFilterSettings},
+			keypointPredictor{keypointPredictorSettings},
+			cropChangeDetectors(cwc::CROP_NUMBER_REGIONS, cwc::CropChangeDetector{cropChangeSettings}),
+			unchangedRegions{0},
+			frameCounter{0ull}
+		{}
+	};
+	const unsigned int mKeypointKeyframeInterval;
+	const cwc::CropChangeSettings mCropChangeSettings;
+	const cwc::TrackerSettings mTrackerSettings;
+	const cwc::KeypointFilterSettings mKeypointFilterSettings;
+	const cwc::KeypointPredictorSettings mKeypointPredictorSettings;
+	std::vector<CameraState> mCameras;
+	cwc::PersonTable mPersonTable;
+	unsigned long long mFrameCounter;  // Frames of every camera, for the crop buffers and the trace log interval
+	cwc::FrameData mFrameData;
+	const cwc::RoiEngine mRoiEngine;
+	std::vector<int> mRoiPersons;
+	std::vector<cwc::RoiResult> mRoiResults;
+	cwc::CropBufferPool mCropBuffers;
+	std::string mCropText;
+	std::vector<float> mTensorBuffers;
+	cwc::CropBatcher mCropBatcher;
+	const unsigned int mTraceLogInterval;
+	cwc::TraceStatistics mTraceStatistics;
+
+	// State of camera cameraIndex, created on its first frame. The pixel settings (tracking distance, crop shift, smoothing
+	// speed) are given in source pixels and the camera works on its frames as decoded, sourceScale times smaller (see
+	// cwc/decodeReduction.hpp; the reduction of a source does not change), so they are converted to decoded pixels.
+	CameraState& getCamera(const unsigned int cameraIndex, const float sourceScale)
+	{
+		auto cropChangeSettings = mCropChangeSettings;
+		cropChangeSettings.maxShift = (int)(mCropChangeSettings.maxShift / sourceScale);
+		auto trackerSettings = mTrackerSettings;
+		trackerSettings.maxDistance = mTrackerSettings.maxDistance / sourceScale;
+		auto keypointFilterSettings = mKeypointFilterSettings;
+		keypointFilterSettings.beta = mKeypointFilterSettings.beta * sourceScale;
+		while (mCameras.size() <= cameraIndex)
+			mCameras.emplace_back(mKeypointKeyframeInterval, cropChangeSettings, trackerSettings, keypointFilterSettings,
+			                      mKeypointPredictorSettings);
+		return mCameras[cameraIndex];
+	}
+
+	// OpenCV window of camera cameraIndex (those of the first camera keep their name)
+	static std::string getWindowName(const std::string& name, const unsigned int cameraIndex)
+	{
+		return (cameraIndex == 0 ? name : name + " (camera " + std::to_string(cameraIndex) + ")");
+	}
+
+	// Every mTraceLogInterval frames, logs the stage times of the last frames and the send time of each stream client
+	void logTrace()
+	{
+		if (mTraceLogInterval == 0)
+			return;
+		mTraceStatistics.add(mFrameData.trace);
+		if (mFrameCounter % mTraceLogInterval != 0)
+			return;
+		op::log("Trace (mean/max): " + mTraceStatistics.getSummary(), op::Priority::High);
+		if (spDatumPool != nullptr)
+			op::log("Trace datum pool: " + spDatumPool->getSummary(), op::Priority::High);
+		if (spStreamServer != nullptr)
+		{
+			for (const auto& client : spStreamServer->getStatistics())
+			{
+				if (client.sent > 0)
+					op::log("Trace " + cwc::getStreamName(client.streamId) + " (" + client.address + ") send queue: "
+					        + cwc::TraceStatistics::toMilliseconds(client.sendNanosecondsTotal / (std::int64_t)client.sent)
+					        + "/" + cwc::TraceStatistics::toMilliseconds(client.sendNanosecondsMax) + " ms since connected",
+					        op::Priority::High);
+			}
+		}
+	}
+
+	// Copies the region row by row into this frame's pooled buffer and points mFrameData at it (no allocation)
+	void setCrop(const cv::Mat& image, const cwc::CropRegion region, const int x, const int y, const int width, const int height)
+	{
+		if ((std::size_t)(width * height * cwc::CROP_NUMBER_CHANNELS) > mCropBuffers.getBufferSize())
+			op::error("Crop larger than its buffer.", __LINE__, __FUNCTION__, __FILE__);
+		auto* const buffer = mCropBuffers.getBuffer(mFrameCounter, region);
+		cwc::copyCropRows(image, x, y, width, height, buffer);
+		auto& crop = mFrameData.crops[(int)region];
+		crop.visible = true;
+		crop.x = x;
+		crop.y = y;
+		crop.width = width;
+		crop.height = height;
+		crop.pixels = buffer;
+	}
 
+	// Resamples the region into its tensor buffer (one per region, the packets are built before the next frame) and points
+	// mFrameData at it. With crop_tensor_scale, the sampled square is that many limb lengths wide, centered on the region.
+	void setTensor(const cv::Mat& image, const cwc::RoiSpec& spec, const cwc::RoiResult& roi, const float limbLength)
+	{
+		auto* const values = &mTensorBuffers[(int)spec.region * spCropTensorizer->getNumberValues()];
+		const auto side = spCropTensorizer->getScale() * limbLength;
+		if (side > 0.f)
+			spCropTensorizer->resample(image, roi.xStart + 0.5f*spec.width, roi.yStart + 0.5f*spec.height, side, side, values);
+		else
+			spCropTensorizer->resample(image, roi.x + 0.5f*spec.width, roi.y + 0.5f*spec.height, (float)spec.width,
+			                           (float)spec.height, values);
+		auto& tensor = mFrameData.tensors[(int)spec.region];
+		tensor.valid = true;
+		tensor.size = spCropTensorizer->getSize();
+		tensor.values = values;
+	}
 };
 
 int openPoseTutorialWrapper3()
@@ -701,6 +1088,20 @@ int openPoseTutorialWrapper3()
     op::ConfigureLog::setPriorityThreshold((op::Priority)FLAGS_logging_level);
     // op::ConfigureLog::setPriorityThreshold(op::Priority::None); // To print all logging messages
 
+    // Microbenchmarks (no camera nor models needed)
+    if (FLAGS_benchmark_crops > 0)
+    {
+        const auto frameSize = op::flagsToPoint(FLAGS_camera_resolution, "320x240");
+        cwc::benchmarkCropExtraction(FLAGS_benchmark_crops, frameSize.x, frameSize.y);
+        return 0;
+    }
+    if (FLAGS_benchmark_people > 0)
+    {
+        const auto frameSize = op::flagsToPoint(FLAGS_camera_resolution, "320x240");
+        cwc::benchmarkPersonTable(10000, FLAGS_benchmark_people, frameSize.x, frameSize.y);
+        return 0;
+    }
+
     op::log("Starting pose estimation demo.", op::Priority::High);
     const auto timerBegin = std::chrono::high_resolution_clock::now();
 
@@ -714,9 +1115,11 @@ int openPoseTutorialWrapper3()
     const auto faceNetInputSize = op::flagsToPoint(FLAGS_face_net_resolution, "368x368 (multiples of 16)");
     // handNetInputSize
     const auto handNetInputSize = op::flagsToPoint(FLAGS_hand_net_resolution, "368x368 (multiples of 16)");
-    // producerType
-    const auto producerSharedPtr = op::flagsToProducer(FLAGS_image_dir, FLAGS_video, FLAGS_ip_camera, FLAGS_camera,
-                                                       FLAGS_camera_resolution, FLAGS_camera_fps);
+    // producerType (none when replaying a frame archive or reading several cameras, so the default camera is not opened)
+    const auto producerSharedPtr = (FLAGS_archive_input.empty() && FLAGS_cameras.empty()
+        ? op::flagsToProducer(FLAGS_image_dir, FLAGS_video, FLAGS_ip_camera, FLAGS_camera, FLAGS_camera_resolution,
+                              FLAGS_camera_fps)
+        : std::shared_ptr<op::Producer>{});
     // poseModel
     const auto poseModel = op::flagsToPoseModel(FLAGS_model_pose);
     // keypointScale
@@ -741,7 +1144,89 @@ int openPoseTutorialWrapper3()
 
     // Configure OpenPose
     // op::log("Configuring OpenPose wrapper.", op::Priority::Low, __LINE__, __FUNCTION__, __FILE__);
-    op::Wrapper<std::vector<op::Datum>> opWrapper{op::ThreadManagerMode::AsynchronousOut};
+    op::Wrapper<std::vector<UserDatum>> opWrapper{op::ThreadManagerMode::AsynchronousOut};
+    // Custom input (same producer and producer flags, but it stamps the capture time of each frame) and a post-processing
+    // stage that stamps the end of the pose extraction, see cwc/frameTrace.hpp
+    // An image directory is read ahead by a pool of threads (see cwc/imagePrefetcher.hpp), and a frame archive replayed
+    // from its mapping (see cwc/frameArchive.hpp)
+    // Both can be decoded reduced, down to the net input size and the crop detail (see cwc/decodeReduction.hpp)
+    const auto decodeMinSize = op::flagsToPoint(FLAGS_decode_min_resolution, "320x240");
+    const auto decodeMinWidth = std::max({netInputSize.x, decodeMinSize.x, 0});
+    const auto decodeMinHeight = std::max({netInputSize.y, decodeMinSize.y, 0});
+    std::shared_ptr<WUserInput> wUserInput;
+    auto datumsPerFrame = std::size_t{1};
+    if (!FLAGS_archive_input.empty())
+        wUserInput = std::make_shared<WUserInput>(
+            std::make_shared<cwc::FrameArchiveReplay>(FLAGS_archive_input, FLAGS_process_real_time, FLAGS_frames_repeat,
+                                                      FLAGS_frame_first, FLAGS_decode_reduction, decodeMinWidth,
+                                                      decodeMinHeight),
+            FLAGS_frame_first, FLAGS_frame_last);
+    // Several cameras, each read by its own thread (see cwc/multiCameraCapture.hpp)
+    else if (!FLAGS_cameras.empty())
+    {
+        op::check(FLAGS_archive_output.empty(), "`archive_output` records a single camera, not `cameras`.",
+                  __LINE__, __FUNCTION__, __FILE__);
+        const auto cameraProducers = cwc::flagsToCameraProducers(FLAGS_cameras, FLAGS_camera_resolution, FLAGS_camera_fps);
+        for (const auto& cameraProducer : cameraProducers)
+        {
+            cameraProducer->set(op::ProducerProperty::Flip, FLAGS_frame_flip);
+            cameraProducer->set(op::ProducerProperty::Rotation, FLAGS_frame_rotate);
+        }
+        datumsPerFrame = cameraProducers.size();
+        wUserInput = std::make_shared<WUserInput>(
+            std::make_shared<cwc::MultiCameraCapture>(cameraProducers, std::max(0, FLAGS_camera_sync_ms)), FLAGS_frame_last);
+    }
+    else if (!FLAGS_image_dir.empty() && FLAGS_image_prefetch_workers > 0)
+    {
+        auto imageFiles = cwc::getImageFiles(FLAGS_image_dir);
+        imageFiles.erase(imageFiles.begin(), imageFiles.begin() + (std::ptrdiff_t)std::min((std::size_t)FLAGS_frame_first,
+                                                                                             imageFiles.size()));
+        cwc::ImagePrefetchSettings imagePrefetchSettings;
+        imagePrefetchSettings.workers = (unsigned int)FLAGS_image_prefetch_workers;
+        imagePrefetchSettings.depth = (unsigned int)std::max(1, FLAGS_image_prefetch_depth);
+        imagePrefetchSettings.flip = FLAGS_frame_flip;
+        imagePrefetchSettings.rotation = FLAGS_frame_rotate;
+        imagePrefetchSettings.repeat = FLAGS_frames_repeat;
+        imagePrefetchSettings.reduction = FLAGS_decode_reduction;
+        imagePrefetchSettings.minWidth = decodeMinWidth;
+        imagePrefetchSettings.minHeight = decodeMinHeight;
+        wUserInput = std::make_shared<WUserInput>(std::make_shared<cwc::ImagePrefetcher>(imageFiles, imagePrefetchSettings),
+                                                  FLAGS_frame_first, FLAGS_frame_last);
+    }
+    else
+        wUserInput = std::make_shared<WUserInput>(producerSharedPtr, FLAGS_frame_first, FLAGS_frame_last, FLAGS_process_real_time,
+                                                  FLAGS_frame_flip, FLAGS_frame_rotate, FLAGS_frames_repeat,
+                                                  FLAGS_latest_frame_only);
+    if (!FLAGS_archive_output.empty())
+        wUserInput->setFrameArchiveWriter(std::make_shared<cwc::FrameArchiveWriter>(
+            FLAGS_archive_output, cwc::flagsToFrameArchiveEncoding(FLAGS_archive_encoding), FLAGS_archive_jpeg_quality));
+    // Datum vectors recycled instead of allocated for every frame (see cwc/datumPool.hpp)
+    std::shared_ptr<cwc::DatumPool<UserDatum>> datumPool;
+    if (FLAGS_datum_pool_size > 0)
+    {
+        // cwc::resetDatum plus the UserDatum fields
+        datumPool = std::make_shared<cwc::DatumPool<UserDatum>>(
+            (std::size_t)FLAGS_datum_pool_size, datumsPerFrame, [](UserDatum& datum)
+            {
+                cwc::resetDatum(datum);
+                datum.trace = cwc::FrameTrace{};
+                datum.sourceScale = 1.f;
+                datum.cameraIndex = 0u;
+            });
+        wUserInput->setDatumPool(datumPool);
+    }
+    if (FLAGS_benchmark_producer > 0)
+    {
+        // As many frames in flight as the pool can hold, leaving one for the next frame
+        cwc::benchmarkProducer(*wUserInput, FLAGS_benchmark_producer,
+                               (std::size_t)(FLAGS_datum_pool_size > 1 ? FLAGS_datum_pool_size - 1 : 8));
+        return 0;
+    }
+    const auto workerInputOnNewThread = true;
+    opWrapper.setWorkerInput(wUserInput, workerInputOnNewThread);
+    auto wUserPostProcessing = std::make_shared<WUserPostProcessing>();
+    const auto workerProcessingOnNewThread = false;
+    opWrapper.setWorkerPostProcessing(wUserPostProcessing, workerProcessingOnNewThread);
     // Pose configuration (use WrapperStructPose{} for default and recommended configuration)
     const op::WrapperStructPose wrapperStructPose{!FLAGS_body_disable, netInputSize, outputSize, keypointScale, FLAGS_num_gpu,
                                                   FLAGS_num_gpu_start, FLAGS_scale_number, (float)FLAGS_scale_gap,
@@ -757,9 +1242,8 @@ int openPoseTutorialWrapper3()
     const op::WrapperStructHand wrapperStructHand{FLAGS_hand, handNetInputSize, FLAGS_hand_scale_number, (float)FLAGS_hand_scale_range,
                                                   FLAGS_hand_tracking, op::flagsToRenderMode(FLAGS_hand_render, FLAGS_render_pose),
                                                   (float)FLAGS_hand_alpha_pose, (float)FLAGS_hand_alpha_heatmap, (float)FLAGS_hand_render_threshold};
-    // Producer (use default to disable any input)
-    const op::WrapperStructInput wrapperStructInput{producerSharedPtr, FLAGS_frame_first, FLAGS_frame_last, FLAGS_process_real_time,
-                                                    FLAGS_frame_flip, FLAGS_frame_rotate, FLAGS_frames_repeat};
+    // Producer (use default to disable any input): the frames come from wUserInput
+    const op::WrapperStructInput wrapperStructInput{};
     // Consumer (comment or use default argument to disable any output)
     const bool displayGui = true;  // cwc // diplays the same gui as the one displayed by openpose main?
     const bool guiVerbose = true;
@@ -776,15 +1260,60 @@ int openPoseTutorialWrapper3()
     // op::log("Starting thread(s)", op::Priority::High);
     opWrapper.start();
 
+    // Stream server (it replaces openpose_server_01.1.py)
+    std::shared_ptr<cwc::StreamServer> streamServer;
+    if (FLAGS_stream_server_port > 0)
+        streamServer = std::make_shared<cwc::StreamServer>(FLAGS_stream_server_port, (std::size_t)FLAGS_stream_queue_size,
+                                                          FLAGS_stream_queue_policy);
+
+    // Model-ready crop tensors, only sent to the encoding=tensor stream clients
+    std::shared_ptr<cwc::CropTensorizer> cropTensorizer;
+    if (streamServer != nullptr)
+    {
+        std::array<float, cwc::CROP_NUMBER_CHANNELS> tensorMean, tensorStd;
+        op::check(cwc::parseChannelValues(FLAGS_crop_tensor_mean, tensorMean)
+                  && cwc::parseChannelValues(FLAGS_crop_tensor_std, tensorStd),
+                  "Wrong `crop_tensor_mean` or `crop_tensor_std` (3 comma-separated values).", __LINE__, __FUNCTION__, __FILE__);
+        cropTensorizer = std::make_shared<cwc::CropTensorizer>(FLAGS_crop_tensor_size, (float)FLAGS_crop_tensor_scale,
+                                                               tensorMean, tensorStd);
+    }
+
+    // When the crops of the unchanged=1 stream clients count as unchanged
+    cwc::CropChangeSettings cropChangeSettings;
+    cropChangeSettings.threshold = (float)FLAGS_crop_unchanged_threshold;
+    cropChangeSettings.maxShift = FLAGS_crop_unchanged_max_shift;
+    cropChangeSettings.refreshInterval = (unsigned int)std::max(1, FLAGS_crop_unchanged_refresh);
+
+    // How people are followed across frames (track ids, engaged person)
+    cwc::TrackerSettings trackerSettings;
+    trackerSettings.maxDistance = (float)FLAGS_tracking_max_distance;
+    trackerSettings.maxMissed = (unsigned int)std::max(0, FLAGS_tracking_max_missed);
+
+    // Keypoint smoothing along each track
+    cwc::KeypointFilterSettings keypointFilterSettings;
+    keypointFilterSettings.minCutoff = (float)FLAGS_smoothing_min_cutoff;
+    keypointFilterSettings.beta = (float)FLAGS_smoothing_beta;
+    keypointFilterSettings.derivativeCutoff = (float)FLAGS_smoothing_derivative_cutoff;
+
+    // Keypoint velocities of the predict=... stream clients
+    cwc::KeypointPredictorSettings keypointPredictorSettings;
+    keypointPredictorSettings.historySize = FLAGS_prediction_history;
+
     // User processing
-    UserOutputClass userOutputClass;
+    UserOutputClass userOutputClass{FLAGS_binary_output, streamServer, FLAGS_shared_memory_name,
+                                    (unsigned int)FLAGS_shared_memory_slots, (unsigned int)FLAGS_keypoint_keyframe_interval,
+                                    (unsigned int)FLAGS_trace_log_interval, cropTensorizer, cropChangeSettings,
+                                    trackerSettings, keypointFilterSettings, keypointPredictorSettings, datumPool};
     bool userWantsToExit = false;
     while (!userWantsToExit)
     {
         // Pop frame
-        std::shared_ptr<std::vector<op::Datum>> datumProcessed;
+        std::shared_ptr<std::vector<UserDatum>> datumProcessed;
         if (opWrapper.waitAndPop(datumProcessed))
         {
+            if (datumProcessed != nullptr)
+                for (auto& datum : *datumProcessed)
+                    datum.trace.stamp(cwc::TraceStage::Popped);
             //userWantsToExit = userOutputClass.display(datumProcessed);
             userWantsToExit = userOutputClass.printKeypoints(datumProcessed);
         }
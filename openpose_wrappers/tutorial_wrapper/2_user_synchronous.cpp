@@ -27,6 +27,8 @@
 #endif
 // OpenPose dependencies
 #include <openpose/headers.hpp>
+// CwC
+#include "cwc/imagePrefetcher.hpp"
 
 // See all the available parameter options withe the `--help` flag. E.g. `./build/examples/openpose/openpose.bin --help`.
 // Note: This command will show you flags for other unnecessary 3rdparty files. Check only the flags for the OpenPose
@@ -39,6 +41,12 @@ DEFINE_int32(logging_level,             3,              "The logging level. Inte
                                                         " low priority messages and 4 for important ones.");
 // Producer
 DEFINE_string(image_dir,                "examples/media/",      "Process a directory of images. Read all standard formats (jpg, png, bmp, etc.).");
+DEFINE_int32(image_prefetch_workers,    2,              "Number of threads that read and decode the images ahead of the pose extraction (in order).");
+DEFINE_int32(image_prefetch_depth,      8,              "Maximum number of images decoded ahead.");
+DEFINE_int32(decode_reduction,          1,              "The images can be decoded at 1/2, 1/4 or 1/8 of their size (much faster for JPEG, see"
+                                                        " `cwc/decodeReduction.hpp`), the keypoints are still given in image coordinates (but"
+                                                        " found on the reduced image). Select 0 to use the largest reduction that keeps them at"
+                                                        " least as large as `net_resolution`, 1 (default) to disable it.");
 
 // Producer cwc
 DEFINE_string(video,					"",				"Use a video file instead of the camera. Use `examples/media/video.avi` for our default"
@@ -168,9 +176,12 @@ DEFINE_string(write_heatmaps_format,    "png",          "File extension and form
 struct UserDatum : public op::Datum
 {
     bool boolServerOn;
+    // Image pixels per pixel of cvInputData (decoded reduced, see cwc/decodeReduction.hpp)
+    float sourceScale;
 
     UserDatum(const bool boolServerOn_ = true) :
-        boolServerOn{boolServerOn_}
+        boolServerOn{boolServerOn_},
+        sourceScale{1.f}
     {}
 };
 
@@ -178,16 +189,15 @@ struct UserDatum : public op::Datum
 // that the user usually knows which kind of data he will move between the queues,
 // in this case we assume a std::shared_ptr of a std::vector of UserDatum
 
-// This worker will just read and return all the jpg files in a directory
+// This worker will just read and return all the jpg files in a directory (read and decoded ahead by cwc::ImagePrefetcher)
 class WUserInput : public op::WorkerProducer<std::shared_ptr<std::vector<UserDatum>>>
 {
 public:
-    WUserInput(const std::string& directoryPath) :
-        mImageFiles{op::getFilesOnDirectory(directoryPath, "jpg")},
-        // mImageFiles{op::getFilesOnDirectory(directoryPath, std::vector<std::string>{"jpg", "png"})}, // If we want "jpg" + "png" images
-        mCounter{0}
+    WUserInput(const std::string& directoryPath, const cwc::ImagePrefetchSettings& imagePrefetchSettings) :
+        mImagePrefetcher{op::getFilesOnDirectory(directoryPath, "jpg"), imagePrefetchSettings}
+        // mImagePrefetcher{cwc::getImageFiles(directoryPath), imagePrefetchSettings} // If we want all the image formats
     {
-        if (mImageFiles.empty())
+        if (mImagePrefetcher.isFinished())
             op::error("No images found on: " + directoryPath, __LINE__, __FUNCTION__, __FILE__);
     }
 
@@ -198,7 +208,7 @@ public:
         try
         {
             // Close program when empty frame
-            if (mImageFiles.size() <= mCounter)
+            if (mImagePrefetcher.isFinished())
             {
                 op::log("Last frame read and added to queue. Closing program after it is processed.", op::Priority::High);
                 // This funtion stops this worker, which will eventually stop the whole thread system once all the frames have been processed
@@ -213,12 +223,14 @@ public:
                 auto& datum = datumsPtr->at(0);
 
                 // Fill datum
-                datum.cvInputData = cv::imread(mImageFiles.at(mCounter++));
+                std::string path;
+                mImagePrefetcher.next(datum.cvInputData, path);
+                datum.sourceScale = (float)mImagePrefetcher.getReduction();
 
                 // If empty frame -> return nullptr
                 if (datum.cvInputData.empty())
                 {
-                    op::log("Empty frame detected on path: " + mImageFiles.at(mCounter-1) + ". Closing program.", op::Priority::High);
+                    op::log("Empty frame detected on path: " + path + ". Closing program.", op::Priority::High);
                     this->stop();
                     datumsPtr = nullptr;
                 }
@@ -236,8 +248,7 @@ public:
     }
 
 private:
-    const std::vector<std::string> mImageFiles;
-    unsigned long long mCounter;
+    cwc::ImagePrefetcher mImagePrefetcher;
 };
 
 // This worker will just invert the image
@@ -288,7 +299,8 @@ public:
             {
                 // Show in command line the resulting pose keypoints for body, face and hands
                 op::log("\nKeypoints:");
-                // Accesing each element of the keypoints
+                // Accesing each element of the keypoints (in image coordinates)
+                cwc::scaleKeypoints(datumsPtr->at(0).poseKeypoints, datumsPtr->at(0).sourceScale);
                 const auto& poseKeypoints = datumsPtr->at(0).poseKeypoints;
                 op::log("Person pose keypoints:");
                 for (auto person = 0 ; person < poseKeypoints.getSize(0) ; person++)
@@ -472,7 +484,13 @@ int openPoseTutorialWrapper2()
 
     // Initializing the user custom classes
     // Frames producer (e.g. video, webcam, ...)
-    auto wUserInput = std::make_shared<WUserInput>(FLAGS_image_dir);
+    cwc::ImagePrefetchSettings imagePrefetchSettings;
+    imagePrefetchSettings.workers = (unsigned int)std::max(1, FLAGS_image_prefetch_workers);
+    imagePrefetchSettings.depth = (unsigned int)std::max(1, FLAGS_image_prefetch_depth);
+    imagePrefetchSettings.reduction = FLAGS_decode_reduction;
+    imagePrefetchSettings.minWidth = std::max(netInputSize.x, 0);
+    imagePrefetchSettings.minHeight = std::max(netInputSize.y, 0);
+    auto wUserInput = std::make_shared<WUserInput>(FLAGS_image_dir, imagePrefetchSettings);
     // Processing
     auto wUserPostProcessing = std::make_shared<WUserPostProcessing>();
     // GUI (Display)
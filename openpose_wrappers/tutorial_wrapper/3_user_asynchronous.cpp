@@ -313,6 +313,8 @@
 #endif
 // OpenPose dependencies
 #include <openpose/headers.hpp>
+// CwC
+#include "cwc/imagePrefetcher.hpp"
 
 // See all the available parameter options withe the `--help` flag. E.g. `./build/examples/openpose/openpose.bin --help`.
 // Note: This command will show you flags for other unnecessary 3rdparty files. Check only the flags for the OpenPose
@@ -323,6 +325,12 @@ DEFINE_int32(logging_level,             3,              "The logging level. Inte
                                                         " low priority messages and 4 for important ones.");
 // Producer
 DEFINE_string(image_dir,                "examples/media/",      "Process a directory of images. Read all standard formats (jpg, png, bmp, etc.).");
+DEFINE_int32(image_prefetch_workers,    2,              "Number of threads that read and decode the images ahead of the pose extraction (in order).");
+DEFINE_int32(image_prefetch_depth,      8,              "Maximum number of images decoded ahead.");
+DEFINE_int32(decode_reduction,          1,              "The images can be decoded at 1/2, 1/4 or 1/8 of their size (much faster for JPEG, see"
+                                                        " `cwc/decodeReduction.hpp`), the keypoints are still given in image coordinates (but"
+                                                        " found on the reduced image). Select 0 to use the largest reduction that keeps them at"
+                                                        " least as large as `net_resolution`, 1 (default) to disable it.");
 // OpenPose
 DEFINE_string(model_folder,             "models/",      "Folder path (absolute or relative) where the models (pose, face, ...) are located.");
 DEFINE_string(output_resolution,        "-1x-1",        "The image resolution (display and output). Use \"-1x-1\" to force the program to use the"
@@ -441,9 +449,12 @@ DEFINE_string(write_heatmaps_format,    "png",          "File extension and form
 struct UserDatum : public op::Datum
 {
     bool boolThatUserNeedsForSomeReason;
+    // Image pixels per pixel of cvInputData (decoded reduced, see cwc/decodeReduction.hpp)
+    float sourceScale;
 
     UserDatum(const bool boolThatUserNeedsForSomeReason_ = false) :
-        boolThatUserNeedsForSomeReason{boolThatUserNeedsForSomeReason_}
+        boolThatUserNeedsForSomeReason{boolThatUserNeedsForSomeReason_},
+        sourceScale{1.f}
     {}
 };
 
@@ -451,24 +462,23 @@ struct UserDatum : public op::Datum
 // that the user usually knows which kind of data he will move between the queues,
 // in this case we assume a std::shared_ptr of a std::vector of UserDatum
 
-// This worker will just read and return all the jpg files in a directory
+// This worker will just read and return all the jpg files in a directory (read and decoded ahead by cwc::ImagePrefetcher)
 class UserInputClass
 {
 public:
-    UserInputClass(const std::string& directoryPath) :
-        mImageFiles{op::getFilesOnDirectory(directoryPath, "jpg")},
-        // mImageFiles{op::getFilesOnDirectory(directoryPath, std::vector<std::string>{"jpg", "png"})}, // If we want "jpg" + "png" images
-        mCounter{0},
+    UserInputClass(const std::string& directoryPath, const cwc::ImagePrefetchSettings& imagePrefetchSettings) :
+        mImagePrefetcher{op::getFilesOnDirectory(directoryPath, "jpg"), imagePrefetchSettings},
+        // mImagePrefetcher{cwc::getImageFiles(directoryPath), imagePrefetchSettings}, // If we want all the image formats
         mClosed{false}
     {
-        if (mImageFiles.empty())
+        if (mImagePrefetcher.isFinished())
             op::error("No images found on: " + directoryPath, __LINE__, __FUNCTION__, __FILE__);
     }
 
     std::shared_ptr<std::vector<UserDatum>> createDatum()
     {
         // Close program when empty frame
-        if (mClosed || mImageFiles.size() <= mCounter)
+        if (mClosed || mImagePrefetcher.isFinished())
         {
             op::log("Last frame read and added to queue. Closing program after it is processed.", op::Priority::High);
             // This funtion stops this worker, which will eventually stop the whole thread system once all the frames have been processed
@@ -483,12 +493,14 @@ public:
             auto& datum = datumsPtr->at(0);
 
             // Fill datum
-            datum.cvInputData = cv::imread(mImageFiles.at(mCounter++));
+            std::string path;
+            mImagePrefetcher.next(datum.cvInputData, path);
+            datum.sourceScale = (float)mImagePrefetcher.getReduction();
 
             // If empty frame -> return nullptr
             if (datum.cvInputData.empty())
             {
-                op::log("Empty frame detected on path: " + mImageFiles.at(mCounter-1) + ". Closing program.", op::Priority::High);
+                op::log("Empty frame detected on path: " + path + ". Closing program.", op::Priority::High);
                 mClosed = true;
                 datumsPtr = nullptr;
             }
@@ -503,8 +515,7 @@ public:
     }
 
 private:
-    const std::vector<std::string> mImageFiles;
-    unsigned long long mCounter;
+    cwc::ImagePrefetcher mImagePrefetcher;
     bool mClosed;
 };
 
@@ -534,7 +545,8 @@ public:
         if (datumsPtr != nullptr && !datumsPtr->empty())
         {
             op::log("\nKeypoints:");
-            // Accesing each element of the keypoints
+            // Accesing each element of the keypoints (in image coordinates)
+            cwc::scaleKeypoints(datumsPtr->at(0).poseKeypoints, datumsPtr->at(0).sourceScale);
             const auto& poseKeypoints = datumsPtr->at(0).poseKeypoints;
             op::log("Person pose keypoints:");
             for (auto person = 0 ; person < poseKeypoints.getSize(0) ; person++)
@@ -650,7 +662,13 @@ int openPoseTutorialWrapper1()
     opWrapper.start();
 
     // User processing
-    UserInputClass userInputClass(FLAGS_image_dir);
+    cwc::ImagePrefetchSettings imagePrefetchSettings;
+    imagePrefetchSettings.workers = (unsigned int)std::max(1, FLAGS_image_prefetch_workers);
+    imagePrefetchSettings.depth = (unsigned int)std::max(1, FLAGS_image_prefetch_depth);
+    imagePrefetchSettings.reduction = FLAGS_decode_reduction;
+    imagePrefetchSettings.minWidth = std::max(netInputSize.x, 0);
+    imagePrefetchSettings.minHeight = std::max(netInputSize.y, 0);
+    UserInputClass userInputClass(FLAGS_image_dir, imagePrefetchSettings);
     UserOutputClass userOutputClass;
     bool userWantsToExit = false;
     while (!userWantsToExit && !userInputClass.isFinished())
@@ -0,0 +1,277 @@
+#ifndef CWC_BENCHMARKS_HPP
+#define CWC_BENCHMARKS_HPP
+
+// Microbenchmarks of the output stage, run by 1_user_asynchronous_output with the `benchmark_*` flags. They use synthetic
+// frames, so they need neither a camera nor OpenPose models.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <openpose/headers.hpp>
+#include "cropBufferPool.hpp"
+#include "decodeReduction.hpp"
+#include "frameData.hpp"
+#include "personTable.hpp"
+
+namespace cwc
+{
+    // Mean nanoseconds of one function(iteration) call
+    template<typename TFunction>
+    inline double measureNanoseconds(const int iterations, TFunction function)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        for (auto iteration = 0 ; iteration < iterations ; iteration++)
+            function(iteration);
+        const auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / (double)iterations;
+    }
+
+    inline void logBenchmark(const std::string& name, const double nanoseconds, const std::string& unit)
+    {
+        op::log("    " + name + ": " + std::to_string((long long)(nanoseconds + 0.5)) + " ns per " + unit, op::Priority::High);
+    }
+
+    // Calls to operator new of the whole program, counted by the executable's replacement of it in a build with
+    // CWC_COUNT_ALLOCATIONS defined (see 1_user_asynchronous_output.cpp), for benchmarkProducer. Always 0 otherwise.
+    inline std::atomic<unsigned long long>& getHeapAllocations()
+    {
+        static std::atomic<unsigned long long> heapAllocations{0ull};
+        return heapAllocations;
+    }
+
+    // CROP_SIZE x CROP_SIZE crops cut at varying positions of a frameWidth x frameHeight BGR frame
+    inline void benchmarkCropExtraction(const int iterations, const int frameWidth, const int frameHeight)
+    {
+        if (iterations <= 0 || frameWidth < CROP_SIZE || frameHeight < CROP_SIZE)
+            op::error("The crop benchmark needs iterations > 0 and a frame of at least CROP_SIZE x CROP_SIZE.",
+                      __LINE__, __FUNCTION__, __FILE__);
+        cv::Mat frame(frameHeight, frameWidth, CV_8UC3);
+        for (auto row = 0 ; row < frameHeight ; row++)
+        {
+            auto* const pixels = frame.ptr<unsigned char>(row);
+            for (auto column = 0 ; column < frameWidth * CROP_NUMBER_CHANNELS ; column++)
+                pixels[column] = (unsigned char)(row * 31 + column * 7);
+        }
+        // Pseudo-random crop positions, cycled through
+        std::vector<cv::Point> positions;
+        for (auto i = 0u ; i < 64u ; i++)
+            positions.emplace_back((int)((i * 2654435761u) % (unsigned)(frameWidth - CROP_SIZE + 1)),
+                                   (int)((i * 40503u + 17u) % (unsigned)(frameHeight - CROP_SIZE + 1)));
+        const auto cropSize = (std::size_t)(CROP_SIZE * CROP_SIZE * CROP_NUMBER_CHANNELS);
+        CropBufferPool cropBuffers{cropSize};
+        std::vector<unsigned char> perPixel(cropSize);
+        cv::Mat copied;
+        std::string text;
+        CropData crop;
+        crop.visible = true;
+        crop.width = CROP_SIZE;
+        crop.height = CROP_SIZE;
+        const auto textIterations = std::max(1, iterations / 100);
+
+        op::log("Crop extraction benchmark: " + std::to_string(CROP_SIZE) + "x" + std::to_string(CROP_SIZE) + " crops of a "
+                + std::to_string(frameWidth) + "x" + std::to_string(frameHeight) + " frame, " + std::to_string(iterations)
+                + " iterations (" + std::to_string(textIterations) + " for the text formatting).", op::Priority::High);
+        logBenchmark("at<cv::Vec3b> per value (previous text path)", measureNanoseconds(iterations, [&](const int iteration)
+        {
+            const auto& position = positions[iteration % positions.size()];
+            auto* output = perPixel.data();
+            for (auto row = position.y ; row < position.y + CROP_SIZE ; row++)
+                for (auto column = position.x ; column < position.x + CROP_SIZE ; column++)
+                    for (auto channel = 0 ; channel < CROP_NUMBER_CHANNELS ; channel++)
+                        *output++ = frame.at<cv::Vec3b>(row, column)[channel];
+        }), "crop");
+        logBenchmark("cv::Mat ROI copyTo (previous binary path)", measureNanoseconds(iterations, [&](const int iteration)
+        {
+            const auto& position = positions[iteration % positions.size()];
+            frame(cv::Rect(position.x, position.y, CROP_SIZE, CROP_SIZE)).copyTo(copied);
+        }), "crop");
+        logBenchmark("copyCropRows into the pool", measureNanoseconds(iterations, [&](const int iteration)
+        {
+            const auto& position = positions[iteration % positions.size()];
+            copyCropRows(frame, position.x, position.y, CROP_SIZE, CROP_SIZE,
+                         cropBuffers.getBuffer((unsigned long long)iteration, CropRegion::LeftHand));
+        }), "crop");
+        logBenchmark("single memcpy of the same size (bound)", measureNanoseconds(iterations, [&](const int iteration)
+        {
+            const auto& position = positions[iteration % positions.size()];
+            std::memcpy(cropBuffers.getBuffer((unsigned long long)iteration, CropRegion::LeftHand),
+                        frame.ptr<unsigned char>(position.y), cropSize);
+        }), "crop");
+        logBenchmark("text, std::to_string concatenation (previous)", measureNanoseconds(textIterations, [&](const int iteration)
+        {
+            const auto& position = positions[iteration % positions.size()];
+            std::string previousText;
+            for (auto row = position.y ; row < position.y + CROP_SIZE ; row++)
+                for (auto column = position.x ; column < position.x + CROP_SIZE ; column++)
+                    previousText += std::to_string(frame.at<cv::Vec3b>(row, column)[0]) + " " +
+                        std::to_string(frame.at<cv::Vec3b>(row, column)[1]) + " " +
+                        std::to_string(frame.at<cv::Vec3b>(row, column)[2]) + " ";
+        }), "crop");
+        logBenchmark("text, formatCropText from the pool", measureNanoseconds(textIterations, [&](const int iteration)
+        {
+            crop.pixels = cropBuffers.getBuffer((unsigned long long)iteration, CropRegion::LeftHand);
+            formatCropText(crop, text);
+        }), "crop");
+
+        // Both copies must give the same bytes
+        const auto& position = positions[0];
+        auto* const pooled = cropBuffers.getBuffer(0ull, CropRegion::LeftHand);
+        copyCropRows(frame, position.x, position.y, CROP_SIZE, CROP_SIZE, pooled);
+        frame(cv::Rect(position.x, position.y, CROP_SIZE, CROP_SIZE)).copyTo(copied);
+        if (!copied.isContinuous() || std::memcmp(copied.data, pooled, cropSize) != 0)
+            op::error("copyCropRows does not match cv::Mat::copyTo.", __LINE__, __FUNCTION__, __FILE__);
+    }
+
+    // computePersonTable against the per-person std::map code it replaced, for numberPeople synthetic people (about 1 in 8
+    // keypoints missing) spread over a frameWidth x frameHeight frame
+    inline void benchmarkPersonTable(const int iterations, const int numberPeople, const int frameWidth, const int frameHeight)
+    {
+        if (iterations <= 0 || numberPeople <= 0 || frameWidth <= 0 || frameHeight <= 0)
+            op::error("The person table benchmark needs iterations > 0, people > 0 and a frame.", __LINE__, __FUNCTION__, __FILE__);
+        op::Array<float> poseKeypoints{{numberPeople, POSE_NUMBER_KEYPOINTS, POSE_VALUES_PER_KEYPOINT}};
+        auto* const keypoints = poseKeypoints.getPtr();
+        for (auto value = 0u ; value < (unsigned)poseKeypoints.getVolume() ; value++)
+        {
+            const auto random = value * 2654435761u;
+            const auto xyscore = value % POSE_VALUES_PER_KEYPOINT;
+            const auto missing = ((value / POSE_VALUES_PER_KEYPOINT) * 40503u >> 5) % 8u == 0u;
+            keypoints[value] = (missing ? 0.f : xyscore == 0 ? (float)(random % (unsigned)frameWidth)
+                                : xyscore == 1 ? (float)(random % (unsigned)frameHeight) : (random % 1000u) / 1000.f);
+        }
+        struct DetectedPerson
+        {
+            bool isWithinCentralFrame;
+            float averageLimbLength;
+            float meanKeypointX;
+        };
+        std::map<int, DetectedPerson> personMap;
+        const auto populatePersonMap = [&]()
+        {
+            const auto centralStart = (unsigned)frameWidth / 3;
+            const auto centralEnd = 2 * (unsigned)frameWidth / 3;
+            for (auto person = 0 ; person < poseKeypoints.getSize(0) ; person++)
+            {
+                auto meanX = 0.f;
+                auto countX = 0;
+                for (const auto joint : {0, 1, 2, 5})
+                    if (poseKeypoints[{person, joint, 0}] > 0.00001)
+                    {
+                        meanX += poseKeypoints[{person, joint, 0}];
+                        countX++;
+                    }
+                meanX /= countX;
+                personMap[person].meanKeypointX = meanX;
+                personMap[person].isWithinCentralFrame = (meanX >= centralStart && meanX <= centralEnd);
+                auto limbSum = 0.f;
+                auto limbCount = 0;
+                const auto addLimb = [&](const int a, const int b)
+                {
+                    const cv::Vec2f pointA{poseKeypoints[{person, a, 0}], poseKeypoints[{person, a, 1}]};
+                    const cv::Vec2f pointB{poseKeypoints[{person, b, 0}], poseKeypoints[{person, b, 1}]};
+                    limbSum = limbSum + cv::norm(pointB - pointA);
+                    limbCount++;
+                };
+                if (poseKeypoints[{person, 1, 0}] > 0.00001 && poseKeypoints[{person, 1, 1}] > 0.00001)
+                    for (const auto joint : {0, 2, 5, 8, 11})
+                        if (poseKeypoints[{person, joint, 0}] > 0.00001 && poseKeypoints[{person, joint, 1}] > 0.00001)
+                            addLimb(1, joint);
+                if (poseKeypoints[{person, 3, 0}] > 0.00001 && poseKeypoints[{person, 3, 1}] > 0.00001
+                    && poseKeypoints[{person, 2, 0}] > 0.00001 && poseKeypoints[{person, 2, 1}])
+                    addLimb(2, 3);
+                if (poseKeypoints[{person, 6, 0}] > 0.00001 && poseKeypoints[{person, 6, 1}] > 0.00001
+                    && poseKeypoints[{person, 5, 0}] > 0.00001 && poseKeypoints[{person, 5, 1}])
+                    addLimb(5, 6);
+                if (limbCount != 0)
+                    personMap[person].averageLimbLength = limbSum / limbCount;
+            }
+        };
+        PersonTable personTable;
+
+        op::log("Person table benchmark: " + std::to_string(numberPeople) + " people in a " + std::to_string(frameWidth) + "x"
+                + std::to_string(frameHeight) + " frame, " + std::to_string(iterations) + " iterations.", op::Priority::High);
+        logBenchmark("std::map and operator[] (previous)", measureNanoseconds(iterations, [&](const int)
+        {
+            populatePersonMap();
+            personMap.clear();
+        }), "frame");
+        logBenchmark("computePersonTable", measureNanoseconds(iterations, [&](const int)
+        {
+            computePersonTable(poseKeypoints, (unsigned int)frameWidth, personTable);
+        }), "frame");
+
+        // Both must find the same people
+        populatePersonMap();
+        computePersonTable(poseKeypoints, (unsigned int)frameWidth, personTable);
+        for (auto person = 0 ; person < numberPeople ; person++)
+        {
+            const auto& detectedPerson = personMap[person];
+            // A person without nose, neck nor shoulders had a NaN mean, now 0
+            const auto sameMean = (std::isnan(detectedPerson.meanKeypointX) ? personTable.meanKeypointX[person] == 0.f
+                                   : detectedPerson.meanKeypointX == personTable.meanKeypointX[person]);
+            if (!sameMean || detectedPerson.isWithinCentralFrame != (personTable.isWithinCentralFrame[person] != 0)
+                || std::abs(detectedPerson.averageLimbLength - personTable.averageLimbLength[person])
+                   > 1e-4f * std::max(1.f, detectedPerson.averageLimbLength))
+                op::error("computePersonTable does not match the std::map code (person " + std::to_string(person) + ").",
+                          __LINE__, __FUNCTION__, __FILE__);
+        }
+    }
+
+    // Heap allocations (operator new) and frame buffer allocations (see getFrameBufferAllocations) per frame of
+    // producer.workProducer() (e.g. WUserInput reading image_dir or archive_input with a DatumPool), without OpenPose:
+    // framesInFlight frames are held, as by the OpenPose queues and the output, and released oldest first. The first
+    // `frames` frames warm it up (pool, prefetch slots), the next `frames` are measured. Use frames_repeat for a short
+    // image directory or archive.
+    template<typename TProducer>
+    inline void benchmarkProducer(TProducer& producer, const int frames, const std::size_t framesInFlight)
+    {
+        if (frames <= 0 || framesInFlight == 0)
+            op::error("The producer benchmark needs frames > 0 and frames in flight.", __LINE__, __FUNCTION__, __FILE__);
+        std::vector<decltype(producer.workProducer())> inFlight(framesInFlight);
+        auto next = 0ull;
+        const auto produce = [&](const int numberFrames)
+        {
+            auto produced = 0;
+            while (produced < numberFrames && producer.isRunning())
+            {
+                auto datums = producer.workProducer();
+                if (datums == nullptr)
+                    continue;
+                inFlight[next++ % inFlight.size()] = std::move(datums);
+                produced++;
+            }
+            return produced;
+        };
+        op::log("Producer benchmark: " + std::to_string(frames) + " frames after as many to warm up, "
+                + std::to_string(framesInFlight) + " in flight.", op::Priority::High);
+        if (produce(frames) < frames)
+            op::error("The producer ran out of frames while warming up (frames_repeat?).", __LINE__, __FUNCTION__, __FILE__);
+        #ifdef CWC_COUNT_ALLOCATIONS
+            const auto heapAllocations = getHeapAllocations().load();
+        #endif
+        const auto frameBufferAllocations = getFrameBufferAllocations().load();
+        const auto begin = std::chrono::steady_clock::now();
+        const auto produced = produce(frames);
+        const auto end = std::chrono::steady_clock::now();
+        if (produced == 0)
+            op::error("The producer ran out of frames.", __LINE__, __FUNCTION__, __FILE__);
+        logBenchmark("workProducer", std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()
+                                     / (double)produced, "frame");
+        #ifdef CWC_COUNT_ALLOCATIONS
+            const auto heapAllocationsPerFrame = std::to_string((getHeapAllocations().load() - heapAllocations)
+                                                                / (double)produced) + " per frame";
+        #else
+            const auto heapAllocationsPerFrame = std::string{"not counted (build with CWC_COUNT_ALLOCATIONS)"};
+        #endif
+        op::log("    heap allocations: " + heapAllocationsPerFrame + ", frame buffer allocations: "
+                + std::to_string((getFrameBufferAllocations().load() - frameBufferAllocations) / (double)produced)
+                + " per frame (" + std::to_string(produced) + " frames)", op::Priority::High);
+    }
+}
+
+#endif // CWC_BENCHMARKS_HPP
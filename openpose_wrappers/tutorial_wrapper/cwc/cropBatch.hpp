@@ -0,0 +1,113 @@
+#ifndef CWC_CROP_BATCH_HPP
+#define CWC_CROP_BATCH_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <openpose/headers.hpp>
+#include "cropBufferPool.hpp"
+#include "frameData.hpp"
+#include "roiEngine.hpp"
+
+namespace cwc
+{
+    // Below this many crop bytes per region, copying every person on this thread is faster than waking the OpenCV workers
+    const std::size_t CROP_BATCH_PARALLEL_BYTES = 64 * 1024;
+
+    // Cuts one region of every detected person into one contiguous NHWC block per region (FrameData::cropBatches), for the
+    // people=all stream clients. The blocks are kept and grown across frames, and refilled for every frame.
+    class CropBatcher
+    {
+    public:
+        // results: RoiEngine::evaluate() of every person, person-major (person p, spec s at p * specs.size() + s).
+        // people: FrameData::people in the same order (for their persistent indices). regionMask: bit (1 << CropRegion) of
+        // the regions to batch.
+        void fill(const cv::Mat& image, const RoiEngine& roiEngine, const std::vector<RoiResult>& results,
+                  const std::vector<PersonData>& people, const int regionMask, FrameData& frameData)
+        {
+            const auto& specs = roiEngine.getSpecs();
+            const auto numberPeople = (specs.empty() ? 0 : (int)(results.size() / specs.size()));
+            if (numberPeople != (int)people.size())
+                op::error("Crop batch results and people do not match.", __LINE__, __FUNCTION__, __FILE__);
+            for (auto specIndex = 0 ; specIndex < (int)specs.size() ; specIndex++)
+            {
+                const auto& spec = specs[specIndex];
+                if (!(regionMask & (1 << (int)spec.region)))
+                    continue;
+                auto& buffer = mBuffers[(int)spec.region];
+                const auto cropBytes = (std::size_t)(spec.width * spec.height * CROP_NUMBER_CHANNELS);
+                buffer.indices.resize(numberPeople);
+                buffer.visible.resize(numberPeople);
+                buffer.pixels.resize(numberPeople * cropBytes);
+                for (auto person = 0 ; person < numberPeople ; person++)
+                {
+                    buffer.indices[person] = people[person].index;
+                    buffer.visible[person] = (results[person * specs.size() + specIndex].visible ? 1 : 0);
+                }
+                const CopyBody copyBody{image, spec, results, specs.size(), specIndex, buffer};
+                if (numberPeople * cropBytes >= CROP_BATCH_PARALLEL_BYTES)
+                    cv::parallel_for_(cv::Range{0, numberPeople}, copyBody);
+                else
+                    copyBody(cv::Range{0, numberPeople});
+                auto& batch = frameData.cropBatches[(int)spec.region];
+                batch.count = numberPeople;
+                batch.width = spec.width;
+                batch.height = spec.height;
+                batch.personIndices = buffer.indices.data();
+                batch.visible = buffer.visible.data();
+                batch.pixels = buffer.pixels.data();
+            }
+        }
+
+    private:
+        struct Buffer
+        {
+            std::vector<unsigned int> indices;
+            std::vector<unsigned char> visible;
+            std::vector<unsigned char> pixels;
+        };
+
+        std::array<Buffer, CROP_NUMBER_REGIONS> mBuffers;
+
+        // Copies the crops of a range of people into their slots of the block (zeros if the region is not visible)
+        class CopyBody : public cv::ParallelLoopBody
+        {
+        public:
+            CopyBody(const cv::Mat& image, const RoiSpec& spec, const std::vector<RoiResult>& results,
+                     const std::size_t numberSpecs, const int specIndex, Buffer& buffer) :
+                mImage(image),
+                mSpec(spec),
+                mResults(results),
+                mNumberSpecs{numberSpecs},
+                mSpecIndex{specIndex},
+                mBuffer(buffer)
+            {}
+
+            void operator()(const cv::Range& range) const
+            {
+                const auto cropBytes = (std::size_t)(mSpec.width * mSpec.height * CROP_NUMBER_CHANNELS);
+                for (auto person = range.start ; person < range.end ; person++)
+                {
+                    const auto& result = mResults[person * mNumberSpecs + mSpecIndex];
+                    auto* const slot = &mBuffer.pixels[person * cropBytes];
+                    if (result.visible)
+                        copyCropRows(mImage, result.x, result.y, mSpec.width, mSpec.height, slot);
+                    else
+                        std::memset(slot, 0, cropBytes);
+                }
+            }
+
+        private:
+            const cv::Mat& mImage;
+            const RoiSpec& mSpec;
+            const std::vector<RoiResult>& mResults;
+            const std::size_t mNumberSpecs;
+            const int mSpecIndex;
+            Buffer& mBuffer;
+        };
+    };
+}
+
+#endif // CWC_CROP_BATCH_HPP
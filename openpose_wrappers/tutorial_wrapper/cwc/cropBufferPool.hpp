@@ -0,0 +1,85 @@
+#ifndef CWC_CROP_BUFFER_POOL_HPP
+#define CWC_CROP_BUFFER_POOL_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    const std::size_t CROP_BUFFER_ALIGNMENT = 64;
+
+    // Crop buffers allocated once and recycled frame after frame: frame n uses the set n % numberFrames, so the crops of
+    // the previous numberFrames - 1 frames stay valid while the current one is extracted. Every buffer starts on a cache line.
+    class CropBufferPool
+    {
+    public:
+        // bufferSize: maximum bytes of one crop (width x height x 3)
+        explicit CropBufferPool(const std::size_t bufferSize, const unsigned int numberFrames = 2) :
+            mBufferSize{(bufferSize + CROP_BUFFER_ALIGNMENT - 1) / CROP_BUFFER_ALIGNMENT * CROP_BUFFER_ALIGNMENT},
+            mNumberFrames{(numberFrames > 0 ? numberFrames : 1)},
+            mMemory(mNumberFrames * CROP_NUMBER_REGIONS * mBufferSize + CROP_BUFFER_ALIGNMENT)
+        {
+            const auto address = (std::uintptr_t)mMemory.data();
+            pBuffers = mMemory.data() + (CROP_BUFFER_ALIGNMENT - address % CROP_BUFFER_ALIGNMENT) % CROP_BUFFER_ALIGNMENT;
+        }
+
+        std::size_t getBufferSize() const
+        {
+            return mBufferSize;
+        }
+
+        unsigned char* getBuffer(const unsigned long long frameNumber, const CropRegion region)
+        {
+            return pBuffers + ((frameNumber % mNumberFrames) * CROP_NUMBER_REGIONS + (int)region) * mBufferSize;
+        }
+
+    private:
+        const std::size_t mBufferSize;
+        const unsigned int mNumberFrames;
+        std::vector<unsigned char> mMemory;
+        unsigned char* pBuffers;
+
+        CropBufferPool(const CropBufferPool&) = delete;
+        CropBufferPool& operator=(const CropBufferPool&) = delete;
+    };
+
+    // Copies the width x height region at (x, y) of a BGR image into buffer, one memcpy per row (width x 3 contiguous bytes
+    // per row, no padding). The region must be inside the image.
+    inline void copyCropRows(const cv::Mat& image, const int x, const int y, const int width, const int height,
+                             unsigned char* const buffer)
+    {
+        if (image.type() != CV_8UC3)
+            op::error("Crops can only be cut from BGR (CV_8UC3) frames.", __LINE__, __FUNCTION__, __FILE__);
+        const auto rowSize = (std::size_t)width * CROP_NUMBER_CHANNELS;
+        for (auto row = 0 ; row < height ; row++)
+            std::memcpy(buffer + row * rowSize, image.ptr<unsigned char>(y + row) + x * CROP_NUMBER_CHANNELS, rowSize);
+    }
+
+    // Text output of a crop, "B G R B G R ... " row by row (the format the text output always had). text keeps its
+    // capacity, so once it has grown to the size of a crop no more memory is allocated.
+    inline void formatCropText(const CropData& crop, std::string& text)
+    {
+        static const auto numbers = []() -> std::array<std::string, 256>
+        {
+            std::array<std::string, 256> strings;
+            for (auto value = 0 ; value < 256 ; value++)
+                strings[value] = std::to_string(value) + " ";
+            return strings;
+        }();
+        text.clear();
+        if (!crop.visible)
+            return;
+        text.reserve(crop.width * crop.height * CROP_NUMBER_CHANNELS * 4);
+        const auto numberValues = crop.width * crop.height * CROP_NUMBER_CHANNELS;
+        for (auto i = 0 ; i < numberValues ; i++)
+            text += numbers[crop.pixels[i]];
+    }
+}
+
+#endif // CWC_CROP_BUFFER_POOL_HPP
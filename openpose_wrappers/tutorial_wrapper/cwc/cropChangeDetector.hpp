@@ -0,0 +1,109 @@
+#ifndef CWC_CROP_CHANGE_DETECTOR_HPP
+#define CWC_CROP_CHANGE_DETECTOR_HPP
+
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <opencv2/core/core.hpp>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    // Side of the thumbnails compared by CropChangeDetector (cells per row/column)
+    const auto CROP_THUMBNAIL_SIZE = 8;
+
+    struct CropChangeSettings
+    {
+        float threshold;                // Mean absolute difference of the thumbnails (0-255) below which a crop is unchanged
+        int maxShift;                   // Maximum ROI displacement (pixels, along x and y) of an unchanged crop
+        unsigned int refreshInterval;   // A crop is sent again at least every this many frames, even if it did not change
+
+        CropChangeSettings() :
+            threshold{3.f}, maxShift{2}, refreshInterval{30u}
+        {}
+    };
+
+    // Decides whether the crop of one region is the same as the last one sent (the reference), for the unchanged=1 stream
+    // clients. The ROI must not have moved by more than maxShift and the thumbnails (CROP_THUMBNAIL_SIZE^2 cells, each the
+    // mean of a subsample of its pixels) must not differ by more than threshold on average. It compares against the last
+    // sent crop, not the previous frame, so a slow drift is still detected. A changed crop becomes the new reference.
+    class CropChangeDetector
+    {
+    public:
+        explicit CropChangeDetector(const CropChangeSettings& settings = CropChangeSettings{}) :
+            mSettings(settings),
+            mHasReference{false},
+            mReferenceX{0},
+            mReferenceY{0},
+            mReferenceFrame{0ull}
+        {}
+
+        // The next crop is a reference (e.g. a new client, which has no crop yet)
+        void reset()
+        {
+            mHasReference = false;
+        }
+
+        // Region (x, y, width, height) of a BGR image, already inside the image. Returns true and the frame number of the
+        // reference in sameAs if it did not change meaningfully.
+        bool isUnchanged(const cv::Mat& image, const int x, const int y, const int width, const int height,
+                         const unsigned long long frameNumber, unsigned long long& sameAs)
+        {
+            std::array<float, CROP_THUMBNAIL_SIZE * CROP_THUMBNAIL_SIZE * CROP_NUMBER_CHANNELS> thumbnail;
+            getThumbnail(image, x, y, width, height, thumbnail);
+            if (mHasReference && std::abs(x - mReferenceX) <= mSettings.maxShift
+                && std::abs(y - mReferenceY) <= mSettings.maxShift
+                && frameNumber - mReferenceFrame < mSettings.refreshInterval)
+            {
+                auto difference = 0.f;
+                for (auto i = 0u ; i < thumbnail.size() ; i++)
+                    difference += std::abs(thumbnail[i] - mReference[i]);
+                if (difference <= mSettings.threshold * thumbnail.size())
+                {
+                    sameAs = mReferenceFrame;
+                    return true;
+                }
+            }
+            mHasReference = true;
+            mReferenceX = x;
+            mReferenceY = y;
+            mReferenceFrame = frameNumber;
+            mReference = thumbnail;
+            return false;
+        }
+
+    private:
+        const CropChangeSettings mSettings;
+        bool mHasReference;
+        int mReferenceX;
+        int mReferenceY;
+        unsigned long long mReferenceFrame;
+        std::array<float, CROP_THUMBNAIL_SIZE * CROP_THUMBNAIL_SIZE * CROP_NUMBER_CHANNELS> mReference;
+
+        // Mean BGR of each cell, from every other pixel of every other row (a quarter of the pixels)
+        static void getThumbnail(const cv::Mat& image, const int x, const int y, const int width, const int height,
+                                 std::array<float, CROP_THUMBNAIL_SIZE * CROP_THUMBNAIL_SIZE * CROP_NUMBER_CHANNELS>& thumbnail)
+        {
+            std::array<int, CROP_THUMBNAIL_SIZE * CROP_THUMBNAIL_SIZE> counts;
+            thumbnail.fill(0.f);
+            counts.fill(0);
+            for (auto row = 0 ; row < height ; row += 2)
+            {
+                const auto* const pixels = image.ptr<unsigned char>(y + row) + x * CROP_NUMBER_CHANNELS;
+                const auto cellRow = row * CROP_THUMBNAIL_SIZE / height;
+                for (auto column = 0 ; column < width ; column += 2)
+                {
+                    const auto cell = cellRow * CROP_THUMBNAIL_SIZE + column * CROP_THUMBNAIL_SIZE / width;
+                    for (auto channel = 0 ; channel < CROP_NUMBER_CHANNELS ; channel++)
+                        thumbnail[cell * CROP_NUMBER_CHANNELS + channel] += pixels[column * CROP_NUMBER_CHANNELS + channel];
+                    counts[cell]++;
+                }
+            }
+            for (auto cell = 0 ; cell < CROP_THUMBNAIL_SIZE * CROP_THUMBNAIL_SIZE ; cell++)
+                for (auto channel = 0 ; channel < CROP_NUMBER_CHANNELS ; channel++)
+                    thumbnail[cell * CROP_NUMBER_CHANNELS + channel] /= (counts[cell] > 0 ? counts[cell] : 1);
+        }
+    };
+}
+
+#endif // CWC_CROP_CHANGE_DETECTOR_HPP
@@ -0,0 +1,48 @@
+#ifndef CWC_CROP_ENCODER_HPP
+#define CWC_CROP_ENCODER_HPP
+
+#include <array>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <openpose/headers.hpp>
+#include "streamPackets.hpp"
+
+namespace cwc
+{
+    // PNG is lossless anyway, favor speed: the encoder runs once per frame and stream
+    const auto CROP_PNG_COMPRESSION = 1;
+
+    // PNG/JPEG bytes of a BGR crop. Slow compared to the rest of the output, so StreamServer calls it from its encoder
+    // thread, never from the waitAndPop loop.
+    inline std::vector<unsigned char> encodeCrop(const cv::Mat& crop, const StreamOptions& options)
+    {
+        std::vector<unsigned char> bytes;
+        const auto png = (options.encoding == CropEncoding::Png);
+        const std::vector<int> parameters{(png ? cv::IMWRITE_PNG_COMPRESSION : cv::IMWRITE_JPEG_QUALITY),
+                                          (png ? CROP_PNG_COMPRESSION : options.quality)};
+        if (!cv::imencode((png ? ".png" : ".jpg"), crop, bytes, parameters))
+            op::error("Crop could not be encoded.", __LINE__, __FUNCTION__, __FILE__);
+        return bytes;
+    }
+
+    // Same '<iqiHH' header as makeColorPacket, followed by the PNG/JPEG bytes (0x0 and no payload if the region is unknown,
+    // i.e. crops[region] is empty)
+    inline Packet makeEncodedStreamPacket(const StreamId streamId, const std::array<cv::Mat, CROP_NUMBER_REGIONS>& crops,
+                                          const StreamOptions& options, const std::int64_t timestamp)
+    {
+        CropRegion region;
+        std::int32_t frameType;
+        if (!getColorStreamRegion(streamId, region, frameType))
+            return nullptr;
+        const auto& crop = crops[(int)region];
+        if (crop.empty())
+            return makeColorPacketHeader(frameType, 0, 0, 0, timestamp);
+        const auto bytes = encodeCrop(crop, options);
+        auto packet = makeColorPacketHeader(frameType, crop.cols, crop.rows, bytes.size(), timestamp);
+        packet->insert(packet->end(), bytes.begin(), bytes.end());
+        return packet;
+    }
+}
+
+#endif // CWC_CROP_ENCODER_HPP
@@ -0,0 +1,162 @@
+#ifndef CWC_CROP_TENSOR_HPP
+#define CWC_CROP_TENSOR_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    // Parses "b,g,r" (3 comma-separated numbers). Returns false if it is not.
+    inline bool parseChannelValues(const std::string& text, std::array<float, CROP_NUMBER_CHANNELS>& values)
+    {
+        std::size_t begin = 0;
+        for (auto channel = 0 ; channel < CROP_NUMBER_CHANNELS ; channel++)
+        {
+            const auto end = (channel + 1 < CROP_NUMBER_CHANNELS ? text.find(',', begin) : text.size());
+            if (end == std::string::npos || end == begin)
+                return false;
+            const auto number = text.substr(begin, end - begin);
+            char* numberEnd = nullptr;
+            values[channel] = std::strtof(number.c_str(), &numberEnd);
+            if (numberEnd == nullptr || *numberEnd != '\0')
+                return false;
+            begin = end + 1;
+        }
+        return true;
+    }
+
+    // Model input of the hand and head classifiers: the crop resampled to size x size and normalized per channel,
+    // (value - mean) / std, as float32 planes (B, G, R), i.e. one NCHW tensor with N = 1. Cropping, bilinear resampling
+    // and normalization are one pass over the output rows: the source pixels are read straight from the frame, so no crop,
+    // resized copy or uint8 -> float image is ever stored (only the two interpolated rows of the current output row).
+    class CropTensorizer
+    {
+    public:
+        // size: side of the tensor (pixels). scale: side of the sampled square as a multiple of the person's average limb
+        // length (0 to sample the region crop as it is). mean, deviation: per channel (B, G, R), in pixel values (0-255).
+        CropTensorizer(const int size, const float scale, const std::array<float, CROP_NUMBER_CHANNELS>& mean,
+                       const std::array<float, CROP_NUMBER_CHANNELS>& deviation) :
+            mSize{size},
+            mScale{scale},
+            mX0(size),
+            mX1(size),
+            mWeightX(size),
+            mTop(CROP_NUMBER_CHANNELS * size),
+            mBottom(CROP_NUMBER_CHANNELS * size)
+        {
+            if (size <= 0 || size > 1024 || scale < 0.f)
+                op::error("The crop tensor size must be in [1, 1024] and its scale >= 0.", __LINE__, __FUNCTION__, __FILE__);
+            for (auto channel = 0 ; channel < CROP_NUMBER_CHANNELS ; channel++)
+            {
+                if (deviation[channel] == 0.f)
+                    op::error("The crop tensor std cannot be 0.", __LINE__, __FUNCTION__, __FILE__);
+                // (value - mean) / std == value * mMultiplier + mOffset
+                mMultiplier[channel] = 1.f / deviation[channel];
+                mOffset[channel] = -mean[channel] / deviation[channel];
+            }
+        }
+
+        int getSize() const
+        {
+            return mSize;
+        }
+
+        float getScale() const
+        {
+            return mScale;
+        }
+
+        // Floats of one tensor
+        std::size_t getNumberValues() const
+        {
+            return (std::size_t)(CROP_NUMBER_CHANNELS * mSize * mSize);
+        }
+
+        // Samples the width x height rectangle centered at (centerX, centerY) of a BGR image at size x size points
+        // (pixel-center aligned as cv::resize INTER_LINEAR, the image edge repeated outside it) into tensor
+        // (getNumberValues() floats).
+        void resample(const cv::Mat& image, const float centerX, const float centerY, const float width, const float height,
+                      float* const tensor)
+        {
+            if (image.type() != CV_8UC3 || image.empty())
+                op::error("Crop tensors can only be sampled from BGR (CV_8UC3) frames.", __LINE__, __FUNCTION__, __FILE__);
+            // Horizontal taps, shared by every output row
+            const auto stepX = width / mSize;
+            const auto leftEdge = centerX - 0.5f * width;
+            for (auto column = 0 ; column < mSize ; column++)
+            {
+                getTaps(leftEdge + (column + 0.5f) * stepX - 0.5f, image.cols, mX0[column], mX1[column], mWeightX[column]);
+                mX0[column] *= CROP_NUMBER_CHANNELS;
+                mX1[column] *= CROP_NUMBER_CHANNELS;
+            }
+            const auto stepY = height / mSize;
+            const auto topEdge = centerY - 0.5f * height;
+            const auto planeSize = mSize * mSize;
+            for (auto row = 0 ; row < mSize ; row++)
+            {
+                int y0, y1;
+                float weightY;
+                getTaps(topEdge + (row + 0.5f) * stepY - 0.5f, image.rows, y0, y1, weightY);
+                const auto* const row0 = image.ptr<unsigned char>(y0);
+                const auto* const row1 = image.ptr<unsigned char>(y1);
+                // Horizontal taps of both source rows (the uint8 gathers), per channel
+                for (auto channel = 0 ; channel < CROP_NUMBER_CHANNELS ; channel++)
+                {
+                    auto* const top = &mTop[channel * mSize];
+                    auto* const bottom = &mBottom[channel * mSize];
+                    for (auto column = 0 ; column < mSize ; column++)
+                    {
+                        const auto x0 = mX0[column] + channel;
+                        const auto x1 = mX1[column] + channel;
+                        top[column] = row0[x0] + mWeightX[column] * (float)(row0[x1] - row0[x0]);
+                        bottom[column] = row1[x0] + mWeightX[column] * (float)(row1[x1] - row1[x0]);
+                    }
+                }
+                // Vertical blend and normalization, contiguous floats in and out, so the compiler vectorizes it
+                for (auto channel = 0 ; channel < CROP_NUMBER_CHANNELS ; channel++)
+                {
+                    const auto* const top = &mTop[channel * mSize];
+                    const auto* const bottom = &mBottom[channel * mSize];
+                    auto* const output = tensor + channel * planeSize + row * mSize;
+                    const auto multiplier = mMultiplier[channel];
+                    const auto offset = mOffset[channel];
+                    for (auto column = 0 ; column < mSize ; column++)
+                        output[column] = (top[column] + weightY * (bottom[column] - top[column])) * multiplier + offset;
+                }
+            }
+        }
+
+    private:
+        const int mSize;
+        const float mScale;
+        std::array<float, CROP_NUMBER_CHANNELS> mMultiplier;
+        std::array<float, CROP_NUMBER_CHANNELS> mOffset;
+        // Byte offsets (x * 3) of the left/right source pixel of each output column and weight of the right one
+        std::vector<int> mX0;
+        std::vector<int> mX1;
+        std::vector<float> mWeightX;
+        // Current output row, horizontally interpolated from the upper and lower source rows (3 x size each)
+        std::vector<float> mTop;
+        std::vector<float> mBottom;
+
+        // Source pixels around the coordinate, clamped to [0, length - 1], and weight of the second one (outside the image
+        // both are the edge pixel, so the weight does not matter)
+        static void getTaps(const float coordinate, const int length, int& first, int& second, float& weight)
+        {
+            const auto floor = std::floor(coordinate);
+            const auto index = (int)floor;
+            weight = coordinate - floor;
+            first = std::max(0, std::min(index, length - 1));
+            second = std::max(0, std::min(index + 1, length - 1));
+        }
+    };
+}
+
+#endif // CWC_CROP_TENSOR_HPP
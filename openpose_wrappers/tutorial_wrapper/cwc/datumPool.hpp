@@ -0,0 +1,244 @@
+#ifndef CWC_DATUM_POOL_HPP
+#define CWC_DATUM_POOL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <openpose/headers.hpp>
+#include "decodeReduction.hpp"
+
+namespace cwc
+{
+    // Default reset of a recycled datum (DatumPool) for its next frame, without allocating: the fields the producer and
+    // OpenPose set on every frame are cleared in place, the name keeps its memory and the frame buffer (cvInputData) is
+    // kept unless another holder (e.g. a rendered cvOutputData sharing it, a frame still on screen) could still read it.
+    // The other op::Datum members (network input, scales, rectangles) are written again by OpenPose for every frame.
+    template<typename TDatum>
+    void resetDatum(TDatum& datum)
+    {
+        datum.id = 0ull;
+        datum.name.clear();
+        datum.cvOutputData.release();
+        if (!isExclusive(datum.cvInputData))
+            datum.cvInputData.release();
+        datum.poseKeypoints = op::Array<float>{};
+        datum.poseHeatMaps = op::Array<float>{};
+        datum.faceKeypoints = op::Array<float>{};
+        datum.faceHeatMaps = op::Array<float>{};
+        for (auto& handKeypoints : datum.handKeypoints)
+            handKeypoints = op::Array<float>{};
+        for (auto& handHeatMaps : datum.handHeatMaps)
+            handHeatMaps = op::Array<float>{};
+    }
+
+    struct DatumPoolStatistics
+    {
+        std::size_t capacity;
+        std::size_t inUse;                  // Containers acquired and not released yet
+        std::size_t highWaterMark;          // Most containers in use at once
+        unsigned long long acquired;
+        unsigned long long allocated;       // Containers allocated because all the pooled ones were in use
+
+        DatumPoolStatistics() :
+            capacity{0}, inUse{0}, highWaterMark{0}, acquired{0ull}, allocated{0ull}
+        {}
+    };
+
+    // Recycling pool of the datum vectors the producer sends through the OpenPose queues. acquire() returns a
+    // std::shared_ptr<std::vector<TDatum>> (TDatum: an op::Datum) that goes back to the pool by itself when its last
+    // reference drops, with the frame buffer (cvInputData) of each datum kept for the next frame if nobody else shares it,
+    // and the shared_ptr control block recycled as well. Once every pooled container carried a frame, acquiring one,
+    // decoding into its buffers (ImagePrefetcher, FrameArchiveReplay) and releasing it allocates no frame; benchmarkProducer
+    // (benchmarks.hpp, flag benchmark_producer) counts what is still allocated per frame. If all the containers are in
+    // flight, a new one is allocated (DatumPoolStatistics::allocated) and freed on release.
+    template<typename TDatum>
+    class DatumPool
+    {
+    public:
+        // capacity: containers kept (at least the frames in flight: OpenPose queues and output), each created with
+        // datumsPerContainer datums (e.g. one per camera). reset: run on each datum of a released container, e.g.
+        // resetDatum plus the fields TDatum adds to op::Datum.
+        explicit DatumPool(const std::size_t capacity, const std::size_t datumsPerContainer = 1,
+                           const std::function<void(TDatum&)>& reset = resetDatum<TDatum>) :
+            spState{std::make_shared<State>(capacity, reset)}
+        {
+            for (auto container = 0u ; container < capacity ; container++)
+                spState->freeContainers.emplace_back(new std::vector<TDatum>(datumsPerContainer));
+            // Every control block allocated now, returned to the pool right away
+            std::vector<std::shared_ptr<std::vector<TDatum>>> containers;
+            containers.reserve(capacity);
+            for (auto container = 0u ; container < capacity ; container++)
+                containers.emplace_back(acquire(datumsPerContainer));
+            containers.clear();
+            std::lock_guard<std::mutex> lock{spState->mutex};
+            spState->statistics = DatumPoolStatistics{};
+            spState->statistics.capacity = capacity;
+        }
+
+        // Container of numberDatums reset datums (their cvInputData may hold a buffer to decode into)
+        std::shared_ptr<std::vector<TDatum>> acquire(const std::size_t numberDatums)
+        {
+            std::vector<TDatum>* datums = nullptr;
+            {
+                std::lock_guard<std::mutex> lock{spState->mutex};
+                auto& statistics = spState->statistics;
+                statistics.acquired++;
+                statistics.inUse++;
+                statistics.highWaterMark = std::max(statistics.highWaterMark, statistics.inUse);
+                if (!spState->freeContainers.empty())
+                {
+                    datums = spState->freeContainers.back();
+                    spState->freeContainers.pop_back();
+                }
+                else
+                    statistics.allocated++;
+            }
+            if (datums == nullptr)
+                datums = new std::vector<TDatum>;
+            datums->resize(numberDatums);
+            return std::shared_ptr<std::vector<TDatum>>{datums, Recycler{spState}, BlockAllocator<std::vector<TDatum>>{spState}};
+        }
+
+        DatumPoolStatistics getStatistics() const
+        {
+            std::lock_guard<std::mutex> lock{spState->mutex};
+            return spState->statistics;
+        }
+
+        // E.g. "3/16 in use (high water 7), 0 allocated beyond the pool"
+        std::string getSummary() const
+        {
+            const auto statistics = getStatistics();
+            return std::to_string(statistics.inUse) + "/" + std::to_string(statistics.capacity) + " in use (high water "
+                 + std::to_string(statistics.highWaterMark) + "), " + std::to_string(statistics.allocated)
+                 + " allocated beyond the pool";
+        }
+
+    private:
+        // Shared with the containers in flight, which can outlive the pool
+        struct State
+        {
+            std::mutex mutex;
+            std::vector<std::vector<TDatum>*> freeContainers;
+            std::size_t capacity;
+            const std::function<void(TDatum&)> reset;
+            // Control blocks of the returned shared_ptr, all the same size
+            std::vector<void*> freeBlocks;
+            std::size_t blockSize;
+            DatumPoolStatistics statistics;
+
+            State(const std::size_t poolCapacity, const std::function<void(TDatum&)>& resetDatum) :
+                capacity{poolCapacity},
+                reset(resetDatum),
+                blockSize{0}
+            {
+                freeContainers.reserve(capacity);
+                freeBlocks.reserve(capacity);
+            }
+
+            ~State()
+            {
+                for (auto* datums : freeContainers)
+                    delete datums;
+                for (auto* block : freeBlocks)
+                    ::operator delete(block);
+            }
+        };
+
+        // Called when the last reference of an acquired container drops
+        struct Recycler
+        {
+            std::shared_ptr<State> spState;
+
+            void operator()(std::vector<TDatum>* datums) const
+            {
+                for (auto& datum : *datums)
+                    spState->reset(datum);
+                std::lock_guard<std::mutex> lock{spState->mutex};
+                spState->statistics.inUse--;
+                if (spState->freeContainers.size() < spState->capacity)
+                    spState->freeContainers.emplace_back(datums);
+                else
+                    delete datums;
+            }
+        };
+
+        // Allocator of the shared_ptr control blocks (the only allocation of std::shared_ptr{pointer, deleter})
+        template<typename T>
+        struct BlockAllocator
+        {
+            typedef T value_type;
+            std::shared_ptr<State> spState;
+
+            explicit BlockAllocator(const std::shared_ptr<State>& state) :
+                spState{state}
+            {}
+
+            template<typename U>
+            BlockAllocator(const BlockAllocator<U>& other) :
+                spState{other.spState}
+            {}
+
+            template<typename U>
+            struct rebind
+            {
+                typedef BlockAllocator<U> other;
+            };
+
+            T* allocate(const std::size_t number)
+            {
+                const auto size = number * sizeof(T);
+                {
+                    std::lock_guard<std::mutex> lock{spState->mutex};
+                    if (spState->blockSize == 0)
+                        spState->blockSize = size;
+                    if (size == spState->blockSize && !spState->freeBlocks.empty())
+                    {
+                        auto* const block = spState->freeBlocks.back();
+                        spState->freeBlocks.pop_back();
+                        return (T*)block;
+                    }
+                }
+                return (T*)::operator new(size);
+            }
+
+            void deallocate(T* const pointer, const std::size_t number)
+            {
+                {
+                    std::lock_guard<std::mutex> lock{spState->mutex};
+                    if (number * sizeof(T) == spState->blockSize && spState->freeBlocks.size() < spState->capacity)
+                    {
+                        spState->freeBlocks.emplace_back(pointer);
+                        return;
+                    }
+                }
+                ::operator delete(pointer);
+            }
+
+            template<typename U>
+            bool operator==(const BlockAllocator<U>& other) const
+            {
+                return spState == other.spState;
+            }
+
+            template<typename U>
+            bool operator!=(const BlockAllocator<U>& other) const
+            {
+                return spState != other.spState;
+            }
+        };
+
+        const std::shared_ptr<State> spState;
+
+        DatumPool(const DatumPool&) = delete;
+        DatumPool& operator=(const DatumPool&) = delete;
+    };
+}
+
+#endif // CWC_DATUM_POOL_HPP
@@ -0,0 +1,172 @@
+#ifndef CWC_DECODE_REDUCTION_HPP
+#define CWC_DECODE_REDUCTION_HPP
+
+#include <atomic>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    // Reduced decoding: the images (ImagePrefetcher) and archived frames (FrameArchiveReader) can be decoded at 1/2, 1/4 or
+    // 1/8 of their size. For JPEG, libjpeg then skips most of the inverse DCT (cv::IMREAD_REDUCED_COLOR_N), so decoding and
+    // the frame memory drop about 4x, 16x or 64x. The keypoints found on such a frame are multiplied by the reduction to
+    // get back to source coordinates.
+
+    // Largest reduction (8, 4, 2, else 1) that keeps a sourceWidth x sourceHeight image at least minWidth x minHeight
+    // (e.g. the net input size, or the size the crops were tuned for). 0 in minWidth or minHeight: no limit on it.
+    inline int getDecodeReduction(const int sourceWidth, const int sourceHeight, const int minWidth, const int minHeight)
+    {
+        if (sourceWidth <= 0 || sourceHeight <= 0)
+            return 1;
+        for (auto reduction = 8 ; reduction > 1 ; reduction /= 2)
+            if ((sourceWidth + reduction - 1) / reduction >= minWidth && (sourceHeight + reduction - 1) / reduction >= minHeight)
+                return reduction;
+        return 1;
+    }
+
+    // Whether image is the only holder of its pixel buffer, so that a frame can be decoded into it without changing an
+    // image somebody else still reads (e.g. a rendered frame on screen)
+    inline bool isExclusive(const cv::Mat& image)
+    {
+        #ifndef CV_VERSION_EPOCH
+            return image.u != nullptr && image.u->refcount == 1;
+        #else
+            return image.refcount != nullptr && *image.refcount == 1;
+        #endif
+    }
+
+    // Frames the functions below decoded into a new buffer instead of the one they were given (empty, shared or of
+    // another size), for the producer benchmark (see benchmarks.hpp)
+    inline std::atomic<unsigned long long>& getFrameBufferAllocations()
+    {
+        static std::atomic<unsigned long long> frameBufferAllocations{0ull};
+        return frameBufferAllocations;
+    }
+
+    namespace detail
+    {
+        // Buffer of image if a frame can be written into it, else nullptr (and image is emptied)
+        inline const unsigned char* takeFrameBuffer(cv::Mat& image)
+        {
+            if (isExclusive(image))
+                return image.data;
+            image = cv::Mat{};
+            return nullptr;
+        }
+
+        inline void countFrameBuffer(const cv::Mat& image, const unsigned char* const previousBuffer)
+        {
+            if (!image.empty() && image.data != previousBuffer)
+                getFrameBufferAllocations().fetch_add(1ull, std::memory_order_relaxed);
+        }
+    }
+
+    // BGR image reduced by reduction (1, 2, 4 or 8), with the size the reduced JPEG decoding gives (rounded up), into
+    // reduced (its buffer is reused if it has that size and is not shared, see isExclusive)
+    inline void reduceImage(const cv::Mat& image, const int reduction, cv::Mat& reduced)
+    {
+        const auto* const previousBuffer = detail::takeFrameBuffer(reduced);
+        if (reduction <= 1 || image.empty())
+            image.copyTo(reduced);
+        else
+            cv::resize(image, reduced,
+                       cv::Size{(image.cols + reduction - 1) / reduction, (image.rows + reduction - 1) / reduction},
+                       0, 0, cv::INTER_AREA);
+        detail::countFrameBuffer(reduced, previousBuffer);
+    }
+
+    inline cv::Mat reduceImage(const cv::Mat& image, const int reduction)
+    {
+        if (reduction <= 1 || image.empty())
+            return image;
+        cv::Mat reduced;
+        reduceImage(image, reduction, reduced);
+        return reduced;
+    }
+
+    // Decodes the bytes of an image file (1 x size CV_8UC1) into image, a BGR image reduced by reduction (1, 2, 4 or 8).
+    // The buffer of image is reused if it has the decoded size and is not shared; image is empty if the bytes could not
+    // be decoded (except with OpenCV 3 for bytes of no known image format, which leave it as it was: the callers read
+    // image files filtered by extension or JPEG frames).
+    inline void decodeImage(const cv::Mat& bytes, const int reduction, cv::Mat& image)
+    {
+        const auto* const previousBuffer = detail::takeFrameBuffer(image);
+        #ifndef CV_VERSION_EPOCH
+            const auto flags = (reduction == 2 ? cv::IMREAD_REDUCED_COLOR_2
+                             : reduction == 4 ? cv::IMREAD_REDUCED_COLOR_4
+                             : reduction == 8 ? cv::IMREAD_REDUCED_COLOR_8 : cv::IMREAD_COLOR);
+            if (cv::imdecode(bytes, flags, &image).empty())
+                image.release();
+            detail::countFrameBuffer(image, previousBuffer);
+        #else
+            // OpenCV 2.4 has no reduced decoding: the image is decoded whole and then reduced
+            if (reduction <= 1)
+            {
+                if (cv::imdecode(bytes, cv::IMREAD_COLOR, &image).empty())
+                    image.release();
+                detail::countFrameBuffer(image, previousBuffer);
+            }
+            else
+            {
+                const cv::Mat decoded = cv::imdecode(bytes, cv::IMREAD_COLOR);
+                detail::countFrameBuffer(decoded, nullptr);
+                if (decoded.empty())
+                    image.release();
+                else
+                    reduceImage(decoded, reduction, image);
+            }
+        #endif
+    }
+
+    inline cv::Mat decodeImage(const cv::Mat& bytes, const int reduction)
+    {
+        cv::Mat image;
+        decodeImage(bytes, reduction, image);
+        return image;
+    }
+
+    // Multiplies the x and y of every keypoint by scale (the score is kept), e.g. by the reduction of the decoded frame
+    inline void scaleKeypoints(op::Array<float>& keypoints, const float scale)
+    {
+        if (scale == 1.f || keypoints.empty())
+            return;
+        const auto numberValues = keypoints.getSize(keypoints.getNumberDimensions() - 1);
+        auto* const values = keypoints.getPtr();
+        for (auto i = 0 ; i < (int)keypoints.getVolume() ; i += numberValues)
+        {
+            values[i] *= scale;
+            values[i+1] *= scale;
+        }
+    }
+
+    // Same for the keypoints, keypoint velocities and people (centroids, limb lengths and keypoints) of frameData. The
+    // crops keep the position where they were cut from the decoded frame.
+    inline void scaleKeypoints(FrameData& frameData, const float scale)
+    {
+        if (scale == 1.f)
+            return;
+        for (auto bodyPart = 0 ; bodyPart < POSE_NUMBER_KEYPOINTS ; bodyPart++)
+        {
+            frameData.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT] *= scale;
+            frameData.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT + 1] *= scale;
+        }
+        for (auto& velocity : frameData.keypointVelocities)
+            velocity *= scale;
+        for (auto& person : frameData.people)
+        {
+            person.centroidX *= scale;
+            person.centroidY *= scale;
+            person.averageLimbLength *= scale;
+            for (auto bodyPart = 0 ; bodyPart < POSE_NUMBER_KEYPOINTS ; bodyPart++)
+            {
+                person.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT] *= scale;
+                person.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT + 1] *= scale;
+            }
+        }
+    }
+}
+
+#endif // CWC_DECODE_REDUCTION_HPP
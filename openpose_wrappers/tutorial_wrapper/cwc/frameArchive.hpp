@@ -0,0 +1,424 @@
+#ifndef CWC_FRAME_ARCHIVE_HPP
+#define CWC_FRAME_ARCHIVE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <openpose/headers.hpp>
+#include "decodeReduction.hpp"
+#include "frameTrace.hpp"
+
+namespace cwc
+{
+    // Single-file recording of the frames read by the producer, so a session can be replayed without one open/stat/imread
+    // per image and with its original timing. Layout (little endian, no padding):
+    //     FrameArchiveHeader           32 bytes
+    //     for each frame, zero padding so that entry.offset is a multiple of FRAME_ARCHIVE_ALIGNMENT, then:
+    //         FrameArchiveEntry        32 bytes
+    //         uint8[entry.size]        JPEG file or BGR pixels (width * height * 3), at entry.offset
+    //     FrameArchiveEntry[frameCount] index, at header.indexOffset
+    // The index is written when the archive is closed. An archive whose recording was interrupted (indexOffset 0) is read
+    // by walking its chunks instead.
+    const std::uint32_t FRAME_ARCHIVE_MAGIC = 0x41435743u; // "CWCA"
+    const std::uint16_t FRAME_ARCHIVE_VERSION = 1;
+    const std::uint64_t FRAME_ARCHIVE_ALIGNMENT = 64;
+
+    enum class FrameArchiveEncoding : std::uint16_t
+    {
+        Jpeg = 0,   // Smaller, decoded on replay
+        Bgr,        // Pre-decoded, replayed with a copy
+    };
+
+    struct FrameArchiveHeader
+    {
+        std::uint32_t magic;
+        std::uint16_t version;
+        std::uint16_t reserved;
+        std::uint64_t frameCount;
+        std::uint64_t indexOffset;      // 0 if the archive was not closed
+        std::uint64_t reserved2;
+    };
+    static_assert(sizeof(FrameArchiveHeader) == 32, "FrameArchiveHeader must not be padded.");
+
+    struct FrameArchiveEntry
+    {
+        std::uint64_t offset;           // Of the frame bytes, from the start of the file
+        std::uint32_t size;
+        std::uint16_t width;
+        std::uint16_t height;
+        std::int64_t captureTime;       // Monotonic ns (FrameTrace::getCaptureTime()) of the recording
+        std::uint16_t encoding;         // FrameArchiveEncoding
+        std::uint16_t reserved;
+        std::uint32_t reserved2;
+    };
+    static_assert(sizeof(FrameArchiveEntry) == 32, "FrameArchiveEntry must not be padded.");
+
+    inline FrameArchiveEncoding flagsToFrameArchiveEncoding(const std::string& encoding)
+    {
+        if (encoding == "jpg")
+            return FrameArchiveEncoding::Jpeg;
+        if (encoding == "bgr")
+            return FrameArchiveEncoding::Bgr;
+        op::error("Unknown frame archive encoding (jpg or bgr): " + encoding, __LINE__, __FUNCTION__, __FILE__);
+        return FrameArchiveEncoding::Jpeg;
+    }
+
+    class FrameArchiveWriter
+    {
+    public:
+        FrameArchiveWriter(const std::string& path, const FrameArchiveEncoding encoding, const int jpegQuality = 90) :
+            pFile{std::fopen(path.c_str(), "wb")},
+            mEncoding{encoding},
+            mJpegParameters{cv::IMWRITE_JPEG_QUALITY, jpegQuality},
+            mOffset{0ull}
+        {
+            if (pFile == nullptr)
+                op::error("Frame archive could not be created: " + path, __LINE__, __FUNCTION__, __FILE__);
+            std::setvbuf(pFile, nullptr, _IOFBF, 1 << 20);
+            FrameArchiveHeader header;
+            std::memset(&header, 0, sizeof(header));
+            header.magic = FRAME_ARCHIVE_MAGIC;
+            header.version = FRAME_ARCHIVE_VERSION;
+            writeBytes(&header, sizeof(header));
+        }
+
+        ~FrameArchiveWriter()
+        {
+            try
+            {
+                close();
+            }
+            catch (const std::exception& e)
+            {
+                op::log(e.what(), op::Priority::High);
+            }
+        }
+
+        // frame: BGR image, captureTime: monotonic ns
+        void write(const cv::Mat& frame, const std::int64_t captureTime)
+        {
+            if (pFile == nullptr || frame.empty())
+                return;
+            if (frame.type() != CV_8UC3)
+                op::error("Only BGR frames can be archived.", __LINE__, __FUNCTION__, __FILE__);
+            FrameArchiveEntry entry;
+            std::memset(&entry, 0, sizeof(entry));
+            entry.width = (std::uint16_t)frame.cols;
+            entry.height = (std::uint16_t)frame.rows;
+            entry.captureTime = captureTime;
+            entry.encoding = (std::uint16_t)mEncoding;
+            const unsigned char* bytes;
+            if (mEncoding == FrameArchiveEncoding::Jpeg)
+            {
+                if (!cv::imencode(".jpg", frame, mBuffer, mJpegParameters))
+                    op::error("Frame could not be encoded.", __LINE__, __FUNCTION__, __FILE__);
+                bytes = mBuffer.data();
+                entry.size = (std::uint32_t)mBuffer.size();
+            }
+            else
+            {
+                if (frame.isContinuous())
+                    bytes = frame.ptr<unsigned char>();
+                else
+                {
+                    mBuffer.resize(frame.total() * frame.elemSize());
+                    for (auto row = 0 ; row < frame.rows ; row++)
+                        std::memcpy(&mBuffer[row * frame.cols * frame.elemSize()], frame.ptr<unsigned char>(row),
+                                    frame.cols * frame.elemSize());
+                    bytes = mBuffer.data();
+                }
+                entry.size = (std::uint32_t)(frame.total() * frame.elemSize());
+            }
+            // Frame bytes aligned (the entry right before them), so the BGR pixels of a mapped archive are aligned too
+            writePadding(sizeof(entry));
+            entry.offset = mOffset + sizeof(entry);
+            writeBytes(&entry, sizeof(entry));
+            writeBytes(bytes, entry.size);
+            mIndex.emplace_back(entry);
+        }
+
+        // Writes the index. Called by the destructor.
+        void close()
+        {
+            if (pFile == nullptr)
+                return;
+            writePadding(0);
+            FrameArchiveHeader header;
+            std::memset(&header, 0, sizeof(header));
+            header.magic = FRAME_ARCHIVE_MAGIC;
+            header.version = FRAME_ARCHIVE_VERSION;
+            header.frameCount = mIndex.size();
+            header.indexOffset = mOffset;
+            if (!mIndex.empty())
+                writeBytes(mIndex.data(), mIndex.size() * sizeof(FrameArchiveEntry));
+            const auto success = std::fseek(pFile, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, pFile) == 1;
+            const auto closed = std::fclose(pFile) == 0;
+            pFile = nullptr;
+            if (!success || !closed)
+                op::error("Frame archive index could not be written.", __LINE__, __FUNCTION__, __FILE__);
+        }
+
+        unsigned long long getNumberFrames() const
+        {
+            return mIndex.size();
+        }
+
+    private:
+        std::FILE* pFile;
+        const FrameArchiveEncoding mEncoding;
+        const std::vector<int> mJpegParameters;
+        unsigned long long mOffset;
+        std::vector<unsigned char> mBuffer;
+        std::vector<FrameArchiveEntry> mIndex;
+
+        void writeBytes(const void* const bytes, const std::size_t size)
+        {
+            if (size > 0 && std::fwrite(bytes, size, 1, pFile) != 1)
+                op::error("Frame archive could not be written (disk full?).", __LINE__, __FUNCTION__, __FILE__);
+            mOffset += size;
+        }
+
+        // Zeros until mOffset + followingBytes is a multiple of FRAME_ARCHIVE_ALIGNMENT
+        void writePadding(const std::size_t followingBytes)
+        {
+            const char zeros[FRAME_ARCHIVE_ALIGNMENT] = {};
+            const auto end = mOffset + followingBytes;
+            writeBytes(zeros, (std::size_t)((FRAME_ARCHIVE_ALIGNMENT - end % FRAME_ARCHIVE_ALIGNMENT) % FRAME_ARCHIVE_ALIGNMENT));
+        }
+
+        FrameArchiveWriter(const FrameArchiveWriter&) = delete;
+        FrameArchiveWriter& operator=(const FrameArchiveWriter&) = delete;
+    };
+
+    // Maps a whole archive (read into memory on Windows) and decodes its frames on demand
+    class FrameArchiveReader
+    {
+    public:
+        explicit FrameArchiveReader(const std::string& path) :
+            pBytes{nullptr},
+            mSize{0ull}
+        {
+            #ifndef _WIN32
+                const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat status;
+                if (fd < 0 || fstat(fd, &status) != 0)
+                {
+                    if (fd >= 0)
+                        ::close(fd);
+                    op::error("Frame archive could not be opened: " + path, __LINE__, __FUNCTION__, __FILE__);
+                }
+                mSize = (unsigned long long)status.st_size;
+                if (mSize > 0)
+                {
+                    void* const bytes = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+                    ::close(fd);
+                    if (bytes == MAP_FAILED)
+                        op::error("Frame archive could not be mapped: " + path, __LINE__, __FUNCTION__, __FILE__);
+                    pBytes = (const unsigned char*)bytes;
+                    madvise(bytes, mSize, MADV_SEQUENTIAL);
+                }
+                else
+                    ::close(fd);
+            #else
+                std::FILE* file = std::fopen(path.c_str(), "rb");
+                if (file == nullptr)
+                    op::error("Frame archive could not be opened: " + path, __LINE__, __FUNCTION__, __FILE__);
+                std::fseek(file, 0, SEEK_END);
+                mBuffer.resize((std::size_t)std::ftell(file));
+                std::fseek(file, 0, SEEK_SET);
+                const auto read = mBuffer.empty() || std::fread(mBuffer.data(), mBuffer.size(), 1, file) == 1;
+                std::fclose(file);
+                if (!read)
+                    op::error("Frame archive could not be read: " + path, __LINE__, __FUNCTION__, __FILE__);
+                pBytes = mBuffer.data();
+                mSize = mBuffer.size();
+            #endif
+            readIndex(path);
+        }
+
+        ~FrameArchiveReader()
+        {
+            #ifndef _WIN32
+                if (pBytes != nullptr)
+                    munmap((void*)pBytes, mSize);
+            #endif
+        }
+
+        unsigned long long getNumberFrames() const
+        {
+            return mIndex.size();
+        }
+
+        std::int64_t getCaptureTime(const unsigned long long frame) const
+        {
+            return mIndex.at(frame).captureTime;
+        }
+
+        int getWidth(const unsigned long long frame) const
+        {
+            return mIndex.at(frame).width;
+        }
+
+        int getHeight(const unsigned long long frame) const
+        {
+            return mIndex.at(frame).height;
+        }
+
+        // BGR image of frame reduced by reduction (1, 2, 4 or 8, see decodeReduction.hpp) into image, empty if it could not
+        // be decoded. The buffer of image is reused if it has that size and nobody else shares it.
+        void getFrame(const unsigned long long frame, const int reduction, cv::Mat& image) const
+        {
+            const auto& entry = mIndex.at(frame);
+            // The mapping is read-only: the BGR frames are copied, the JPEG ones decoded into image
+            const cv::Mat bytes{1, (int)entry.size, CV_8UC1, (void*)(pBytes + entry.offset)};
+            if (entry.encoding == (std::uint16_t)FrameArchiveEncoding::Jpeg)
+                decodeImage(bytes, reduction, image);
+            else
+                reduceImage(cv::Mat{entry.height, entry.width, CV_8UC3, (void*)(pBytes + entry.offset)}, reduction, image);
+        }
+
+        cv::Mat getFrame(const unsigned long long frame, const int reduction = 1) const
+        {
+            cv::Mat image;
+            getFrame(frame, reduction, image);
+            return image;
+        }
+
+    private:
+        const unsigned char* pBytes;
+        unsigned long long mSize;
+        #ifdef _WIN32
+            std::vector<unsigned char> mBuffer;
+        #endif
+        std::vector<FrameArchiveEntry> mIndex;
+
+        void readIndex(const std::string& path)
+        {
+            FrameArchiveHeader header;
+            if (mSize < sizeof(header))
+                op::error("Not a frame archive: " + path, __LINE__, __FUNCTION__, __FILE__);
+            std::memcpy(&header, pBytes, sizeof(header));
+            if (header.magic != FRAME_ARCHIVE_MAGIC || header.version != FRAME_ARCHIVE_VERSION)
+                op::error("Not a frame archive (or another version): " + path, __LINE__, __FUNCTION__, __FILE__);
+            if (header.indexOffset > 0)
+            {
+                if (header.indexOffset > mSize || header.frameCount > (mSize - header.indexOffset) / sizeof(FrameArchiveEntry))
+                    op::error("Frame archive index out of the file: " + path, __LINE__, __FUNCTION__, __FILE__);
+                mIndex.resize(header.frameCount);
+                if (!mIndex.empty())
+                    std::memcpy(mIndex.data(), pBytes + header.indexOffset, mIndex.size() * sizeof(FrameArchiveEntry));
+            }
+            // Interrupted recording: the chunks that were written completely
+            else
+            {
+                auto offset = (unsigned long long)sizeof(header);
+                while (true)
+                {
+                    FrameArchiveEntry entry;
+                    offset = (offset + sizeof(entry) + FRAME_ARCHIVE_ALIGNMENT - 1) / FRAME_ARCHIVE_ALIGNMENT
+                           * FRAME_ARCHIVE_ALIGNMENT - sizeof(entry);
+                    if (offset + sizeof(entry) > mSize)
+                        break;
+                    std::memcpy(&entry, pBytes + offset, sizeof(entry));
+                    if (entry.offset != offset + sizeof(entry) || entry.size == 0)
+                        break;
+                    mIndex.emplace_back(entry);
+                    offset = entry.offset + entry.size;
+                }
+                op::log("Frame archive " + path + " was not closed, " + std::to_string(mIndex.size()) + " frames recovered.",
+                        op::Priority::High);
+            }
+            // Frames past the end of the file (truncated copy)
+            mIndex.erase(std::remove_if(mIndex.begin(), mIndex.end(), [&](const FrameArchiveEntry& entry)
+            {
+                return entry.offset > mSize || entry.size > mSize - entry.offset
+                    || (entry.encoding == (std::uint16_t)FrameArchiveEncoding::Bgr
+                        && entry.size != (std::uint32_t)entry.width * entry.height * 3u);
+            }), mIndex.end());
+            if (mIndex.empty())
+                op::error("Frame archive without frames: " + path, __LINE__, __FUNCTION__, __FILE__);
+        }
+
+        FrameArchiveReader(const FrameArchiveReader&) = delete;
+        FrameArchiveReader& operator=(const FrameArchiveReader&) = delete;
+    };
+
+    // Frame source of WUserInput/UserInputClass replaying an archive, either as fast as possible (benchmarks) or at the rate
+    // it was recorded (each frame is returned when as much time has passed since the first one as when it was recorded).
+    // reduction: as ImagePrefetchSettings::reduction (0: the largest that keeps the first frame at least minWidth x minHeight).
+    class FrameArchiveReplay
+    {
+    public:
+        FrameArchiveReplay(const std::string& path, const bool realTime, const bool repeat,
+                           const unsigned long long frameFirst = 0ull, const int reduction = 1, const int minWidth = 0,
+                           const int minHeight = 0) :
+            mReader{path},
+            mRealTime{realTime},
+            mRepeat{repeat},
+            mFrameFirst{std::min(frameFirst, mReader.getNumberFrames() - 1)},
+            mReduction{reduction > 0 ? reduction
+                                     : getDecodeReduction(mReader.getWidth(mFrameFirst), mReader.getHeight(mFrameFirst),
+                                                          minWidth, minHeight)},
+            mNextFrame{mFrameFirst},
+            mStartTime{0}
+        {}
+
+        bool isFinished() const
+        {
+            return !mRepeat && mNextFrame >= mReader.getNumberFrames();
+        }
+
+        // Source pixels per pixel of the returned frames
+        int getReduction() const
+        {
+            return mReduction;
+        }
+
+        // Next frame (empty if it could not be decoded) and its index in the archive. Returns false once all were returned.
+        // The frame is decoded into the buffer of frame if it can be reused (see FrameArchiveReader::getFrame).
+        bool next(cv::Mat& frame, unsigned long long& index)
+        {
+            if (isFinished())
+                return false;
+            if (mNextFrame >= mReader.getNumberFrames())
+                mNextFrame = mFrameFirst;
+            index = mNextFrame++;
+            // The timing starts again with each pass
+            if (index == mFrameFirst)
+                mStartTime = getMonotonicNanoseconds();
+            mReader.getFrame(index, mReduction, frame);
+            if (mRealTime)
+            {
+                const auto delay = mReader.getCaptureTime(index) - mReader.getCaptureTime(mFrameFirst);
+                const auto wait = mStartTime + delay - getMonotonicNanoseconds();
+                if (wait > 0)
+                    std::this_thread::sleep_for(std::chrono::nanoseconds{wait});
+            }
+            return true;
+        }
+
+    private:
+        const FrameArchiveReader mReader;
+        const bool mRealTime;
+        const bool mRepeat;
+        const unsigned long long mFrameFirst;
+        const int mReduction;
+        unsigned long long mNextFrame;
+        std::int64_t mStartTime;
+    };
+}
+
+#endif // CWC_FRAME_ARCHIVE_HPP
@@ -0,0 +1,141 @@
+#ifndef CWC_FRAME_DATA_HPP
+#define CWC_FRAME_DATA_HPP
+
+#include <array>
+#include <vector>
+#include "frameTrace.hpp"
+
+namespace cwc
+{
+    // COCO model: 18 keypoints with (x, y, score) each
+    const auto POSE_NUMBER_KEYPOINTS = 18;
+    const auto POSE_VALUES_PER_KEYPOINT = 3;
+    const auto POSE_NUMBER_VALUES = POSE_NUMBER_KEYPOINTS * POSE_VALUES_PER_KEYPOINT;
+    // Crops are raw BGR bytes, as stored in op::Datum::cvInputData
+    const auto CROP_NUMBER_CHANNELS = 3;
+    // Side of the square hand and head crops cut by UserOutputClass::printKeypoints (pixels)
+    const auto CROP_SIZE = 64;
+
+    // Image regions cropped around the engaged person. The order is also the order in which they are serialized.
+    enum class CropRegion : unsigned char
+    {
+        LeftHand = 0,
+        RightHand,
+        Head,
+        Size,
+    };
+    const auto CROP_NUMBER_REGIONS = (int)CropRegion::Size;
+    // Bitmask (1 << CropRegion) of every region
+    const auto ALL_CROP_REGIONS = (1 << CROP_NUMBER_REGIONS) - 1;
+
+    struct CropData
+    {
+        bool visible;   // False if the region is too far outside the frame (e.g. "[left hand unknown]")
+        // Top-left corner in the pixels of the decoded frame it was cut from, unlike the keypoints (source pixels, see
+        // decodeReduction.hpp)
+        int x;
+        int y;
+        int width;
+        int height;
+        // width x height x 3 contiguous BGR bytes. Only valid while the frame is being output.
+        const unsigned char* pixels;
+        // Same as the crop of frame sameAs (CropChangeDetector). Only checked for the unchanged=1 stream clients, and then
+        // pixels may be nullptr (the crop is not extracted again unless another output needs it).
+        bool unchanged;
+        unsigned long long sameAs;
+
+        CropData() :
+            visible{false}, x{0}, y{0}, width{0}, height{0}, pixels{nullptr}, unchanged{false}, sameAs{0ull}
+        {}
+    };
+
+    // Crop resampled and normalized for the classifiers (CropTensorizer, cropTensor.hpp)
+    struct CropTensor
+    {
+        bool valid;     // False if the region is unknown or no output needs the tensor
+        int size;
+        // 3 x size x size float32 planes (B, G, R). Only valid while the frame is being output.
+        const float* values;
+
+        CropTensor() :
+            valid{false}, size{0}, values{nullptr}
+        {}
+    };
+
+    // One region of every detected person (CropBatcher, cropBatch.hpp)
+    struct CropBatch
+    {
+        int count;                          // People, in FrameData::people order
+        int width;
+        int height;
+        const unsigned int* personIndices;  // count PersonData::index
+        const unsigned char* visible;       // count 0/1
+        // count x height x width x 3 BGR bytes (NHWC), zeros for the people whose region is unknown. Only valid while the
+        // frame is being output.
+        const unsigned char* pixels;
+
+        CropBatch() :
+            count{0}, width{0}, height{0}, personIndices{nullptr}, visible{nullptr}, pixels{nullptr}
+        {}
+    };
+
+    // PersonData::flags
+    const unsigned char PERSON_CENTRAL_FLAG = 1;    // Centroid within the central third of the frame
+    const unsigned char PERSON_ENGAGED_FLAG = 2;    // The person sent by the ClosestBody stream, engaged
+    // PersonData::index / FrameData::trackId of nobody
+    const unsigned int PERSON_NO_TRACK = 0xFFFFFFFFu;
+
+    // One detected person, as sent by the AllBodies stream
+    struct PersonData
+    {
+        unsigned int index;         // Track id, persistent across frames while the person stays in view (PersonTracker)
+        float centroidX;            // Mean x of the nose, neck and shoulders (computePersonTable)
+        float centroidY;            // Mean y of the same keypoints
+        float averageLimbLength;    // Mean length of the upper body limbs, 0 if none is visible
+        unsigned char flags;
+        std::array<float, POSE_NUMBER_VALUES> keypoints;
+
+        PersonData() :
+            index{0u}, centroidX{0.f}, centroidY{0.f}, averageLimbLength{0.f}, flags{0}
+        {
+            keypoints.fill(0.f);
+        }
+    };
+
+    // Everything the output stage sends about one processed frame
+    struct FrameData
+    {
+        // Frames output so far by the camera (cameraIndex), each camera counts its own
+        unsigned long long frameNumber;
+        // Camera the frame comes from (its index in -cameras, 0 with a single camera, see multiCameraCapture.hpp)
+        unsigned int cameraIndex;
+        float engaged;
+        // Track (PersonData::index) of the person whose keypoints and crops are sent, PERSON_NO_TRACK if nobody is detected
+        unsigned int trackId;
+        std::array<float, POSE_NUMBER_VALUES> keypoints;
+        // Velocity (x, y in pixels/second) of the keypoints (KeypointPredictor), only set if a stream client asked for
+        // predict. predictableKeypoints: bit (1 << keypoint) of those that have one.
+        std::array<float, POSE_NUMBER_KEYPOINTS * 2> keypointVelocities;
+        unsigned int predictableKeypoints;
+        std::array<CropData, CROP_NUMBER_REGIONS> crops;
+        // Only filled for the regions whose stream client asked for encoding=tensor
+        std::array<CropTensor, CROP_NUMBER_REGIONS> tensors;
+        // Only filled for the regions whose stream client asked for people=all
+        std::array<CropBatch, CROP_NUMBER_REGIONS> cropBatches;
+        // keypoints encoded by KeypointEncoder (keypointCodec.hpp), empty if no output needs them
+        std::vector<char> compactKeypoints;
+        // Every detected person, empty if no output needs them
+        std::vector<PersonData> people;
+        // Capture timestamp, sequence and stage times of the frame (see frameTrace.hpp)
+        FrameTrace trace;
+
+        FrameData() :
+            frameNumber{0ull}, cameraIndex{0u}, engaged{0.f}, trackId{PERSON_NO_TRACK}, predictableKeypoints{0u}
+        {
+            keypoints.fill(0.f);
+            keypointVelocities.fill(0.f);
+        }
+    };
+}
+
+#endif // CWC_FRAME_DATA_HPP
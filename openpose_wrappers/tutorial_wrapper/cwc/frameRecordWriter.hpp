@@ -0,0 +1,130 @@
+#ifndef CWC_FRAME_RECORD_WRITER_HPP
+#define CWC_FRAME_RECORD_WRITER_HPP
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    // Binary alternative to the text lines printed by UserOutputClass::printKeypoints.
+    // Each frame is written as one length-prefixed record (little endian, no padding):
+    //     uint32                   recordSize (number of bytes that follow)
+    //     FrameRecordHeader        40 bytes
+    //     float32[18 * 3]          keypoints (x, y, score) of the engaged person
+    //     uint8[w * h * 3]         BGR crop, for each CropRegion whose bit is set in cropMask (LH, RH, Head order)
+    const std::uint32_t FRAME_RECORD_MAGIC = 0x31435743u; // "CWC1"
+    const std::uint16_t FRAME_RECORD_VERSION = 1;
+
+    struct FrameRecordHeader
+    {
+        std::uint32_t magic;
+        std::uint16_t version;
+        std::uint16_t cropMask;
+        std::uint64_t frameNumber;
+        float engaged;
+        std::uint16_t numberKeypoints;
+        std::uint16_t valuesPerKeypoint;
+        std::uint16_t cropWidth[CROP_NUMBER_REGIONS];
+        std::uint16_t cropHeight[CROP_NUMBER_REGIONS];
+        std::uint32_t cameraIndex;     // FrameData::cameraIndex (0 with a single camera)
+    };
+    static_assert(sizeof(FrameRecordHeader) == 40, "FrameRecordHeader must not be padded.");
+
+    class FrameRecordWriter
+    {
+    public:
+        // output: "fd:N" to write into an already opened file descriptor (e.g. a pipe inherited from the Python server),
+        // otherwise the path of a file or named pipe
+        explicit FrameRecordWriter(const std::string& output) :
+            pFile{nullptr}
+        {
+            try
+            {
+                if (output.compare(0, 3, "fd:") == 0)
+                {
+                    #ifdef _WIN32
+                        pFile = _fdopen(std::stoi(output.substr(3)), "wb");
+                    #else
+                        pFile = fdopen(std::stoi(output.substr(3)), "wb");
+                    #endif
+                }
+                else
+                    pFile = std::fopen(output.c_str(), "wb");
+                if (pFile == nullptr)
+                    op::error("Binary output could not be opened: " + output, __LINE__, __FUNCTION__, __FILE__);
+                // Big enough to hold a whole record, so each frame reaches the pipe with a single flush
+                std::setvbuf(pFile, nullptr, _IOFBF, 1 << 16);
+                #ifndef _WIN32
+                    // A closed reader must be reported by fwrite, not kill the process
+                    std::signal(SIGPIPE, SIG_IGN);
+                #endif
+            }
+            catch (const std::exception& e)
+            {
+                op::error(e.what(), __LINE__, __FUNCTION__, __FILE__);
+            }
+        }
+
+        ~FrameRecordWriter()
+        {
+            if (pFile != nullptr)
+                std::fclose(pFile);
+        }
+
+        void write(const FrameData& frameData)
+        {
+            try
+            {
+                FrameRecordHeader header;
+                header.magic = FRAME_RECORD_MAGIC;
+                header.version = FRAME_RECORD_VERSION;
+                header.cropMask = 0;
+                header.frameNumber = frameData.frameNumber;
+                header.engaged = frameData.engaged;
+                header.numberKeypoints = POSE_NUMBER_KEYPOINTS;
+                header.valuesPerKeypoint = POSE_VALUES_PER_KEYPOINT;
+                header.cameraIndex = frameData.cameraIndex;
+                std::uint32_t recordSize = sizeof(header) + sizeof(frameData.keypoints);
+                for (auto region = 0 ; region < CROP_NUMBER_REGIONS ; region++)
+                {
+                    const auto& crop = frameData.crops[region];
+                    header.cropWidth[region] = (std::uint16_t)crop.width;
+                    header.cropHeight[region] = (std::uint16_t)crop.height;
+                    if (crop.visible)
+                    {
+                        header.cropMask |= (1 << region);
+                        recordSize += crop.width * crop.height * CROP_NUMBER_CHANNELS;
+                    }
+                }
+
+                auto success = std::fwrite(&recordSize, sizeof(recordSize), 1, pFile) == 1
+                            && std::fwrite(&header, sizeof(header), 1, pFile) == 1
+                            && std::fwrite(frameData.keypoints.data(), sizeof(frameData.keypoints), 1, pFile) == 1;
+                for (auto region = 0 ; success && region < CROP_NUMBER_REGIONS ; region++)
+                {
+                    const auto& crop = frameData.crops[region];
+                    if (crop.visible)
+                        success = std::fwrite(crop.pixels, crop.width * crop.height * CROP_NUMBER_CHANNELS, 1, pFile) == 1;
+                }
+                if (!success || std::fflush(pFile) != 0)
+                    op::error("Binary output could not be written (reader closed?).", __LINE__, __FUNCTION__, __FILE__);
+            }
+            catch (const std::exception& e)
+            {
+                op::error(e.what(), __LINE__, __FUNCTION__, __FILE__);
+            }
+        }
+
+    private:
+        std::FILE* pFile;
+
+        FrameRecordWriter(const FrameRecordWriter&) = delete;
+        FrameRecordWriter& operator=(const FrameRecordWriter&) = delete;
+    };
+}
+
+#endif // CWC_FRAME_RECORD_WRITER_HPP
@@ -0,0 +1,148 @@
+#ifndef CWC_FRAME_TRACE_HPP
+#define CWC_FRAME_TRACE_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace cwc
+{
+    // Points of the pipeline where a frame gets a timestamp. The intervals between consecutive stages are:
+    //     producer                     ProducerStart -> Captured        (op::Producer::getFrame)
+    //     pose queue + inference       Captured -> PoseDone             (the 1.x wrapper has no hook between both)
+    //     postprocessing + output      PoseDone -> Popped               (rendering, GUI, writers, output queue)
+    //     crop extraction              Popped -> CropsExtracted
+    //     serialization                CropsExtracted -> Serialized     (record writer, stream packets, shared memory)
+    // The send time (Serialized -> last byte given to the socket) is measured per client by StreamServer.
+    enum class TraceStage : unsigned char
+    {
+        ProducerStart = 0,
+        Captured,
+        PoseDone,
+        Popped,
+        CropsExtracted,
+        Serialized,
+        Size,
+    };
+    const auto TRACE_NUMBER_STAGES = (int)TraceStage::Size;
+
+    // Monotonic clock of the traces (std::chrono::steady_clock, i.e. CLOCK_MONOTONIC on Linux, so clients on the same
+    // machine can compare it with their own receive time)
+    inline std::int64_t getMonotonicNanoseconds()
+    {
+        return (std::int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Wall-clock milliseconds (std::chrono::system_clock, Unix epoch) of monotonicNanoseconds, a getMonotonicNanoseconds()
+    // time of this process, e.g. to give the capture time of a frame to clients on other machines
+    inline std::int64_t toWallMilliseconds(const std::int64_t monotonicNanoseconds)
+    {
+        const auto wallNanoseconds = (std::int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        return (wallNanoseconds - (getMonotonicNanoseconds() - monotonicNanoseconds)) / 1000000;
+    }
+
+    struct FrameTrace
+    {
+        unsigned long long sequence;    // +1 per frame read by the producer
+        std::array<std::int64_t, TRACE_NUMBER_STAGES> stageTimes;   // Monotonic ns, 0 if the stage was not reached
+        unsigned long long droppedFrames;   // Newer frames replaced the ones read since the previous one (LatestFrameCapture)
+
+        FrameTrace() :
+            sequence{0ull},
+            droppedFrames{0ull}
+        {
+            stageTimes.fill(0);
+        }
+
+        void stamp(const TraceStage stage)
+        {
+            stageTimes[(int)stage] = getMonotonicNanoseconds();
+        }
+
+        std::int64_t getCaptureTime() const
+        {
+            return stageTimes[(int)TraceStage::Captured];
+        }
+    };
+
+    // Mean and max duration of each stage over the frames added since the last getSummary()
+    class TraceStatistics
+    {
+    public:
+        TraceStatistics()
+        {
+            reset();
+        }
+
+        void add(const FrameTrace& trace)
+        {
+            for (auto stage = 1 ; stage < TRACE_NUMBER_STAGES ; stage++)
+            {
+                if (trace.stageTimes[stage-1] > 0 && trace.stageTimes[stage] > 0)
+                {
+                    const auto duration = trace.stageTimes[stage] - trace.stageTimes[stage-1];
+                    mTotal[stage-1] += duration;
+                    mMax[stage-1] = std::max(mMax[stage-1], duration);
+                    mCount[stage-1]++;
+                }
+            }
+            mDroppedFrames += trace.droppedFrames;
+            const auto total = trace.stageTimes[(int)TraceStage::Serialized] - trace.getCaptureTime();
+            if (trace.getCaptureTime() > 0 && trace.stageTimes[(int)TraceStage::Serialized] > 0)
+            {
+                mTotal[TRACE_NUMBER_STAGES-1] += total;
+                mMax[TRACE_NUMBER_STAGES-1] = std::max(mMax[TRACE_NUMBER_STAGES-1], total);
+                mCount[TRACE_NUMBER_STAGES-1]++;
+            }
+        }
+
+        // E.g. "producer 1.2/3.4 ms | pose queue + inference 40.1/52.0 ms | ...", mean/max per interval, and the frames
+        // dropped if any. Resets the counts.
+        std::string getSummary()
+        {
+            const std::array<std::string, TRACE_NUMBER_STAGES> names{
+                "producer", "pose queue + inference", "postprocessing + output", "crop extraction", "serialization",
+                "capture to serialized"};
+            std::string summary;
+            for (auto interval = 0 ; interval < TRACE_NUMBER_STAGES ; interval++)
+            {
+                if (mCount[interval] == 0)
+                    continue;
+                summary += (summary.empty() ? "" : " | ") + names[interval] + " "
+                         + toMilliseconds(mTotal[interval] / (std::int64_t)mCount[interval]) + "/"
+                         + toMilliseconds(mMax[interval]) + " ms";
+            }
+            if (mDroppedFrames > 0)
+                summary += (summary.empty() ? "" : " | ") + std::to_string(mDroppedFrames) + " frames dropped";
+            reset();
+            return summary;
+        }
+
+        static std::string toMilliseconds(const std::int64_t nanoseconds)
+        {
+            const auto tenths = (nanoseconds + 50000) / 100000;
+            return std::to_string(tenths / 10) + "." + std::to_string(tenths % 10);
+        }
+
+    private:
+        // Index i: interval between stage i and i+1; last index: Captured -> Serialized
+        std::array<std::int64_t, TRACE_NUMBER_STAGES> mTotal;
+        std::array<std::int64_t, TRACE_NUMBER_STAGES> mMax;
+        std::array<unsigned long long, TRACE_NUMBER_STAGES> mCount;
+        unsigned long long mDroppedFrames;
+
+        void reset()
+        {
+            mTotal.fill(0);
+            mMax.fill(0);
+            mCount.fill(0ull);
+            mDroppedFrames = 0ull;
+        }
+    };
+}
+
+#endif // CWC_FRAME_TRACE_HPP
@@ -0,0 +1,286 @@
+#ifndef CWC_IMAGE_PREFETCHER_HPP
+#define CWC_IMAGE_PREFETCHER_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <openpose/headers.hpp>
+#include "decodeReduction.hpp"
+
+namespace cwc
+{
+    struct ImagePrefetchSettings
+    {
+        unsigned int workers;   // Decoding threads
+        unsigned int depth;     // Images decoded ahead of the one being returned (at least workers)
+        bool flip;              // Mirror each image, as op::ProducerProperty::Flip
+        int rotation;           // 0, 90, 180 or 270 degrees, as op::ProducerProperty::Rotation
+        bool repeat;            // Start again from the first file after the last one
+        int reduction;          // Decode at 1/reduction of the size (1, 2, 4 or 8, see decodeReduction.hpp). 0: the largest
+                                // that keeps the first image at least minWidth x minHeight
+        int minWidth;
+        int minHeight;
+
+        ImagePrefetchSettings() :
+            workers{2u}, depth{8u}, flip{false}, rotation{0}, repeat{false}, reduction{1}, minWidth{0}, minHeight{0}
+        {}
+    };
+
+    // Image formats read from a directory (those of op::ImageDirectoryReader)
+    const std::vector<std::string> IMAGE_FILE_EXTENSIONS{"bmp", "dib", "pbm", "pgm", "ppm", "sr", "ras", "jpg", "jpeg", "png",
+                                                         "jpe", "jp2", "tiff", "tif"};
+
+    inline std::vector<std::string> getImageFiles(const std::string& directoryPath)
+    {
+        return op::getFilesOnDirectory(directoryPath, IMAGE_FILE_EXTENSIONS);
+    }
+
+    // op::getFileNameNoExtension(path) into name, which keeps its memory (e.g. the name of a recycled datum)
+    inline void getFileNameNoExtension(const std::string& path, std::string& name)
+    {
+        const auto slash = path.find_last_of("\\/");
+        const auto begin = (slash == std::string::npos ? 0 : slash + 1);
+        const auto dot = path.find_last_of('.');
+        const auto end = (dot == std::string::npos || dot < begin ? path.size() : dot);
+        name.assign(path, begin, end - begin);
+    }
+
+    // Reads the image files with the OS mapping (mmap) and decodes them in memory (cv::imdecode) into image, reduced by
+    // reduction (the buffer of image is reused as in decodeImage)
+    inline void decodeImageFile(const std::string& path, const int reduction, cv::Mat& image)
+    {
+        #ifndef _WIN32
+            const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                image.release();
+                return;
+            }
+            struct stat status;
+            if (fstat(fd, &status) != 0 || status.st_size <= 0)
+            {
+                close(fd);
+                image.release();
+                return;
+            }
+            const auto size = (std::size_t)status.st_size;
+            void* const bytes = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (bytes == MAP_FAILED)
+            {
+                image.release();
+                return;
+            }
+            // The whole file is read once, in order (more read-ahead)
+            madvise(bytes, size, MADV_SEQUENTIAL);
+            try
+            {
+                decodeImage(cv::Mat{1, (int)size, CV_8UC1, bytes}, reduction, image);
+            }
+            catch (const std::exception&)
+            {
+                munmap(bytes, size);
+                throw;
+            }
+            munmap(bytes, size);
+        #else
+            std::ifstream file{path, std::ios::binary};
+            const std::vector<unsigned char> bytes{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+            if (bytes.empty())
+                image.release();
+            else
+                decodeImage(cv::Mat{bytes}, reduction, image);
+        #endif
+    }
+
+    inline cv::Mat decodeImageFile(const std::string& path, const int reduction = 1)
+    {
+        cv::Mat image;
+        decodeImageFile(path, reduction, image);
+        return image;
+    }
+
+    // Image-directory producer for the offline runs: a pool of `workers` threads reads and decodes the files up to `depth`
+    // images ahead of the one the producer thread asks for, so the pose extraction does not wait for the disk nor the JPEG
+    // decoder (which take longer than the network at low net_resolution). The images are returned in file order.
+    class ImagePrefetcher
+    {
+    public:
+        ImagePrefetcher(const std::vector<std::string>& files, const ImagePrefetchSettings& settings = ImagePrefetchSettings{}) :
+            mFiles(files),
+            mSettings(settings),
+            mRunning{true},
+            mNextToRead{0ull},
+            mNextToReturn{0ull}
+        {
+            mSettings.workers = std::max(1u, mSettings.workers);
+            mSettings.depth = std::max(mSettings.workers, mSettings.depth);
+            if (mSettings.reduction <= 0)
+                mSettings.reduction = detectReduction();
+            mSlots.resize(mSettings.depth);
+            for (auto worker = 0u ; worker < mSettings.workers ; worker++)
+                mThreads.emplace_back(&ImagePrefetcher::decodeFiles, this);
+        }
+
+        ~ImagePrefetcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock{mMutex};
+                mRunning = false;
+            }
+            mReadCondition.notify_all();
+            for (auto& thread : mThreads)
+                thread.join();
+        }
+
+        // Next image in file order (waits for it if it is not decoded yet) and its path. Returns false once all of them were
+        // returned. The image is empty if the file could not be read or decoded. The buffer image had goes to the slot
+        // freed, where a later file is decoded into it if it has the size of the decoded images and nobody else shares it
+        // (e.g. the recycled frame of a DatumPool datum).
+        bool next(cv::Mat& image, std::string& path)
+        {
+            std::unique_lock<std::mutex> lock{mMutex};
+            if (isFinished())
+                return false;
+            auto& slot = mSlots[mNextToReturn % mSlots.size()];
+            mReturnCondition.wait(lock, [&] { return slot.ready; });
+            std::swap(image, slot.image);
+            path = getFile(mNextToReturn);
+            slot.ready = false;
+            mNextToReturn++;
+            lock.unlock();
+            mReadCondition.notify_all();
+            return true;
+        }
+
+        bool isFinished() const
+        {
+            return mFiles.empty() || (!mSettings.repeat && mNextToReturn >= mFiles.size());
+        }
+
+        // Source pixels per pixel of the returned images
+        int getReduction() const
+        {
+            return mSettings.reduction;
+        }
+
+    private:
+        struct Slot
+        {
+            cv::Mat image;
+            bool ready;
+
+            Slot() :
+                ready{false}
+            {}
+        };
+
+        const std::vector<std::string> mFiles;
+        ImagePrefetchSettings mSettings;
+        bool mRunning;
+        unsigned long long mNextToRead;     // Next image index given to a worker
+        unsigned long long mNextToReturn;   // Next image index returned by next()
+        std::vector<Slot> mSlots;           // Image i goes to slot i % depth
+        std::mutex mMutex;
+        std::condition_variable mReadCondition;     // Signaled when a slot is freed (or on destruction)
+        std::condition_variable mReturnCondition;   // Signaled when an image is decoded
+        std::vector<std::thread> mThreads;
+
+        const std::string& getFile(const unsigned long long index) const
+        {
+            return mFiles[index % mFiles.size()];
+        }
+
+        bool hasFileToRead() const
+        {
+            return !mFiles.empty() && (mSettings.repeat || mNextToRead < mFiles.size());
+        }
+
+        void decodeFiles()
+        {
+            std::unique_lock<std::mutex> lock{mMutex};
+            while (true)
+            {
+                mReadCondition.wait(lock, [&]
+                {
+                    return !mRunning || (hasFileToRead() && mNextToRead < mNextToReturn + mSlots.size());
+                });
+                if (!mRunning)
+                    return;
+                const auto index = mNextToRead++;
+                const auto& path = getFile(index);
+                // Decoded into the buffer left in the slot by next()
+                auto& slot = mSlots[index % mSlots.size()];
+                cv::Mat image;
+                std::swap(image, slot.image);
+                lock.unlock();
+                try
+                {
+                    decodeImageFile(path, mSettings.reduction, image);
+                    if (!image.empty())
+                        transformImage(image);
+                }
+                catch (const std::exception& e)
+                {
+                    op::log("Image " + path + " could not be decoded: " + e.what(), op::Priority::High);
+                    image = cv::Mat{};
+                }
+                lock.lock();
+                std::swap(image, slot.image);
+                slot.ready = true;
+                mReturnCondition.notify_one();
+            }
+        }
+
+        // Reduction of settings.reduction 0, from the size of the first image that can be read (the others are expected
+        // to be the same size)
+        int detectReduction() const
+        {
+            for (const auto& path : mFiles)
+            {
+                const auto image = decodeImageFile(path);
+                if (image.empty())
+                    continue;
+                const auto rotated = (mSettings.rotation == 90 || mSettings.rotation == 270);
+                return getDecodeReduction((rotated ? image.rows : image.cols), (rotated ? image.cols : image.rows),
+                                          mSettings.minWidth, mSettings.minHeight);
+            }
+            return 1;
+        }
+
+        // Same flip and rotation as op::Producer
+        void transformImage(cv::Mat& image) const
+        {
+            if (mSettings.flip)
+                cv::flip(image, image, 1);
+            if (mSettings.rotation == 90)
+            {
+                cv::transpose(image, image);
+                cv::flip(image, image, 0);
+            }
+            else if (mSettings.rotation == 180)
+                cv::flip(image, image, -1);
+            else if (mSettings.rotation == 270)
+            {
+                cv::transpose(image, image);
+                cv::flip(image, image, 1);
+            }
+        }
+    };
+}
+
+#endif // CWC_IMAGE_PREFETCHER_HPP
@@ -0,0 +1,99 @@
+#ifndef CWC_KEYPOINT_CODEC_HPP
+#define CWC_KEYPOINT_CODEC_HPP
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    // Compact keypoints (ClosestBody option keypoints=compact), little endian, no padding:
+    //     uint8                    flags (KEYPOINT_KEYFRAME_FLAG)
+    //     uint8                    engaged (0 or 1)
+    //     uint32                   sequence (+1 per frame)
+    //     uint32                   changedMask (bit j set => keypoint j follows; all of them in a keyframe)
+    //     changed keypoints x      int16 x | int16 y | uint8 score
+    // x and y are fixed point (pixels * KEYPOINT_FIXED_POINT_SCALE) and score is score * 255. In a keyframe they are
+    // absolute values; otherwise x and y are deltas against the previous frame, score is absolute and unchanged keypoints
+    // keep their previous value. A decoder that misses a frame (late join, dropped packet: the sequence does not follow)
+    // must wait for the next keyframe.
+    const std::uint8_t KEYPOINT_KEYFRAME_FLAG = 1;
+    const auto KEYPOINT_FIXED_POINT_SCALE = 4.f;
+    const auto KEYPOINT_SCORE_SCALE = 255.f;
+
+    class KeypointEncoder
+    {
+    public:
+        // keyframeInterval: a keyframe is sent every keyframeInterval frames (1 = only keyframes)
+        explicit KeypointEncoder(const unsigned int keyframeInterval = 30) :
+            mKeyframeInterval{(keyframeInterval > 0 ? keyframeInterval : 1)},
+            mSequence{0u}
+        {
+            mPrevious.fill(0);
+            mPreviousScores.fill(0);
+        }
+
+        // Encodes the keypoints of frameData (see above) into output
+        void encode(const FrameData& frameData, std::vector<char>& output)
+        {
+            const auto keyframe = (mSequence % mKeyframeInterval == 0);
+            std::array<std::int16_t, 2*POSE_NUMBER_KEYPOINTS> positions;
+            std::array<std::uint8_t, POSE_NUMBER_KEYPOINTS> scores;
+            std::uint32_t changedMask = 0;
+            for (auto keypoint = 0 ; keypoint < POSE_NUMBER_KEYPOINTS ; keypoint++)
+            {
+                const auto* const values = &frameData.keypoints[keypoint*POSE_VALUES_PER_KEYPOINT];
+                positions[2*keypoint] = quantize(values[0] * KEYPOINT_FIXED_POINT_SCALE, -32768.f, 32767.f);
+                positions[2*keypoint+1] = quantize(values[1] * KEYPOINT_FIXED_POINT_SCALE, -32768.f, 32767.f);
+                scores[keypoint] = (std::uint8_t)quantize(values[2] * KEYPOINT_SCORE_SCALE, 0.f, 255.f);
+                if (keyframe || positions[2*keypoint] != mPrevious[2*keypoint]
+                    || positions[2*keypoint+1] != mPrevious[2*keypoint+1] || scores[keypoint] != mPreviousScores[keypoint])
+                    changedMask |= (1u << keypoint);
+            }
+
+            output.clear();
+            output.reserve(2*sizeof(std::uint8_t) + 2*sizeof(std::uint32_t)
+                           + POSE_NUMBER_KEYPOINTS * (2*sizeof(std::int16_t) + sizeof(std::uint8_t)));
+            append(output, (std::uint8_t)(keyframe ? KEYPOINT_KEYFRAME_FLAG : 0));
+            append(output, (std::uint8_t)(frameData.engaged != 0.f ? 1 : 0));
+            append(output, mSequence);
+            append(output, changedMask);
+            for (auto keypoint = 0 ; keypoint < POSE_NUMBER_KEYPOINTS ; keypoint++)
+            {
+                if (changedMask & (1u << keypoint))
+                {
+                    const auto x = positions[2*keypoint];
+                    const auto y = positions[2*keypoint+1];
+                    append(output, (std::int16_t)(keyframe ? x : x - mPrevious[2*keypoint]));
+                    append(output, (std::int16_t)(keyframe ? y : y - mPrevious[2*keypoint+1]));
+                    append(output, scores[keypoint]);
+                }
+            }
+            mPrevious = positions;
+            mPreviousScores = scores;
+            mSequence++;
+        }
+
+    private:
+        const unsigned int mKeyframeInterval;
+        std::uint32_t mSequence;
+        std::array<std::int16_t, 2*POSE_NUMBER_KEYPOINTS> mPrevious;
+        std::array<std::uint8_t, POSE_NUMBER_KEYPOINTS> mPreviousScores;
+
+        static std::int16_t quantize(const float value, const float minimum, const float maximum)
+        {
+            return (std::int16_t)std::round(value < minimum ? minimum : (value > maximum ? maximum : value));
+        }
+
+        template<typename T>
+        static void append(std::vector<char>& buffer, const T value)
+        {
+            const auto* const bytes = (const char*)&value;
+            buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+        }
+    };
+}
+
+#endif // CWC_KEYPOINT_CODEC_HPP
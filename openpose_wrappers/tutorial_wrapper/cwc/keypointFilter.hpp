@@ -0,0 +1,196 @@
+#ifndef CWC_KEYPOINT_FILTER_HPP
+#define CWC_KEYPOINT_FILTER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+#include "personTable.hpp"
+
+namespace cwc
+{
+    // x and y of every keypoint (the score is not filtered)
+    const auto KEYPOINT_FILTER_NUMBER_VALUES = POSE_NUMBER_KEYPOINTS * 2;
+
+    // One Euro filter (Casiez et al., 2012): a low-pass filter whose cutoff frequency rises with the speed of the keypoint,
+    // so a still keypoint loses its jitter while a moving one barely lags
+    struct KeypointFilterSettings
+    {
+        float minCutoff;        // Cutoff frequency of a still keypoint (Hz). Lower: smoother but more lag. 0 disables the filter
+        float beta;             // Cutoff increase per pixel/second of speed. Higher: less lag on fast movements
+        float derivativeCutoff; // Cutoff frequency of the speed estimate (Hz)
+        float maxGap;           // A track not seen for longer than this (seconds) starts again from its raw keypoints
+
+        KeypointFilterSettings() :
+            minCutoff{1.f}, beta{0.007f}, derivativeCutoff{1.f}, maxGap{0.5f}
+        {}
+    };
+
+    namespace detail
+    {
+        // Filter state of one track
+        struct KeypointFilterTrack
+        {
+            unsigned int id;
+            std::int64_t time;      // Capture time of its last frame (monotonic ns)
+            std::array<float, KEYPOINT_FILTER_NUMBER_VALUES> values;        // Last filtered x, y
+            std::array<float, KEYPOINT_FILTER_NUMBER_VALUES> derivatives;   // Last filtered speed (pixels/second)
+            std::array<float, KEYPOINT_FILTER_NUMBER_VALUES> found;         // 1 if the keypoint was found in that frame, 0 if not
+        };
+    }
+
+    // Smooths the x, y of the keypoints of every tracked person, with one One Euro filter per track and keypoint. The state
+    // of the people of the frame is gathered into contiguous arrays and then all their keypoints are filtered in one
+    // branchless loop, which the compiler vectorizes. A keypoint not found (0) stays 0 and starts again from its raw value
+    // once it is found again.
+    class KeypointFilter
+    {
+    public:
+        explicit KeypointFilter(const KeypointFilterSettings& settings = KeypointFilterSettings{}) :
+            mSettings(settings)
+        {}
+
+        bool isEnabled() const
+        {
+            return mSettings.minCutoff > 0.f;
+        }
+
+        // Filters poseKeypoints (trackIds: PersonTracker::getTrackIds() of the same frame, time: its capture time in
+        // monotonic ns) into filteredKeypoints, which has the same sizes. The scores, and the keypoints of people without a
+        // track, are copied as they are.
+        void filter(const op::Array<float>& poseKeypoints, const std::vector<unsigned int>& trackIds, const std::int64_t time,
+                    op::Array<float>& filteredKeypoints)
+        {
+            if (filteredKeypoints.getSize() != poseKeypoints.getSize())
+                filteredKeypoints.reset(poseKeypoints.getSize());
+            if (poseKeypoints.empty())
+                return;
+            std::copy(poseKeypoints.getConstPtr(), poseKeypoints.getConstPtr() + poseKeypoints.getVolume(),
+                      filteredKeypoints.getPtr());
+            const auto numberPeople = std::min(poseKeypoints.getSize(0), (int)trackIds.size());
+            const auto numberParts = std::min(poseKeypoints.getSize(1), POSE_NUMBER_KEYPOINTS);
+            const auto numberValues = poseKeypoints.getSize(2);
+            const auto maxGap = (std::int64_t)(mSettings.maxGap * 1e9f);
+            // Tracks gone for too long
+            mTracks.erase(std::remove_if(mTracks.begin(), mTracks.end(), [&](const detail::KeypointFilterTrack& track)
+            {
+                return time - track.time > maxGap;
+            }), mTracks.end());
+            // Gather: raw values, previous state and 1 / elapsed time of every person
+            const auto size = numberPeople * KEYPOINT_FILTER_NUMBER_VALUES;
+            for (auto* values : {&mValues, &mFound, &mPrevious, &mDerivatives, &mRates, &mMask})
+                values->assign(size, 0.f);
+            mSlots.assign(numberPeople, -1);
+            for (auto person = 0 ; person < numberPeople ; person++)
+            {
+                const auto* const keypoints = poseKeypoints.getConstPtr() + person * poseKeypoints.getSize(1) * numberValues;
+                const auto offset = person * KEYPOINT_FILTER_NUMBER_VALUES;
+                for (auto bodyPart = 0 ; bodyPart < numberParts ; bodyPart++)
+                {
+                    const auto x = keypoints[bodyPart*numberValues];
+                    const auto y = keypoints[bodyPart*numberValues + 1];
+                    mValues[offset + bodyPart*2] = x;
+                    mValues[offset + bodyPart*2 + 1] = y;
+                    mFound[offset + bodyPart*2] = (x > PERSON_KEYPOINT_THRESHOLD && y > PERSON_KEYPOINT_THRESHOLD ? 1.f : 0.f);
+                    mFound[offset + bodyPart*2 + 1] = mFound[offset + bodyPart*2];
+                }
+                if (trackIds[person] == PERSON_NO_TRACK)
+                    continue;
+                auto slot = getSlot(trackIds[person]);
+                auto rate = 0.f;
+                if (slot < 0)
+                {
+                    slot = (int)mTracks.size();
+                    mTracks.emplace_back();
+                    mTracks.back().id = trackIds[person];
+                    mTracks.back().found.fill(0.f);
+                }
+                else if (time > mTracks[slot].time)
+                    rate = 1e9f / (float)(time - mTracks[slot].time);
+                mSlots[person] = slot;
+                const auto& track = mTracks[slot];
+                std::copy(track.values.begin(), track.values.end(), mPrevious.begin() + offset);
+                std::copy(track.derivatives.begin(), track.derivatives.end(), mDerivatives.begin() + offset);
+                // Any positive rate for the keypoints not filtered, so the loop divides by no 0
+                std::fill(mRates.begin() + offset, mRates.begin() + offset + KEYPOINT_FILTER_NUMBER_VALUES,
+                          (rate > 0.f ? rate : 1.f));
+                // A keypoint is filtered if found now and in the last frame of the track (else it restarts from its value)
+                const auto filtered = (rate > 0.f ? 1.f : 0.f);
+                for (auto value = 0 ; value < KEYPOINT_FILTER_NUMBER_VALUES ; value++)
+                    mMask[offset + value] = filtered * mFound[offset + value] * track.found[value];
+            }
+            // Filter
+            filterValues(size);
+            // Scatter: state of the tracks and filtered x, y
+            for (auto person = 0 ; person < numberPeople ; person++)
+            {
+                if (mSlots[person] < 0)
+                    continue;
+                auto& track = mTracks[mSlots[person]];
+                const auto offset = person * KEYPOINT_FILTER_NUMBER_VALUES;
+                track.time = time;
+                std::copy(mValues.begin() + offset, mValues.begin() + offset + KEYPOINT_FILTER_NUMBER_VALUES, track.values.begin());
+                std::copy(mDerivatives.begin() + offset, mDerivatives.begin() + offset + KEYPOINT_FILTER_NUMBER_VALUES,
+                          track.derivatives.begin());
+                std::copy(mFound.begin() + offset, mFound.begin() + offset + KEYPOINT_FILTER_NUMBER_VALUES, track.found.begin());
+                auto* const keypoints = filteredKeypoints.getPtr() + person * poseKeypoints.getSize(1) * numberValues;
+                for (auto bodyPart = 0 ; bodyPart < numberParts ; bodyPart++)
+                {
+                    keypoints[bodyPart*numberValues] = mValues[offset + bodyPart*2];
+                    keypoints[bodyPart*numberValues + 1] = mValues[offset + bodyPart*2 + 1];
+                }
+            }
+        }
+
+    private:
+        const KeypointFilterSettings mSettings;
+        std::vector<detail::KeypointFilterTrack> mTracks;
+        // Per-frame buffers (one value per person and KEYPOINT_FILTER_NUMBER_VALUES), kept to avoid allocations
+        std::vector<float> mValues;         // Raw, then filtered values
+        std::vector<float> mFound;          // 1 if the keypoint is found (not 0), 0 if not
+        std::vector<float> mPrevious;
+        std::vector<float> mDerivatives;    // Previous, then new filtered speed
+        std::vector<float> mRates;          // 1 / elapsed time (1/s)
+        std::vector<float> mMask;           // 1 if filtered, 0 if the raw value is kept
+        std::vector<int> mSlots;            // mTracks index of each person (-1 if none)
+
+        int getSlot(const unsigned int id) const
+        {
+            for (auto slot = 0u ; slot < mTracks.size() ; slot++)
+                if (mTracks[slot].id == id)
+                    return (int)slot;
+            return -1;
+        }
+
+        // The One Euro filter of every value, masked instead of branched. Smoothing factor of a cutoff frequency fc with
+        // the elapsed time te: alpha = 1 / (1 + tau / te), tau = 1 / (2 pi fc), i.e. 2 pi fc / (2 pi fc + rate)
+        void filterValues(const int size)
+        {
+            const auto twoPi = 6.28318530718f;
+            const auto derivativeCutoff = twoPi * mSettings.derivativeCutoff;
+            const auto minCutoff = twoPi * mSettings.minCutoff;
+            const auto beta = twoPi * mSettings.beta;
+            auto* const values = mValues.data();
+            auto* const derivatives = mDerivatives.data();
+            const auto* const previous = mPrevious.data();
+            const auto* const rates = mRates.data();
+            const auto* const mask = mMask.data();
+            for (auto i = 0 ; i < size ; i++)
+            {
+                const auto derivativeAlpha = derivativeCutoff / (derivativeCutoff + rates[i]);
+                const auto derivative = derivatives[i] + derivativeAlpha * ((values[i] - previous[i]) * rates[i] - derivatives[i]);
+                const auto cutoff = minCutoff + beta * std::abs(derivative);
+                const auto alpha = cutoff / (cutoff + rates[i]);
+                const auto value = previous[i] + alpha * (values[i] - previous[i]);
+                // Blended with the 0/1 mask rather than selected, or GCC moves the divisions into a branch
+                values[i] += mask[i] * (value - values[i]);
+                derivatives[i] = mask[i] * derivative;
+            }
+        }
+    };
+}
+
+#endif // CWC_KEYPOINT_FILTER_HPP
@@ -0,0 +1,164 @@
+#ifndef CWC_KEYPOINT_PREDICTOR_HPP
+#define CWC_KEYPOINT_PREDICTOR_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+#include "personTable.hpp"
+
+namespace cwc
+{
+    // Maximum number of frames kept per track by KeypointPredictor
+    const auto KEYPOINT_HISTORY_MAX_SIZE = 8;
+
+    struct KeypointPredictorSettings
+    {
+        int historySize;        // Frames the velocities are fitted on (2 to KEYPOINT_HISTORY_MAX_SIZE)
+        float maxGap;           // A track not seen for longer than this (seconds) starts a new history
+
+        KeypointPredictorSettings() :
+            historySize{4}, maxGap{0.5f}
+        {}
+    };
+
+    namespace detail
+    {
+        // Last frames of one track, newest first
+        struct KeypointHistory
+        {
+            unsigned int id;
+            int size;
+            std::array<std::int64_t, KEYPOINT_HISTORY_MAX_SIZE> times;  // Capture times (monotonic ns)
+            std::array<std::array<float, POSE_NUMBER_KEYPOINTS * 2>, KEYPOINT_HISTORY_MAX_SIZE> positions;  // x, y (0 if not found)
+        };
+    }
+
+    // Velocity of every keypoint of the tracked people, for the stream clients that ask for predicted keypoints (option
+    // predict, see makePredictedClosestBodyPacket). The velocity of a keypoint is the least-squares slope of its x and y over
+    // the last historySize frames of its track in which it was found without interruption (at least 2).
+    class KeypointPredictor
+    {
+    public:
+        explicit KeypointPredictor(const KeypointPredictorSettings& settings = KeypointPredictorSettings{}) :
+            mSettings(settings)
+        {
+            mSettings.historySize = std::max(2, std::min(mSettings.historySize, KEYPOINT_HISTORY_MAX_SIZE));
+        }
+
+        // Adds the keypoints of poseKeypoints (trackIds: PersonTracker::getTrackIds() of the same frame, time: its capture
+        // time in monotonic ns) to the history of their tracks
+        void update(const op::Array<float>& poseKeypoints, const std::vector<unsigned int>& trackIds, const std::int64_t time)
+        {
+            const auto maxGap = (std::int64_t)(mSettings.maxGap * 1e9f);
+            mHistories.erase(std::remove_if(mHistories.begin(), mHistories.end(), [&](const detail::KeypointHistory& history)
+            {
+                return time - history.times[0] > maxGap;
+            }), mHistories.end());
+            mSlots.assign(trackIds.size(), -1);
+            if (poseKeypoints.empty())
+                return;
+            const auto numberPeople = std::min(poseKeypoints.getSize(0), (int)trackIds.size());
+            const auto numberParts = std::min(poseKeypoints.getSize(1), POSE_NUMBER_KEYPOINTS);
+            const auto numberValues = poseKeypoints.getSize(2);
+            for (auto person = 0 ; person < numberPeople ; person++)
+            {
+                if (trackIds[person] == PERSON_NO_TRACK)
+                    continue;
+                auto slot = 0;
+                while (slot < (int)mHistories.size() && mHistories[slot].id != trackIds[person])
+                    slot++;
+                if (slot == (int)mHistories.size())
+                {
+                    mHistories.emplace_back();
+                    mHistories.back().id = trackIds[person];
+                    mHistories.back().size = 0;
+                }
+                auto& history = mHistories[slot];
+                // A frame with the same capture time (e.g. repeated) replaces the newest one
+                if (history.size > 0 && time <= history.times[0])
+                    history.size--;
+                else
+                {
+                    std::copy_backward(history.times.begin(), history.times.begin() + mSettings.historySize - 1,
+                                       history.times.begin() + mSettings.historySize);
+                    std::copy_backward(history.positions.begin(), history.positions.begin() + mSettings.historySize - 1,
+                                       history.positions.begin() + mSettings.historySize);
+                }
+                history.size = std::min(history.size + 1, mSettings.historySize);
+                history.times[0] = time;
+                history.positions[0].fill(0.f);
+                const auto* const keypoints = poseKeypoints.getConstPtr() + person * poseKeypoints.getSize(1) * numberValues;
+                for (auto bodyPart = 0 ; bodyPart < numberParts ; bodyPart++)
+                {
+                    const auto x = keypoints[bodyPart*numberValues];
+                    const auto y = keypoints[bodyPart*numberValues + 1];
+                    if (x > PERSON_KEYPOINT_THRESHOLD && y > PERSON_KEYPOINT_THRESHOLD)
+                    {
+                        history.positions[0][bodyPart*2] = x;
+                        history.positions[0][bodyPart*2 + 1] = y;
+                    }
+                }
+                mSlots[person] = slot;
+            }
+        }
+
+        // Velocities (x, y in pixels/second) of the keypoints of person (index in the frame of the last update()), and the
+        // bit (1 << keypoint) of those that have one. All 0 if the person is not tracked.
+        void getVelocities(const int person, std::array<float, POSE_NUMBER_KEYPOINTS * 2>& velocities,
+                           unsigned int& predictableKeypoints) const
+        {
+            velocities.fill(0.f);
+            predictableKeypoints = 0u;
+            if (person < 0 || person >= (int)mSlots.size() || mSlots[person] < 0)
+                return;
+            const auto& history = mHistories[mSlots[person]];
+            for (auto bodyPart = 0 ; bodyPart < POSE_NUMBER_KEYPOINTS ; bodyPart++)
+            {
+                // Frames in which it was found, from the newest one
+                auto size = 0;
+                while (size < history.size && history.positions[size][bodyPart*2] > 0.f)
+                    size++;
+                if (size < 2)
+                    continue;
+                // Least-squares slope, with the times in seconds from the newest frame
+                auto meanT = 0.f;
+                auto meanX = 0.f;
+                auto meanY = 0.f;
+                for (auto frame = 0 ; frame < size ; frame++)
+                {
+                    meanT += (float)(history.times[frame] - history.times[0]) * 1e-9f;
+                    meanX += history.positions[frame][bodyPart*2];
+                    meanY += history.positions[frame][bodyPart*2 + 1];
+                }
+                meanT /= size;
+                meanX /= size;
+                meanY /= size;
+                auto sumTT = 0.f;
+                auto sumTX = 0.f;
+                auto sumTY = 0.f;
+                for (auto frame = 0 ; frame < size ; frame++)
+                {
+                    const auto t = (float)(history.times[frame] - history.times[0]) * 1e-9f - meanT;
+                    sumTT += t*t;
+                    sumTX += t * (history.positions[frame][bodyPart*2] - meanX);
+                    sumTY += t * (history.positions[frame][bodyPart*2 + 1] - meanY);
+                }
+                if (sumTT <= 0.f)
+                    continue;
+                velocities[bodyPart*2] = sumTX / sumTT;
+                velocities[bodyPart*2 + 1] = sumTY / sumTT;
+                predictableKeypoints |= 1u << bodyPart;
+            }
+        }
+
+    private:
+        KeypointPredictorSettings mSettings;
+        std::vector<detail::KeypointHistory> mHistories;
+        std::vector<int> mSlots;    // mHistories index of each person of the last update() (-1 if none)
+    };
+}
+
+#endif // CWC_KEYPOINT_PREDICTOR_HPP
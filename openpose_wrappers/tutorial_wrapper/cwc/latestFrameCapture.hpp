@@ -0,0 +1,146 @@
+#ifndef CWC_LATEST_FRAME_CAPTURE_HPP
+#define CWC_LATEST_FRAME_CAPTURE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <opencv2/core/core.hpp>
+#include <openpose/headers.hpp>
+#include "frameTrace.hpp"
+
+namespace cwc
+{
+    // Live camera reader for interactive use: a dedicated thread reads the producer as fast as it delivers frames and
+    // keeps only the newest one in a single-slot mailbox. The pose extraction always takes the freshest frame, and a frame
+    // replaced before anybody took it is dropped (and counted), so the frames never queue up behind a slow inference.
+    class LatestFrameCapture
+    {
+    public:
+        explicit LatestFrameCapture(const std::shared_ptr<op::Producer>& producer) :
+            spProducer{producer},
+            mRunning{true},
+            mClosed{false},
+            mFresh{false},
+            mProducerStartTime{0},
+            mCaptureTime{0},
+            mDroppedFrames{0ull},
+            mTotalDroppedFrames{0ull}
+        {
+            if (spProducer == nullptr || !spProducer->isOpened())
+                op::error("The frame producer could not be opened.", __LINE__, __FUNCTION__, __FILE__);
+            mThread = std::thread{&LatestFrameCapture::captureFrames, this};
+        }
+
+        ~LatestFrameCapture()
+        {
+            {
+                std::lock_guard<std::mutex> lock{mMutex};
+                mRunning = false;
+            }
+            mThread.join();
+        }
+
+        // Waits for a frame newer than the last one returned. trace gets its ProducerStart and Captured times (those of
+        // the capture thread) and the number of frames dropped since the last one returned. Returns false once the
+        // producer is closed (end of a video, camera unplugged).
+        bool next(cv::Mat& frame, std::string& name, FrameTrace& trace)
+        {
+            std::unique_lock<std::mutex> lock{mMutex};
+            mCondition.wait(lock, [&] { return mFresh || mClosed; });
+            if (!mFresh)
+                return false;
+            frame = mFrame;
+            name = mName;
+            trace.stageTimes[(int)TraceStage::ProducerStart] = mProducerStartTime;
+            trace.stageTimes[(int)TraceStage::Captured] = mCaptureTime;
+            trace.droppedFrames = mDroppedFrames;
+            mFrame = cv::Mat{};
+            mFresh = false;
+            mDroppedFrames = 0ull;
+            return true;
+        }
+
+        bool isClosed() const
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            return mClosed && !mFresh;
+        }
+
+        unsigned long long getTotalDroppedFrames() const
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            return mTotalDroppedFrames;
+        }
+
+    private:
+        const std::shared_ptr<op::Producer> spProducer;
+        mutable std::mutex mMutex;
+        std::condition_variable mCondition;
+        bool mRunning;
+        bool mClosed;
+        // Mailbox
+        bool mFresh;            // mFrame was not returned yet
+        cv::Mat mFrame;
+        std::string mName;
+        std::int64_t mProducerStartTime;
+        std::int64_t mCaptureTime;
+        unsigned long long mDroppedFrames;      // Since the last frame returned
+        unsigned long long mTotalDroppedFrames;
+        std::thread mThread;
+
+        // Capture thread: the only one that uses the producer
+        void captureFrames()
+        {
+            try
+            {
+                while (true)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock{mMutex};
+                        if (!mRunning)
+                            break;
+                    }
+                    const auto producerStartTime = getMonotonicNanoseconds();
+                    auto name = spProducer->getFrameName();
+                    auto frame = spProducer->getFrame();
+                    const auto captureTime = getMonotonicNanoseconds();
+                    // Empty frame: end of a video or a camera error (only the first ends the capture)
+                    if (frame.empty())
+                    {
+                        if (!spProducer->isOpened())
+                            break;
+                        continue;
+                    }
+                    std::lock_guard<std::mutex> lock{mMutex};
+                    if (mFresh)
+                    {
+                        mDroppedFrames++;
+                        mTotalDroppedFrames++;
+                    }
+                    mFrame = frame;
+                    mName = std::move(name);
+                    mProducerStartTime = producerStartTime;
+                    mCaptureTime = captureTime;
+                    mFresh = true;
+                    mCondition.notify_one();
+                }
+            }
+            catch (const std::exception& e)
+            {
+                op::log(std::string{"Frame capture stopped: "} + e.what(), op::Priority::High);
+            }
+            std::lock_guard<std::mutex> lock{mMutex};
+            mClosed = true;
+            mCondition.notify_all();
+        }
+
+        LatestFrameCapture(const LatestFrameCapture&) = delete;
+        LatestFrameCapture& operator=(const LatestFrameCapture&) = delete;
+    };
+}
+
+#endif // CWC_LATEST_FRAME_CAPTURE_HPP
@@ -0,0 +1,143 @@
+#ifndef CWC_MULTI_CAMERA_CAPTURE_HPP
+#define CWC_MULTI_CAMERA_CAPTURE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <openpose/headers.hpp>
+#include "frameTrace.hpp"
+#include "latestFrameCapture.hpp"
+
+namespace cwc
+{
+    // Times a camera whose frame is too old is read again before the set is delivered as it is
+    const auto MULTI_CAMERA_MAX_RESYNCS = 4;
+
+    // One producer per entry of a comma-separated list, e.g. "0,1,rtsp://side/stream": a number is a webcam index, anything
+    // else an IP camera URL
+    inline std::vector<std::shared_ptr<op::Producer>> flagsToCameraProducers(const std::string& cameras,
+                                                                           const std::string& cameraResolution,
+                                                                           const double cameraFps)
+    {
+        std::vector<std::shared_ptr<op::Producer>> producers;
+        std::size_t begin = 0;
+        while (begin <= cameras.size())
+        {
+            auto end = cameras.find(',', begin);
+            if (end == std::string::npos)
+                end = cameras.size();
+            const auto camera = cameras.substr(begin, end - begin);
+            begin = end + 1;
+            if (camera.empty())
+                op::error("Empty entry in the camera list: " + cameras, __LINE__, __FUNCTION__, __FILE__);
+            if (camera.find_first_not_of("0123456789") == std::string::npos)
+                producers.emplace_back(op::flagsToProducer("", "", "", std::stoi(camera), cameraResolution, cameraFps));
+            else
+                producers.emplace_back(op::flagsToProducer("", "", camera, -1, cameraResolution, cameraFps));
+        }
+        return producers;
+    }
+
+    // Several live cameras read together (e.g. the front and side cameras of the table), so that one pose extraction
+    // processes all of them: each camera has its own LatestFrameCapture thread, and next() returns one frame per camera,
+    // taken within maxSkew of each other (capture times).
+    class MultiCameraCapture
+    {
+    public:
+        // maxSkewMilliseconds: 0 to take the newest frame of each camera, whatever its capture time
+        MultiCameraCapture(const std::vector<std::shared_ptr<op::Producer>>& producers, const int maxSkewMilliseconds) :
+            mMaxSkew{(std::int64_t)maxSkewMilliseconds * 1000000},
+            mTotalResyncs{0ull}
+        {
+            if (producers.empty())
+                op::error("No camera to read.", __LINE__, __FUNCTION__, __FILE__);
+            for (const auto& producer : producers)
+                mCaptures.emplace_back(new LatestFrameCapture{producer});
+        }
+
+        std::size_t getNumberCameras() const
+        {
+            return mCaptures.size();
+        }
+
+        // Waits for a frame of every camera (frames[i], names[i] and traces[i] are those of camera i, see
+        // LatestFrameCapture::next). While the capture times spread over more than maxSkew, the frames older than the
+        // newest one by more than maxSkew are dropped and their camera read again, at most MULTI_CAMERA_MAX_RESYNCS times
+        // and only while the spread shrinks (cameras running out of phase never get closer). Returns false once a camera
+        // is closed.
+        bool next(std::vector<cv::Mat>& frames, std::vector<std::string>& names, std::vector<FrameTrace>& traces)
+        {
+            const auto numberCameras = mCaptures.size();
+            frames.resize(numberCameras);
+            names.resize(numberCameras);
+            traces.resize(numberCameras);
+            for (auto camera = 0u ; camera < numberCameras ; camera++)
+                if (!mCaptures[camera]->next(frames[camera], names[camera], traces[camera]))
+                    return false;
+            auto newest = std::int64_t{0};
+            auto spread = getSpread(traces, newest);
+            for (auto resync = 0 ; resync < MULTI_CAMERA_MAX_RESYNCS && mMaxSkew > 0 && spread > mMaxSkew ; resync++)
+            {
+                for (auto camera = 0u ; camera < numberCameras ; camera++)
+                {
+                    if (newest - traces[camera].getCaptureTime() <= mMaxSkew)
+                        continue;
+                    // The one read again is newer: the old frame counts as dropped
+                    const auto droppedFrames = traces[camera].droppedFrames + 1;
+                    if (!mCaptures[camera]->next(frames[camera], names[camera], traces[camera]))
+                        return false;
+                    traces[camera].droppedFrames += droppedFrames;
+                    mTotalResyncs++;
+                }
+                const auto previousSpread = spread;
+                spread = getSpread(traces, newest);
+                if (spread >= previousSpread)
+                    break;
+            }
+            return true;
+        }
+
+        bool isClosed() const
+        {
+            for (const auto& capture : mCaptures)
+                if (capture->isClosed())
+                    return true;
+            return false;
+        }
+
+        // Frames replaced by a newer one of the same camera, plus those dropped to synchronize the cameras
+        unsigned long long getTotalDroppedFrames() const
+        {
+            auto totalDroppedFrames = mTotalResyncs;
+            for (const auto& capture : mCaptures)
+                totalDroppedFrames += capture->getTotalDroppedFrames();
+            return totalDroppedFrames;
+        }
+
+    private:
+        const std::int64_t mMaxSkew;    // ns
+        std::vector<std::unique_ptr<LatestFrameCapture>> mCaptures;
+        unsigned long long mTotalResyncs;
+
+        // Newest minus oldest capture time of the set (newest: the newest one)
+        static std::int64_t getSpread(const std::vector<FrameTrace>& traces, std::int64_t& newest)
+        {
+            newest = traces[0].getCaptureTime();
+            auto oldest = newest;
+            for (const auto& trace : traces)
+            {
+                newest = std::max(newest, trace.getCaptureTime());
+                oldest = std::min(oldest, trace.getCaptureTime());
+            }
+            return newest - oldest;
+        }
+
+        MultiCameraCapture(const MultiCameraCapture&) = delete;
+        MultiCameraCapture& operator=(const MultiCameraCapture&) = delete;
+    };
+}
+
+#endif // CWC_MULTI_CAMERA_CAPTURE_HPP
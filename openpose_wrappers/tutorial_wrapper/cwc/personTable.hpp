@@ -0,0 +1,182 @@
+#ifndef CWC_PERSON_TABLE_HPP
+#define CWC_PERSON_TABLE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    // Keypoints at or below this value are missing (OpenPose gives 0)
+    const auto PERSON_KEYPOINT_THRESHOLD = 0.00001f;
+
+    namespace detail
+    {
+        // Joints used by computePersonTable, copied into contiguous per-person columns
+        enum PersonTableJoint { Nose = 0, Neck, RShoulder, RElbow, LShoulder, LElbow, RHip, LHip, Size };
+        const std::array<int, PersonTableJoint::Size> PERSON_TABLE_JOINTS{{0, 1, 2, 3, 5, 6, 8, 11}};
+
+        // Scratch columns of computePersonTable
+        struct PersonTableColumns
+        {
+            std::array<std::vector<float>, PersonTableJoint::Size> x;
+            std::array<std::vector<float>, PersonTableJoint::Size> y;
+            std::vector<float> limbSum;
+            std::vector<float> limbCount;
+            std::vector<float> centroidCount;
+        };
+
+        // Length of the limb a-b of every person, added (with its count) where both joints are found (and, for the limbs
+        // from the neck, the neck too). quirkY: the y of joint b only has to be non-zero
+        // (as it always was for the elbow limbs, kept so the engaged person does not change).
+        inline void addLimbs(PersonTableColumns& columns, const int size, const int a, const int b, const bool quirkY,
+                             const bool needsNeck)
+        {
+            const auto* const ax = columns.x[a].data();
+            const auto* const ay = columns.y[a].data();
+            const auto* const bx = columns.x[b].data();
+            const auto* const by = columns.y[b].data();
+            const auto* const neckX = columns.x[Neck].data();
+            const auto* const neckY = columns.y[Neck].data();
+            auto* const limbSum = columns.limbSum.data();
+            auto* const limbCount = columns.limbCount.data();
+            for (auto person = 0 ; person < size ; person++)
+            {
+                const auto found = (ax[person] > PERSON_KEYPOINT_THRESHOLD) & (ay[person] > PERSON_KEYPOINT_THRESHOLD)
+                                 & (bx[person] > PERSON_KEYPOINT_THRESHOLD)
+                                 & (quirkY ? by[person] != 0.f : by[person] > PERSON_KEYPOINT_THRESHOLD)
+                                 & ((!needsNeck) | ((neckX[person] > PERSON_KEYPOINT_THRESHOLD)
+                                                    & (neckY[person] > PERSON_KEYPOINT_THRESHOLD)));
+                const auto dx = ax[person] - bx[person];
+                const auto dy = ay[person] - by[person];
+                // Computed for everyone and then masked, so the loop has no branch
+                limbSum[person] += (float)found * std::sqrt(dx*dx + dy*dy);
+                limbCount[person] += (float)found;
+            }
+        }
+    }
+
+    // What the output stage needs to know about every person of a frame, one array per value (structure of arrays). Kept
+    // across frames, so once it has grown to the largest crowd seen nothing is allocated.
+    struct PersonTable
+    {
+        int size;
+        std::vector<float> meanKeypointX;       // Mean x of the nose, neck and shoulders found (0 if none)
+        std::vector<float> meanKeypointY;       // Mean y of the same joints (0 if none)
+        std::vector<float> averageLimbLength;   // Mean length of the upper body limbs found (0 if none)
+        std::vector<unsigned char> isWithinCentralFrame;    // meanKeypointX within the central third of the frame
+        detail::PersonTableColumns columns;     // Scratch of computePersonTable
+
+        PersonTable() :
+            size{0}
+        {}
+    };
+
+    // Centroid, average limb length and central-frame flag of every person of poseKeypoints (frame width resX), the values
+    // of the per-person std::map code it replaced. The joints used are first copied into contiguous columns, and then each
+    // value is computed for all the people in one branchless loop, which the compiler vectorizes (with GCC, the limb
+    // lengths only with -fno-math-errno, as std::sqrt may set errno).
+    // Limbs: | 0-1 | 2-1 | 5-1 | 8-1 | 11-1 | 3-2 | 6-5 | (not | 4-3 | 7-6 | 14-0 | 15-0 | 16-14 | 17-15 |)
+    inline void computePersonTable(const op::Array<float>& poseKeypoints, const unsigned int resX, PersonTable& table)
+    {
+        using namespace detail;
+        auto& columns = table.columns;
+        const auto size = (poseKeypoints.empty() ? 0 : poseKeypoints.getSize(0));
+        const auto numberParts = (poseKeypoints.empty() ? 0 : poseKeypoints.getSize(1));
+        const auto numberValues = (poseKeypoints.empty() ? 0 : poseKeypoints.getSize(2));
+        table.size = size;
+        for (auto* values : {&table.meanKeypointX, &table.meanKeypointY, &table.averageLimbLength, &columns.limbSum,
+                             &columns.limbCount, &columns.centroidCount})
+            values->assign(size, 0.f);
+        table.isWithinCentralFrame.assign(size, 0);
+        if (size == 0)
+            return;
+        // Transpose the joints used into columns (0 for the joints the model does not have)
+        const auto* const keypoints = poseKeypoints.getConstPtr();
+        for (auto joint = 0 ; joint < PersonTableJoint::Size ; joint++)
+        {
+            auto& x = columns.x[joint];
+            auto& y = columns.y[joint];
+            const auto part = PERSON_TABLE_JOINTS[joint];
+            x.assign(size, 0.f);
+            y.assign(size, 0.f);
+            if (part < numberParts)
+                for (auto person = 0 ; person < size ; person++)
+                {
+                    const auto* const keypoint = keypoints + (person * numberParts + part) * numberValues;
+                    x[person] = keypoint[0];
+                    y[person] = keypoint[1];
+                }
+        }
+        // Centroid, and central third of the frame along x: [--|--|--]. Missing joints count as 0 in the sums, in the nose,
+        // neck, right shoulder, left shoulder order, as they always were.
+        const auto* const noseX = columns.x[Nose].data();
+        const auto* const noseY = columns.y[Nose].data();
+        const auto* const neckX = columns.x[Neck].data();
+        const auto* const neckY = columns.y[Neck].data();
+        const auto* const rShoulderX = columns.x[RShoulder].data();
+        const auto* const rShoulderY = columns.y[RShoulder].data();
+        const auto* const lShoulderX = columns.x[LShoulder].data();
+        const auto* const lShoulderY = columns.y[LShoulder].data();
+        const auto centralStart = (float)(resX / 3);
+        const auto centralEnd = (float)(2 * resX / 3);
+        auto* const meanX = table.meanKeypointX.data();
+        auto* const meanY = table.meanKeypointY.data();
+        auto* const central = table.isWithinCentralFrame.data();
+        auto* const centroidCount = columns.centroidCount.data();
+        const auto count = [](const float value) { return (value > PERSON_KEYPOINT_THRESHOLD ? 1.f : 0.f); };
+        const auto keep = [](const float value) { return (value > PERSON_KEYPOINT_THRESHOLD ? value : 0.f); };
+        // x and y apart, so each loop has few enough arrays for the compiler to check that they do not overlap
+        for (auto person = 0 ; person < size ; person++)
+        {
+            const auto countX = count(noseX[person]) + count(neckX[person]) + count(rShoulderX[person]) + count(lShoulderX[person]);
+            const auto sumX = keep(noseX[person]) + keep(neckX[person]) + keep(rShoulderX[person]) + keep(lShoulderX[person]);
+            // Divided by 1 instead of 0 (a mean of no joint is 0), so no division is skipped and the loop has no branch
+            meanX[person] = sumX / (countX + (float)(countX == 0.f));
+            centroidCount[person] = countX;
+        }
+        for (auto person = 0 ; person < size ; person++)
+        {
+            const auto countY = count(noseY[person]) + count(neckY[person]) + count(rShoulderY[person]) + count(lShoulderY[person]);
+            const auto sumY = keep(noseY[person]) + keep(neckY[person]) + keep(rShoulderY[person]) + keep(lShoulderY[person]);
+            meanY[person] = sumY / (countY + (float)(countY == 0.f));
+        }
+        for (auto person = 0 ; person < size ; person++)
+            central[person] = (centroidCount[person] > 0.f) & (meanX[person] >= centralStart) & (meanX[person] <= centralEnd);
+        // Limbs
+        for (const auto joint : {Nose, RShoulder, LShoulder, RHip, LHip})
+            addLimbs(columns, size, Neck, joint, false, true);
+        addLimbs(columns, size, RElbow, RShoulder, true, false);
+        addLimbs(columns, size, LElbow, LShoulder, true, false);
+        auto* const averageLimbLength = table.averageLimbLength.data();
+        const auto* const limbSum = columns.limbSum.data();
+        const auto* const limbCount = columns.limbCount.data();
+        for (auto person = 0 ; person < size ; person++)
+            averageLimbLength[person] = limbSum[person] / (limbCount[person] + (float)(limbCount[person] == 0.f));
+    }
+
+    // One PersonData per person of the table (index not assigned yet, see PersonTracker), for the AllBodies stream
+    inline void fillPeople(const op::Array<float>& poseKeypoints, const PersonTable& table, std::vector<PersonData>& people)
+    {
+        people.resize(table.size);
+        const auto numberParts = (table.size > 0 ? std::min(poseKeypoints.getSize(1), POSE_NUMBER_KEYPOINTS) : 0);
+        const auto numberValues = (table.size > 0 ? poseKeypoints.getSize(2) : 0);
+        for (auto person = 0 ; person < table.size ; person++)
+        {
+            auto& personData = people[person];
+            const auto* const keypoints = poseKeypoints.getConstPtr() + person * poseKeypoints.getSize(1) * numberValues;
+            for (auto bodyPart = 0 ; bodyPart < numberParts ; bodyPart++)
+                for (auto xyscore = 0 ; xyscore < std::min(numberValues, POSE_VALUES_PER_KEYPOINT) ; xyscore++)
+                    personData.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT + xyscore] = keypoints[bodyPart*numberValues + xyscore];
+            personData.centroidX = table.meanKeypointX[person];
+            personData.centroidY = table.meanKeypointY[person];
+            personData.averageLimbLength = table.averageLimbLength[person];
+            personData.flags = (table.isWithinCentralFrame[person] ? PERSON_CENTRAL_FLAG : 0);
+        }
+    }
+}
+
+#endif // CWC_PERSON_TABLE_HPP
@@ -0,0 +1,223 @@
+#ifndef CWC_PERSON_TRACKER_HPP
+#define CWC_PERSON_TRACKER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <tuple>
+#include <vector>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+#include "personTable.hpp"
+
+namespace cwc
+{
+    struct TrackerSettings
+    {
+        float maxDistance;          // Maximum mean keypoint displacement between two frames of the same person (pixels)
+        unsigned int maxMissed;     // Frames a person can go undetected (e.g. occluded) and keep its track
+
+        TrackerSettings() :
+            maxDistance{64.f}, maxMissed{5u}
+        {}
+    };
+
+    // What the tracker remembers about one person
+    struct TrackState
+    {
+        unsigned int id;
+        std::array<float, POSE_NUMBER_VALUES> keypoints;    // Last detection (x, y, score), as PersonData::keypoints
+        float centerX;              // Mean of the keypoints found in the last detection
+        float centerY;
+        float averageLimbLength;    // PersonTable::averageLimbLength of the last detection
+        unsigned int age;           // Frames detected
+        unsigned int missed;        // Consecutive frames not detected (0 if detected in the last one)
+    };
+
+    // Gives every detected person a track id that stays the same from frame to frame (OpenPose orders the people of every
+    // frame independently) and picks the engaged person so that it does not flip between people.
+    // Detections are matched to the tracks by their mean keypoint distance (over the joints found in both), closest pairs
+    // first. Only the tracks whose center is within maxDistance along x are compared, found by binary search in the tracks
+    // sorted by x, so a frame costs O(n log n) for n people spread across the frame instead of O(n^2).
+    class PersonTracker
+    {
+    public:
+        explicit PersonTracker(const TrackerSettings& settings = TrackerSettings{}) :
+            mSettings(settings),
+            mNextId{0u},
+            mEngagedTrack{PERSON_NO_TRACK}
+        {}
+
+        // Matches the people of poseKeypoints (and table, computePersonTable() of the same frame) with the tracks. Tracks
+        // not detected for more than maxMissed frames are dropped, the people not matched start new tracks.
+        void update(const op::Array<float>& poseKeypoints, const PersonTable& table)
+        {
+            const auto numberPeople = table.size;
+            const auto numberParts = (numberPeople > 0 ? std::min(poseKeypoints.getSize(1), POSE_NUMBER_KEYPOINTS) : 0);
+            const auto numberValues = (numberPeople > 0 ? poseKeypoints.getSize(2) : 0);
+            // Detections, in the TrackState layout
+            mDetections.resize(numberPeople);
+            for (auto person = 0 ; person < numberPeople ; person++)
+            {
+                auto& detection = mDetections[person];
+                const auto* const keypoints = poseKeypoints.getConstPtr() + person * poseKeypoints.getSize(1) * numberValues;
+                detection.keypoints.fill(0.f);
+                for (auto bodyPart = 0 ; bodyPart < numberParts ; bodyPart++)
+                    for (auto xyscore = 0 ; xyscore < std::min(numberValues, POSE_VALUES_PER_KEYPOINT) ; xyscore++)
+                        detection.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT + xyscore] = keypoints[bodyPart*numberValues + xyscore];
+                getCenter(detection.keypoints, detection.centerX, detection.centerY);
+                detection.averageLimbLength = table.averageLimbLength[person];
+            }
+            // Candidate pairs (cost, person, track), with the tracks sorted by x
+            std::sort(mTracks.begin(), mTracks.end(), [](const TrackState& a, const TrackState& b)
+            {
+                return a.centerX < b.centerX;
+            });
+            mPairs.clear();
+            for (auto person = 0 ; person < numberPeople ; person++)
+            {
+                const auto& detection = mDetections[person];
+                auto track = std::lower_bound(mTracks.begin(), mTracks.end(), detection.centerX - mSettings.maxDistance,
+                                              [](const TrackState& state, const float x) { return state.centerX < x; });
+                for ( ; track != mTracks.end() && track->centerX <= detection.centerX + mSettings.maxDistance ; ++track)
+                {
+                    const auto cost = getDistance(detection, *track);
+                    if (cost <= mSettings.maxDistance)
+                        mPairs.emplace_back(cost, person, (int)(track - mTracks.begin()));
+                }
+            }
+            std::sort(mPairs.begin(), mPairs.end());
+            // Greedy assignment, closest pairs first
+            mTrackIds.assign(numberPeople, PERSON_NO_TRACK);
+            mMatched.assign(mTracks.size(), false);
+            for (const auto& pair : mPairs)
+            {
+                const auto person = std::get<1>(pair);
+                const auto track = std::get<2>(pair);
+                if (mTrackIds[person] == PERSON_NO_TRACK && !mMatched[track])
+                {
+                    mMatched[track] = true;
+                    mTrackIds[person] = mTracks[track].id;
+                    const auto age = mTracks[track].age;
+                    mTracks[track] = mDetections[person];
+                    mTracks[track].id = mTrackIds[person];
+                    mTracks[track].age = age + 1;
+                    mTracks[track].missed = 0;
+                }
+            }
+            // Lost tracks, then new ones
+            auto kept = 0u;
+            for (auto track = 0u ; track < mTracks.size() ; track++)
+            {
+                if (!mMatched[track] && ++mTracks[track].missed > mSettings.maxMissed)
+                    continue;
+                mTracks[kept++] = mTracks[track];
+            }
+            mTracks.resize(kept);
+            for (auto person = 0 ; person < numberPeople ; person++)
+            {
+                if (mTrackIds[person] != PERSON_NO_TRACK)
+                    continue;
+                mTrackIds[person] = mNextId++;
+                mTracks.emplace_back(mDetections[person]);
+                mTracks.back().id = mTrackIds[person];
+                mTracks.back().age = 1;
+                mTracks.back().missed = 0;
+            }
+        }
+
+        // Track id of each person of the last update()
+        const std::vector<unsigned int>& getTrackIds() const
+        {
+            return mTrackIds;
+        }
+
+        const std::vector<TrackState>& getTracks() const
+        {
+            return mTracks;
+        }
+
+        // Engaged person of the last update(): within the central third of the frame and with an average limb length above
+        // minLimbLength (i.e. close enough). The engaged person stays engaged while it qualifies, otherwise the closest
+        // (longest limbs) of the people who qualify is engaged. Returns its index in the frame, or -1 if nobody qualifies.
+        int selectEngaged(const PersonTable& table, const float minLimbLength)
+        {
+            auto engaged = -1;
+            for (auto person = 0 ; person < table.size && person < (int)mTrackIds.size() ; person++)
+            {
+                if (!table.isWithinCentralFrame[person] || !(table.averageLimbLength[person] > minLimbLength))
+                    continue;
+                if (mTrackIds[person] == mEngagedTrack)
+                {
+                    engaged = person;
+                    break;
+                }
+                if (engaged < 0 || table.averageLimbLength[person] > table.averageLimbLength[engaged])
+                    engaged = person;
+            }
+            mEngagedTrack = (engaged >= 0 ? mTrackIds[engaged] : PERSON_NO_TRACK);
+            return engaged;
+        }
+
+    private:
+        const TrackerSettings mSettings;
+        unsigned int mNextId;
+        unsigned int mEngagedTrack;
+        std::vector<TrackState> mTracks;
+        // Per-frame buffers, kept to avoid allocations
+        std::vector<TrackState> mDetections;
+        std::vector<std::tuple<float, int, int>> mPairs;
+        std::vector<unsigned int> mTrackIds;
+        std::vector<bool> mMatched;
+
+        static bool isFound(const std::array<float, POSE_NUMBER_VALUES>& keypoints, const int bodyPart)
+        {
+            return keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT] > PERSON_KEYPOINT_THRESHOLD
+                && keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT + 1] > PERSON_KEYPOINT_THRESHOLD;
+        }
+
+        static void getCenter(const std::array<float, POSE_NUMBER_VALUES>& keypoints, float& centerX, float& centerY)
+        {
+            auto count = 0;
+            centerX = 0.f;
+            centerY = 0.f;
+            for (auto bodyPart = 0 ; bodyPart < POSE_NUMBER_KEYPOINTS ; bodyPart++)
+            {
+                if (!isFound(keypoints, bodyPart))
+                    continue;
+                centerX += keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT];
+                centerY += keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT + 1];
+                count++;
+            }
+            if (count > 0)
+            {
+                centerX /= count;
+                centerY /= count;
+            }
+        }
+
+        // Mean distance of the joints found in both, or distance of the centers if they have none in common
+        static float getDistance(const TrackState& a, const TrackState& b)
+        {
+            auto distance = 0.f;
+            auto count = 0;
+            for (auto bodyPart = 0 ; bodyPart < POSE_NUMBER_KEYPOINTS ; bodyPart++)
+            {
+                if (!isFound(a.keypoints, bodyPart) || !isFound(b.keypoints, bodyPart))
+                    continue;
+                const auto dx = a.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT] - b.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT];
+                const auto dy = a.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT + 1]
+                              - b.keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT + 1];
+                distance += std::sqrt(dx*dx + dy*dy);
+                count++;
+            }
+            if (count > 0)
+                return distance / count;
+            const auto dx = a.centerX - b.centerX;
+            const auto dy = a.centerY - b.centerY;
+            return std::sqrt(dx*dx + dy*dy);
+        }
+    };
+}
+
+#endif // CWC_PERSON_TRACKER_HPP
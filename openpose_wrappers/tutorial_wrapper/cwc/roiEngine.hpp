@@ -0,0 +1,150 @@
+#ifndef CWC_ROI_ENGINE_HPP
+#define CWC_ROI_ENGINE_HPP
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <openpose/headers.hpp>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    // One image region cut around a person. The anchor point is the anchor joint pushed along the reference->anchor
+    // direction: anchor + (anchor - reference) * scale, or * shortScale if that vector is not longer than minLength (e.g.
+    // the palm past the wrist along the forearm). Without a reference joint, the anchor point is the anchor joint itself.
+    // The width x height crop is centered on the anchor point. It is used if at most `tolerance` of its width/height falls
+    // outside the frame, and then shifted inside the frame.
+    struct RoiSpec
+    {
+        CropRegion region;
+        int anchorJoint;
+        int referenceJoint;     // -1: no extrapolation
+        float scaleX;
+        float scaleY;
+        float shortScale;
+        float minLength;        // Pixels
+        int width;
+        int height;
+        float tolerance;        // Fraction of the width/height
+        // Text output and display: "Image<textName>: <textSize>_img_x_start, ...", "[<unknownName> unknown]" and the
+        // cv::imshow window
+        std::string textName;
+        std::string textSize;
+        std::string unknownName;
+        std::string windowName;
+    };
+
+    // Regions cut by UserOutputClass::printKeypoints (COCO joints: 0 nose, 3/4 right elbow/wrist, 6/7 left elbow/wrist).
+    // A new region is one more entry (and its CropRegion).
+    inline std::vector<RoiSpec> getDefaultRoiSpecs()
+    {
+        // Palm: past the wrist by 0.375 x (x) and 0.75 x (y) the forearm, or by half of it if the forearm is 10 pixels or less
+        const auto palmRatio = 0.5f;
+        return std::vector<RoiSpec>{
+            {CropRegion::LeftHand, 7, 6, 0.75f*palmRatio, 1.5f*palmRatio, palmRatio, 10.f, CROP_SIZE, CROP_SIZE, 0.45f,
+             "LeftHand", "hand", "left hand", "Left Hand"},
+            {CropRegion::RightHand, 4, 3, 0.75f*palmRatio, 1.5f*palmRatio, palmRatio, 10.f, CROP_SIZE, CROP_SIZE, 0.45f,
+             "RightHand", "hand", "right hand", "Right Hand"},
+            {CropRegion::Head, 0, -1, 0.f, 0.f, 0.f, 0.f, CROP_SIZE, CROP_SIZE, 0.45f,
+             "Head", "head", "head", "Head"},
+        };
+    }
+
+    // Where one RoiSpec falls for one person
+    struct RoiResult
+    {
+        int person;
+        int spec;               // Index in RoiEngine::getSpecs()
+        bool visible;           // Within the tolerance (and requested)
+        int xStart;             // Centered on the anchor point, before shifting it inside the frame
+        int yStart;
+        int xEnd;
+        int yEnd;
+        int x;                  // Shifted inside the frame (only if visible)
+        int y;
+    };
+
+    class RoiEngine
+    {
+    public:
+        explicit RoiEngine(const std::vector<RoiSpec>& specs = getDefaultRoiSpecs()) :
+            mSpecs(specs)
+        {
+            for (const auto& spec : mSpecs)
+                if ((int)spec.region >= CROP_NUMBER_REGIONS || spec.width <= 0 || spec.height <= 0)
+                    op::error("Wrong region " + spec.textName + ".", __LINE__, __FUNCTION__, __FILE__);
+        }
+
+        const std::vector<RoiSpec>& getSpecs() const
+        {
+            return mSpecs;
+        }
+
+        // Largest crop (bytes), to size the crop buffers
+        std::size_t getMaxCropBytes() const
+        {
+            std::size_t maxBytes = 0;
+            for (const auto& spec : mSpecs)
+                maxBytes = std::max(maxBytes, (std::size_t)(spec.width * spec.height * CROP_NUMBER_CHANNELS));
+            return maxBytes;
+        }
+
+        // Evaluates every spec for every person of persons, in one pass over poseKeypoints (person-major, then in spec
+        // order). regionMask: bit (1 << CropRegion) set for the regions to compute, the others are not visible. A person
+        // out of range reads as all-zero keypoints, like an empty frame. results keeps its capacity across frames.
+        void evaluate(const op::Array<float>& poseKeypoints, const std::vector<int>& persons, const int width,
+                      const int height, const int regionMask, std::vector<RoiResult>& results) const
+        {
+            results.clear();
+            const auto numberPeople = (poseKeypoints.empty() ? 0 : poseKeypoints.getSize(0));
+            const auto numberParts = (poseKeypoints.empty() ? 0 : poseKeypoints.getSize(1));
+            const auto numberValues = (poseKeypoints.empty() ? 0 : poseKeypoints.getSize(2));
+            const auto* const keypoints = (poseKeypoints.empty() ? nullptr : poseKeypoints.getConstPtr());
+            for (const auto person : persons)
+            {
+                const auto* const personKeypoints = (person >= 0 && person < numberPeople
+                                                     ? keypoints + person * numberParts * numberValues : nullptr);
+                const auto getJoint = [&](const int joint, float& x, float& y)
+                {
+                    const auto valid = (personKeypoints != nullptr && joint >= 0 && joint < numberParts);
+                    x = (valid ? personKeypoints[joint * numberValues] : 0.f);
+                    y = (valid ? personKeypoints[joint * numberValues + 1] : 0.f);
+                };
+                for (auto specIndex = 0 ; specIndex < (int)mSpecs.size() ; specIndex++)
+                {
+                    const auto& spec = mSpecs[specIndex];
+                    float anchorX, anchorY;
+                    getJoint(spec.anchorJoint, anchorX, anchorY);
+                    if (spec.referenceJoint >= 0)
+                    {
+                        float referenceX, referenceY;
+                        getJoint(spec.referenceJoint, referenceX, referenceY);
+                        const auto dx = anchorX - referenceX;
+                        const auto dy = anchorY - referenceY;
+                        const auto isLong = (dx*dx + dy*dy > spec.minLength*spec.minLength);
+                        anchorX = (float)(anchorX + dx * (double)(isLong ? spec.scaleX : spec.shortScale));
+                        anchorY = (float)(anchorY + dy * (double)(isLong ? spec.scaleY : spec.shortScale));
+                    }
+                    results.emplace_back();
+                    auto& result = results.back();
+                    result.person = person;
+                    result.spec = specIndex;
+                    result.xStart = (int)anchorX - spec.width / 2;
+                    result.yStart = (int)anchorY - spec.height / 2;
+                    result.xEnd = result.xStart + spec.width;
+                    result.yEnd = result.yStart + spec.height;
+                    result.visible = (regionMask & (1 << (int)spec.region))
+                        && result.yStart >= -spec.tolerance*spec.height && result.xStart >= -spec.tolerance*spec.width
+                        && result.yEnd < height + spec.tolerance*spec.height && result.xEnd < width + spec.tolerance*spec.width;
+                    result.x = std::max(0, std::min(result.xStart, width - spec.width));
+                    result.y = std::max(0, std::min(result.yStart, height - spec.height));
+                }
+            }
+        }
+
+    private:
+        const std::vector<RoiSpec> mSpecs;
+    };
+}
+
+#endif // CWC_ROI_ENGINE_HPP
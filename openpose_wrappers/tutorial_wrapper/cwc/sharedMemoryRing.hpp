@@ -0,0 +1,327 @@
+#ifndef CWC_SHARED_MEMORY_RING_HPP
+#define CWC_SHARED_MEMORY_RING_HPP
+
+// Shared-memory transport for consumers running on the same machine as the wrapper.
+// This header does not depend on OpenPose/OpenCV, so the consumers can include it directly (link with -lrt on old glibc).
+//
+// Memory layout (one POSIX shared-memory object):
+//     SharedRingHeader                                                     (64 bytes)
+//     slotCount x slot, each of header.slotSize bytes:
+//         std::atomic<uint64_t> generation                                 (seqlock: odd while the writer fills the slot)
+//         SharedFrame                                                      (at SHARED_SLOT_FRAME_OFFSET)
+//         uint8[cropCapacity] x CROP_NUMBER_REGIONS                        (LH, RH, Head at fixed offsets)
+// The writer fills slot (sequence - 1) % slotCount and then publishes `sequence` in header.latestSequence. Readers never
+// lock: they read the newest slot in place and check that its generation did not change while they were reading it.
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+#include "frameData.hpp"
+
+namespace cwc
+{
+    const std::uint32_t SHARED_RING_MAGIC = 0x52435743u; // "CWCR"
+    const std::uint32_t SHARED_RING_VERSION = 1;
+    const std::size_t SHARED_SLOT_FRAME_OFFSET = 64;
+    // Times SharedMemoryRingReader::readLatest tries to read a slot before giving up (e.g. a writer killed while it was
+    // filling the newest slot leaves its generation odd forever)
+    const auto SHARED_RING_READ_ATTEMPTS = 64;
+
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared-memory counters must be lock-free (address-free) atomics.");
+
+    struct SharedRingHeader
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t slotCount;
+        std::uint32_t slotSize;
+        std::uint32_t cropCapacity;     // Bytes reserved per crop in each slot
+        std::uint32_t reserved;
+        std::atomic<std::uint64_t> latestSequence; // 0 until the first frame is published
+        char padding[32];
+    };
+    static_assert(sizeof(SharedRingHeader) == 64, "SharedRingHeader must be 64 bytes.");
+
+    struct SharedFrame
+    {
+        std::uint64_t sequence;
+        std::uint64_t frameNumber;
+        float engaged;
+        std::uint32_t cropMask;         // Bit i set => crop i (CropRegion order) is valid
+        float keypoints[POSE_NUMBER_VALUES];
+        std::int32_t cropX[CROP_NUMBER_REGIONS];    // Decoded frame pixels (CropData::x), the keypoints are source pixels
+        std::int32_t cropY[CROP_NUMBER_REGIONS];
+        std::int32_t cropWidth[CROP_NUMBER_REGIONS];
+        std::int32_t cropHeight[CROP_NUMBER_REGIONS];
+        std::uint32_t cameraIndex;      // FrameData::cameraIndex (0 with a single camera)
+    };
+
+    // Rounds up to a cache line, so slots and crops never share one
+    inline std::size_t sharedRingAlign(const std::size_t size)
+    {
+        return (size + 63) & ~(std::size_t)63;
+    }
+
+    inline std::size_t sharedSlotCropsOffset()
+    {
+        return sharedRingAlign(SHARED_SLOT_FRAME_OFFSET + sizeof(SharedFrame));
+    }
+
+    class SharedMemoryRing
+    {
+    public:
+        ~SharedMemoryRing()
+        {
+            #ifndef _WIN32
+                if (pMemory != nullptr)
+                    munmap(pMemory, mSize);
+                if (mOwner)
+                    shm_unlink(mName.c_str());
+            #endif
+        }
+
+    protected:
+        const std::string mName;
+        const bool mOwner;
+        std::size_t mSize;
+        unsigned char* pMemory;
+
+        SharedMemoryRing(const std::string& name, const bool owner) :
+            mName{name},
+            mOwner{owner},
+            mSize{0},
+            pMemory{nullptr}
+        {}
+
+        void map(const int fd, const std::size_t size, const bool writable)
+        {
+            #ifndef _WIN32
+                void* const memory = mmap(nullptr, size, (writable ? PROT_READ | PROT_WRITE : PROT_READ), MAP_SHARED, fd, 0);
+                close(fd);
+                if (memory == MAP_FAILED)
+                    throw std::runtime_error{"Shared memory " + mName + " could not be mapped: " + std::strerror(errno)};
+                pMemory = (unsigned char*)memory;
+                mSize = size;
+            #else
+                (void)fd; (void)size; (void)writable;
+            #endif
+        }
+
+        SharedRingHeader& header() const
+        {
+            return *(SharedRingHeader*)pMemory;
+        }
+
+        unsigned char* slot(const std::uint64_t sequence) const
+        {
+            const auto& ringHeader = header();
+            return pMemory + sizeof(SharedRingHeader) + ((sequence - 1) % ringHeader.slotCount) * ringHeader.slotSize;
+        }
+
+        static std::atomic<std::uint64_t>& generation(unsigned char* const slot)
+        {
+            return *(std::atomic<std::uint64_t>*)slot;
+        }
+
+    private:
+        SharedMemoryRing(const SharedMemoryRing&) = delete;
+        SharedMemoryRing& operator=(const SharedMemoryRing&) = delete;
+    };
+
+    // Creates (and removes on destruction) the shared-memory object. Used by the wrapper output stage.
+    class SharedMemoryRingWriter : public SharedMemoryRing
+    {
+    public:
+        // name: POSIX shared-memory name, e.g. "/cwc_openpose". cropCapacity: max bytes of one crop (width x height x 3).
+        SharedMemoryRingWriter(const std::string& name, const unsigned int slotCount, const unsigned int cropCapacity) :
+            SharedMemoryRing{name, true},
+            mSequence{0ull}
+        {
+            #ifndef _WIN32
+                if (slotCount < 2)
+                    throw std::runtime_error{"The shared-memory ring needs at least 2 slots."};
+                const auto slotSize = sharedRingAlign(sharedSlotCropsOffset() + CROP_NUMBER_REGIONS * sharedRingAlign(cropCapacity));
+                const auto size = sizeof(SharedRingHeader) + slotCount * slotSize;
+                shm_unlink(name.c_str());
+                const auto fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+                if (fd < 0)
+                    throw std::runtime_error{"Shared memory " + name + " could not be created: " + std::strerror(errno)};
+                if (ftruncate(fd, (off_t)size) != 0)
+                {
+                    close(fd);
+                    throw std::runtime_error{"Shared memory " + name + " could not be resized: " + std::strerror(errno)};
+                }
+                map(fd, size, true);
+                // ftruncate zero-fills: every generation and latestSequence start at 0
+                auto& ringHeader = header();
+                ringHeader.version = SHARED_RING_VERSION;
+                ringHeader.slotCount = slotCount;
+                ringHeader.slotSize = (std::uint32_t)slotSize;
+                ringHeader.cropCapacity = sharedRingAlign(cropCapacity);
+                std::atomic_thread_fence(std::memory_order_release);
+                ringHeader.magic = SHARED_RING_MAGIC;
+            #else
+                (void)slotCount; (void)cropCapacity;
+                throw std::runtime_error{"The shared-memory ring is only implemented for POSIX systems."};
+            #endif
+        }
+
+        void write(const FrameData& frameData)
+        {
+            const auto sequence = ++mSequence;
+            auto* const slotPtr = slot(sequence);
+            auto& slotGeneration = generation(slotPtr);
+            const auto startGeneration = slotGeneration.load(std::memory_order_relaxed);
+            slotGeneration.store(startGeneration + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            auto& frame = *(SharedFrame*)(slotPtr + SHARED_SLOT_FRAME_OFFSET);
+            frame.sequence = sequence;
+            frame.frameNumber = frameData.frameNumber;
+            frame.cameraIndex = frameData.cameraIndex;
+            frame.engaged = frameData.engaged;
+            frame.cropMask = 0;
+            std::memcpy(frame.keypoints, frameData.keypoints.data(), sizeof(frame.keypoints));
+            const auto cropCapacity = header().cropCapacity;
+            for (auto region = 0 ; region < CROP_NUMBER_REGIONS ; region++)
+            {
+                const auto& crop = frameData.crops[region];
+                const auto cropSize = (std::uint32_t)(crop.width * crop.height * CROP_NUMBER_CHANNELS);
+                const auto fits = crop.visible && cropSize <= cropCapacity;
+                frame.cropX[region] = crop.x;
+                frame.cropY[region] = crop.y;
+                frame.cropWidth[region] = (fits ? crop.width : 0);
+                frame.cropHeight[region] = (fits ? crop.height : 0);
+                if (fits)
+                {
+                    frame.cropMask |= (1u << region);
+                    std::memcpy(slotPtr + sharedSlotCropsOffset() + region * cropCapacity, crop.pixels, cropSize);
+                }
+            }
+
+            slotGeneration.store(startGeneration + 2, std::memory_order_release);
+            header().latestSequence.store(sequence, std::memory_order_release);
+        }
+
+    private:
+        std::uint64_t mSequence;
+    };
+
+    // Consumer side: lock-free access to the newest frame
+    class SharedMemoryRingReader : public SharedMemoryRing
+    {
+    public:
+        // Zero-copy view of one slot. Only trust what you read from it if isValid(view) still returns true afterwards.
+        struct FrameView
+        {
+            const SharedFrame* frame;
+            const unsigned char* crops[CROP_NUMBER_REGIONS];
+            std::uint64_t generation;
+        };
+
+        explicit SharedMemoryRingReader(const std::string& name) :
+            SharedMemoryRing{name, false}
+        {
+            #ifndef _WIN32
+                const auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+                if (fd < 0)
+                    throw std::runtime_error{"Shared memory " + name + " could not be opened (is the wrapper running?): "
+                                             + std::strerror(errno)};
+                struct stat status;
+                if (fstat(fd, &status) != 0 || (std::size_t)status.st_size < sizeof(SharedRingHeader))
+                {
+                    close(fd);
+                    throw std::runtime_error{"Shared memory " + name + " is not initialized yet."};
+                }
+                map(fd, (std::size_t)status.st_size, false);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (header().magic != SHARED_RING_MAGIC || header().version != SHARED_RING_VERSION)
+                    throw std::runtime_error{"Shared memory " + name + " is not a CwC frame ring (or a different version)."};
+                // The slots must fit in their size and in the object (a truncated or mismatched one would be read out of
+                // bounds)
+                const auto& ringHeader = header();
+                if (ringHeader.slotCount == 0
+                    || (std::uint64_t)ringHeader.slotSize < (std::uint64_t)sharedSlotCropsOffset()
+                                                            + (std::uint64_t)CROP_NUMBER_REGIONS * ringHeader.cropCapacity
+                    || (std::uint64_t)sizeof(SharedRingHeader) + (std::uint64_t)ringHeader.slotCount * ringHeader.slotSize
+                       > (std::uint64_t)status.st_size)
+                    throw std::runtime_error{"Shared memory " + name + " is smaller than the slots its header describes."};
+            #else
+                throw std::runtime_error{"The shared-memory ring is only implemented for POSIX systems."};
+            #endif
+        }
+
+        // Sequence number of the newest complete frame, 0 if none. Compare it to the last one read to detect new frames.
+        std::uint64_t latestSequence() const
+        {
+            return header().latestSequence.load(std::memory_order_acquire);
+        }
+
+        std::uint32_t cropCapacity() const
+        {
+            return header().cropCapacity;
+        }
+
+        // False if there is no frame yet or the writer is overwriting the newest slot right now (simply retry)
+        bool viewLatest(FrameView& view) const
+        {
+            const auto sequence = latestSequence();
+            if (sequence == 0)
+                return false;
+            auto* const slotPtr = slot(sequence);
+            view.generation = generation(slotPtr).load(std::memory_order_acquire);
+            if (view.generation & 1)
+                return false;
+            view.frame = (const SharedFrame*)(slotPtr + SHARED_SLOT_FRAME_OFFSET);
+            for (auto region = 0 ; region < CROP_NUMBER_REGIONS ; region++)
+                view.crops[region] = slotPtr + sharedSlotCropsOffset() + region * header().cropCapacity;
+            return true;
+        }
+
+        bool isValid(const FrameView& view) const
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            auto* const slotPtr = (unsigned char*)view.frame - SHARED_SLOT_FRAME_OFFSET;
+            return generation(slotPtr).load(std::memory_order_relaxed) == view.generation;
+        }
+
+        // Copying version of viewLatest() + isValid(). crops (optional) receives the CROP_NUMBER_REGIONS crops, each at
+        // region * cropCapacity(). Returns false if no frame was published yet, or if no consistent copy could be read in
+        // SHARED_RING_READ_ATTEMPTS attempts (simply retry later).
+        bool readLatest(SharedFrame& frame, std::vector<unsigned char>* crops = nullptr) const
+        {
+            FrameView view;
+            for (auto attempt = 0 ; attempt < SHARED_RING_READ_ATTEMPTS ; attempt++)
+            {
+                if (!viewLatest(view))
+                {
+                    if (latestSequence() == 0)
+                        return false;
+                    continue;
+                }
+                std::memcpy(&frame, view.frame, sizeof(frame));
+                if (crops != nullptr)
+                {
+                    crops->resize(CROP_NUMBER_REGIONS * header().cropCapacity);
+                    std::memcpy(crops->data(), view.crops[0], crops->size());
+                }
+                if (isValid(view))
+                    return true;
+            }
+            return false;
+        }
+    };
+}
+
+#endif // CWC_SHARED_MEMORY_RING_HPP
@@ -0,0 +1,706 @@
+#ifndef CWC_STREAM_PACKETS_HPP
+#define CWC_STREAM_PACKETS_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "frameData.hpp"
+
+namespace cwc
+{
+    // Stream ids a client sends (int32, little endian) right after connecting, as in openpose_server_01.1.py. Each one is a
+    // distinct bit (see StreamServer::getSubscribedStreams).
+    enum class StreamId : int
+    {
+        ClosestBody = 512,
+        HandColorLH = 1024,
+        HandColorRH = 2048,
+        HeadColor = 4096,
+        AllBodies = 8192,   // Not served by openpose_server_01.1.py (its text input only has the closest body)
+    };
+
+    inline bool isValidStreamId(const int streamId)
+    {
+        return streamId == (int)StreamId::ClosestBody || streamId == (int)StreamId::HandColorLH
+            || streamId == (int)StreamId::HandColorRH || streamId == (int)StreamId::HeadColor
+            || streamId == (int)StreamId::AllBodies;
+    }
+
+    // Names used by the Python scripts (stream_id_dict) and in the flags
+    inline std::string getStreamName(const StreamId streamId)
+    {
+        switch (streamId)
+        {
+            case StreamId::ClosestBody:
+                return "ClosestBody";
+            case StreamId::HandColorLH:
+                return "HandColorLH";
+            case StreamId::HandColorRH:
+                return "HandColorRH";
+            case StreamId::HeadColor:
+                return "HeadColor";
+            case StreamId::AllBodies:
+                return "AllBodies";
+            default:
+                return std::to_string((int)streamId);
+        }
+    }
+
+    // Accepts the stream name or its numeric id. Returns false if it is neither.
+    inline bool streamIdFromName(const std::string& name, StreamId& streamId)
+    {
+        for (const auto candidate : {StreamId::ClosestBody, StreamId::HandColorLH, StreamId::HandColorRH, StreamId::HeadColor,
+                                     StreamId::AllBodies})
+        {
+            if (name == getStreamName(candidate) || name == std::to_string((int)candidate))
+            {
+                streamId = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Extended handshake. A client that wants options sends, instead of the plain 4-byte stream id:
+    //     int32 (streamId | STREAM_OPTIONS_FLAG) | uint16 options size | options (ASCII "key=value;key=value")
+    // Options (unknown keys are ignored, so older servers/clients stay compatible):
+    //     encoding=uint16|raw|png|jpeg|tensor  HandColor/HeadColor payload (default uint16, the original layout)
+    //     quality=1..100                   JPEG quality (default 90)
+    //     keypoints=float|compact          ClosestBody keypoints as 55 float32 (default) or as FrameData::compactKeypoints
+    //     batch_frames=1..1000             Send the packets in batches of up to N frames (default 1, no batching)
+    //     batch_ms=0..10000                ... and flush a batch after T ms even if it is not full (default 0, no timeout)
+    //     trace=0|1                        Prefix every packet with its frame trace (default 0, see makeTracedPacket)
+    //     people=closest|all               HandColor/HeadColor crop of the engaged person (default) or of every person in
+    //                                      one raw NHWC block (see makeCropBatchPacket, only with encoding uint16 or raw)
+    //     unchanged=0|1                    HandColor/HeadColor: send a short packet instead of a crop that did not change
+    //                                      (see makeUnchangedPacket, not with people=all)
+    //     track=0|1                        Prefix every packet with the track id of the person it is about (default 0, see
+    //                                      makeTrackedPacket)
+    //     predict=0..1000                  ClosestBody keypoints extrapolated this many ms past the capture time, e.g. the
+    //                                      client's latency (default 0, none, see makePredictedClosestBodyPacket; not with
+    //                                      keypoints=compact)
+    //     camera=0..15|all                 Frames of that camera only (default 0, the only one without -cameras), or of
+    //                                      every camera, each packet prefixed with its camera index (see makeCameraPacket).
+    //                                      A stream takes one client per camera.
+    // With batch_frames > 1 or batch_ms > 0, every packet is a batch: '<iH' load size | frame count, followed by the usual
+    // packets (each with its own '<i' load size) of those frames.
+    const std::int32_t STREAM_OPTIONS_FLAG = 0x40000000;
+    const std::size_t STREAM_OPTIONS_MAX_SIZE = 1024;
+    const auto STREAM_BATCH_MAX_FRAMES = 1000;
+    const auto STREAM_BATCH_MAX_MILLISECONDS = 10000;
+    const auto STREAM_PREDICT_MAX_MILLISECONDS = 1000;
+    const auto STREAM_MAX_CAMERAS = 16;
+    // StreamOptions::camera of the camera=all clients
+    const auto STREAM_ALL_CAMERAS = -1;
+
+    enum class CropEncoding : unsigned char
+    {
+        Uint16 = 0, // One uint16 per BGR value, as sent by openpose_server_01.1.py
+        Raw,        // One uint8 per BGR value
+        Png,        // cv::imencode(".png") of the BGR crop
+        Jpeg,       // cv::imencode(".jpg") of the BGR crop
+        Tensor,     // FrameData::tensors, float32 normalized planes (see makeTensorPacket)
+    };
+
+    struct StreamOptions
+    {
+        CropEncoding encoding;
+        int quality;
+        bool compactKeypoints;
+        int batchFrames;
+        int batchMilliseconds;
+        bool trace;
+        bool allPeople;
+        bool skipUnchanged;
+        bool tracked;
+        int predictMilliseconds;
+        int camera;     // FrameData::cameraIndex sent, or STREAM_ALL_CAMERAS
+
+        StreamOptions() :
+            encoding{CropEncoding::Uint16}, quality{90}, compactKeypoints{false}, batchFrames{1}, batchMilliseconds{0},
+            trace{false}, allPeople{false}, skipUnchanged{false}, tracked{false}, predictMilliseconds{0}, camera{0}
+        {}
+    };
+
+    // Whether a client with these options receives the frames of camera cameraIndex
+    inline bool isCameraSent(const StreamOptions& options, const unsigned int cameraIndex)
+    {
+        return options.camera == STREAM_ALL_CAMERAS || options.camera == (int)cameraIndex;
+    }
+
+    inline bool isBatched(const StreamOptions& options)
+    {
+        return options.batchFrames > 1 || options.batchMilliseconds > 0;
+    }
+
+    inline bool isCompressed(const CropEncoding encoding)
+    {
+        return encoding == CropEncoding::Png || encoding == CropEncoding::Jpeg;
+    }
+
+    // E.g. ", jpeg, quality 80, batches of 10 frames / 100 ms" (empty for a plain ClosestBody stream)
+    inline std::string getStreamOptionsDescription(const int streamId, const StreamOptions& options)
+    {
+        std::string description;
+        if (streamId == (int)StreamId::ClosestBody && options.compactKeypoints)
+            description = ", compact keypoints";
+        else if (streamId == (int)StreamId::ClosestBody && options.predictMilliseconds > 0)
+            description = ", predicted " + std::to_string(options.predictMilliseconds) + " ms ahead";
+        else if (streamId != (int)StreamId::ClosestBody && streamId != (int)StreamId::AllBodies && options.allPeople)
+            description = ", all people";
+        else if (streamId != (int)StreamId::ClosestBody && streamId != (int)StreamId::AllBodies)
+        {
+            switch (options.encoding)
+            {
+                case CropEncoding::Raw:
+                    description = ", raw";
+                    break;
+                case CropEncoding::Png:
+                    description = ", png";
+                    break;
+                case CropEncoding::Jpeg:
+                    description = ", jpeg, quality " + std::to_string(options.quality);
+                    break;
+                case CropEncoding::Tensor:
+                    description = ", tensor";
+                    break;
+                default:
+                    description = ", uint16";
+            }
+        }
+        if (options.skipUnchanged)
+            description += ", unchanged crops skipped";
+        if (isBatched(options))
+            description += ", batches of " + std::to_string(options.batchFrames) + " frames / "
+                         + std::to_string(options.batchMilliseconds) + " ms";
+        if (options.tracked)
+            description += ", tracked";
+        if (options.camera == STREAM_ALL_CAMERAS)
+            description += ", all cameras";
+        else if (options.camera > 0)
+            description += ", camera " + std::to_string(options.camera);
+        if (options.trace)
+            description += ", traced";
+        return description;
+    }
+
+    // Number of handshake bytes needed given the ones received so far (they are complete when it returns
+    // handshake.size()). Returns 0 if the handshake is invalid.
+    inline std::size_t getHandshakeSize(const std::string& handshake)
+    {
+        if (handshake.size() < sizeof(std::int32_t))
+            return sizeof(std::int32_t);
+        std::int32_t streamId;
+        std::memcpy(&streamId, handshake.data(), sizeof(streamId));
+        if (!(streamId & STREAM_OPTIONS_FLAG))
+            return sizeof(std::int32_t);
+        const auto headerSize = sizeof(std::int32_t) + sizeof(std::uint16_t);
+        if (handshake.size() < headerSize)
+            return headerSize;
+        std::uint16_t optionsSize;
+        std::memcpy(&optionsSize, handshake.data() + sizeof(std::int32_t), sizeof(optionsSize));
+        return (optionsSize <= STREAM_OPTIONS_MAX_SIZE ? headerSize + optionsSize : 0);
+    }
+
+    // Parses a complete handshake. Returns false (and the reason in errorMessage) if it is invalid.
+    inline bool parseHandshake(const std::string& handshake, int& streamId, StreamOptions& options, std::string& errorMessage)
+    {
+        std::int32_t rawStreamId;
+        std::memcpy(&rawStreamId, handshake.data(), sizeof(rawStreamId));
+        streamId = (rawStreamId & ~STREAM_OPTIONS_FLAG);
+        options = StreamOptions{};
+        const auto headerSize = sizeof(std::int32_t) + sizeof(std::uint16_t);
+        const auto text = (handshake.size() > headerSize ? handshake.substr(headerSize) : std::string{});
+        std::size_t begin = 0;
+        while (begin < text.size())
+        {
+            auto end = text.find(';', begin);
+            if (end == std::string::npos)
+                end = text.size();
+            const auto entry = text.substr(begin, end - begin);
+            begin = end + 1;
+            const auto equal = entry.find('=');
+            if (equal == std::string::npos)
+                continue;
+            const auto key = entry.substr(0, equal);
+            const auto value = entry.substr(equal + 1);
+            if (key == "encoding")
+            {
+                if (value == "uint16")
+                    options.encoding = CropEncoding::Uint16;
+                else if (value == "raw")
+                    options.encoding = CropEncoding::Raw;
+                else if (value == "png")
+                    options.encoding = CropEncoding::Png;
+                else if (value == "jpeg" || value == "jpg")
+                    options.encoding = CropEncoding::Jpeg;
+                else if (value == "tensor")
+                    options.encoding = CropEncoding::Tensor;
+                else
+                {
+                    errorMessage = "unknown encoding " + value;
+                    return false;
+                }
+            }
+            else if (key == "quality")
+            {
+                options.quality = std::atoi(value.c_str());
+                if (options.quality < 1 || options.quality > 100)
+                {
+                    errorMessage = "JPEG quality must be in [1, 100]";
+                    return false;
+                }
+            }
+            else if (key == "keypoints")
+            {
+                if (value != "float" && value != "compact")
+                {
+                    errorMessage = "unknown keypoint format " + value;
+                    return false;
+                }
+                options.compactKeypoints = (value == "compact");
+            }
+            else if (key == "batch_frames")
+            {
+                options.batchFrames = std::atoi(value.c_str());
+                if (options.batchFrames < 1 || options.batchFrames > STREAM_BATCH_MAX_FRAMES)
+                {
+                    errorMessage = "batch_frames must be in [1, " + std::to_string(STREAM_BATCH_MAX_FRAMES) + "]";
+                    return false;
+                }
+            }
+            else if (key == "batch_ms")
+            {
+                options.batchMilliseconds = std::atoi(value.c_str());
+                if (options.batchMilliseconds < 0 || options.batchMilliseconds > STREAM_BATCH_MAX_MILLISECONDS)
+                {
+                    errorMessage = "batch_ms must be in [0, " + std::to_string(STREAM_BATCH_MAX_MILLISECONDS) + "]";
+                    return false;
+                }
+            }
+            else if (key == "trace")
+            {
+                if (value != "0" && value != "1")
+                {
+                    errorMessage = "trace must be 0 or 1";
+                    return false;
+                }
+                options.trace = (value == "1");
+            }
+            else if (key == "people")
+            {
+                if (value != "closest" && value != "all")
+                {
+                    errorMessage = "people must be closest or all";
+                    return false;
+                }
+                options.allPeople = (value == "all");
+            }
+            else if (key == "unchanged")
+            {
+                if (value != "0" && value != "1")
+                {
+                    errorMessage = "unchanged must be 0 or 1";
+                    return false;
+                }
+                options.skipUnchanged = (value == "1");
+            }
+            else if (key == "track")
+            {
+                if (value != "0" && value != "1")
+                {
+                    errorMessage = "track must be 0 or 1";
+                    return false;
+                }
+                options.tracked = (value == "1");
+            }
+            else if (key == "predict")
+            {
+                options.predictMilliseconds = std::atoi(value.c_str());
+                if (options.predictMilliseconds < 0 || options.predictMilliseconds > STREAM_PREDICT_MAX_MILLISECONDS)
+                {
+                    errorMessage = "predict must be in [0, " + std::to_string(STREAM_PREDICT_MAX_MILLISECONDS) + "]";
+                    return false;
+                }
+            }
+            else if (key == "camera")
+            {
+                options.camera = (value == "all" ? STREAM_ALL_CAMERAS : std::atoi(value.c_str()));
+                if (value != "all" && (options.camera < 0 || options.camera >= STREAM_MAX_CAMERAS))
+                {
+                    errorMessage = "camera must be all or in [0, " + std::to_string(STREAM_MAX_CAMERAS - 1) + "]";
+                    return false;
+                }
+            }
+        }
+        if (streamId == (int)StreamId::ClosestBody || streamId == (int)StreamId::AllBodies)
+        {
+            options.encoding = CropEncoding::Uint16;
+            options.allPeople = false;
+            options.skipUnchanged = false;
+        }
+        else if (options.allPeople)
+        {
+            if (options.encoding != CropEncoding::Uint16 && options.encoding != CropEncoding::Raw)
+            {
+                errorMessage = "people=all only sends raw crops";
+                return false;
+            }
+            if (options.skipUnchanged)
+            {
+                errorMessage = "unchanged=1 does not work with people=all";
+                return false;
+            }
+            options.encoding = CropEncoding::Raw;
+        }
+        if (streamId != (int)StreamId::ClosestBody)
+        {
+            options.compactKeypoints = false;
+            options.predictMilliseconds = 0;
+        }
+        else if (options.compactKeypoints && options.predictMilliseconds > 0)
+        {
+            errorMessage = "predict does not work with keypoints=compact";
+            return false;
+        }
+        return true;
+    }
+
+    // The 'q' timestamp of every packet is the capture time of its frame in wall-clock milliseconds (Unix epoch), the same
+    // for every stream of the frame (openpose_server_01.1.py sends the time it read the frame, also in ms). The monotonic
+    // stage times and the sequence number stay opt-in (trace=1, see makeTracedPacket), so the packet layouts do not change.
+    // Crop size announced in HandColor/HeadColor packets when the region is unknown (all-zero pixels)
+    const auto COLOR_PACKET_WIDTH = 64;
+    const auto COLOR_PACKET_HEIGHT = 64;
+    // Value the Python server always sent as "tracked body count"
+    const auto CLOSEST_BODY_TRACKED_COUNT = 100;
+
+    // One serialized packet, shared by every client of the same stream
+    typedef std::shared_ptr<const std::vector<char>> Packet;
+
+    // Packets are little endian (as the Python struct formats '<...'), i.e. the host byte order of our x86 machines
+    template<typename T>
+    inline void appendValue(std::vector<char>& buffer, const T value)
+    {
+        const auto* const bytes = (const char*)&value;
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    // '<iqhH55f': load size | timestamp | frame type (512) | tracked body count | engaged | 18 x (x, y, score)
+    inline Packet makeClosestBodyPacket(const FrameData& frameData, const std::int64_t timestamp)
+    {
+        const auto loadSize = (std::int32_t)(sizeof(std::int64_t) + 2*sizeof(std::uint16_t) + sizeof(float)
+                                             + sizeof(frameData.keypoints));
+        auto packet = std::make_shared<std::vector<char>>();
+        packet->reserve(sizeof(loadSize) + loadSize);
+        appendValue(*packet, loadSize);
+        appendValue(*packet, timestamp);
+        appendValue(*packet, (std::int16_t)StreamId::ClosestBody);
+        appendValue(*packet, (std::uint16_t)CLOSEST_BODY_TRACKED_COUNT);
+        appendValue(*packet, frameData.engaged);
+        const auto* const keypoints = (const char*)frameData.keypoints.data();
+        packet->insert(packet->end(), keypoints, keypoints + sizeof(frameData.keypoints));
+        return packet;
+    }
+
+    // Option predict: '<iqhH55fI' ClosestBody packet with the keypoints extrapolated leadMilliseconds past the capture time
+    // (FrameData::keypointVelocities), followed by the bit (1 << keypoint) of the keypoints that were (the others, e.g. not
+    // found or seen in a single frame, are as detected). The scores are as detected.
+    inline Packet makePredictedClosestBodyPacket(const FrameData& frameData, const std::int64_t timestamp,
+                                                 const int leadMilliseconds)
+    {
+        auto keypoints = frameData.keypoints;
+        auto predictedKeypoints = 0u;
+        const auto lead = leadMilliseconds * 1e-3f;
+        for (auto bodyPart = 0 ; bodyPart < POSE_NUMBER_KEYPOINTS ; bodyPart++)
+        {
+            auto* const keypoint = &keypoints[bodyPart*POSE_VALUES_PER_KEYPOINT];
+            if (!(frameData.predictableKeypoints & (1u << bodyPart)) || keypoint[2] <= 0.f)
+                continue;
+            keypoint[0] += lead * frameData.keypointVelocities[bodyPart*2];
+            keypoint[1] += lead * frameData.keypointVelocities[bodyPart*2 + 1];
+            predictedKeypoints |= 1u << bodyPart;
+        }
+        const auto loadSize = (std::int32_t)(sizeof(std::int64_t) + 2*sizeof(std::uint16_t) + sizeof(float)
+                                             + sizeof(keypoints) + sizeof(std::uint32_t));
+        auto packet = std::make_shared<std::vector<char>>();
+        packet->reserve(sizeof(loadSize) + loadSize);
+        appendValue(*packet, loadSize);
+        appendValue(*packet, timestamp);
+        appendValue(*packet, (std::int16_t)StreamId::ClosestBody);
+        appendValue(*packet, (std::uint16_t)CLOSEST_BODY_TRACKED_COUNT);
+        appendValue(*packet, frameData.engaged);
+        packet->insert(packet->end(), (const char*)keypoints.data(), (const char*)keypoints.data() + sizeof(keypoints));
+        appendValue(*packet, (std::uint32_t)predictedKeypoints);
+        return packet;
+    }
+
+    // '<iqhH' + count x '<IfffB54f': load size | timestamp | frame type (8192) | person count, then for each person:
+    // index | centroid x | centroid y | average limb length | flags (PERSON_*_FLAG) | 18 x (x, y, score)
+    inline Packet makeAllBodiesPacket(const FrameData& frameData, const std::int64_t timestamp)
+    {
+        const auto personSize = sizeof(std::uint32_t) + 3*sizeof(float) + sizeof(std::uint8_t) + sizeof(float)*POSE_NUMBER_VALUES;
+        const auto loadSize = (std::int32_t)(sizeof(std::int64_t) + sizeof(std::int16_t) + sizeof(std::uint16_t)
+                                             + frameData.people.size() * personSize);
+        auto packet = std::make_shared<std::vector<char>>();
+        packet->reserve(sizeof(loadSize) + loadSize);
+        appendValue(*packet, loadSize);
+        appendValue(*packet, timestamp);
+        appendValue(*packet, (std::int16_t)StreamId::AllBodies);
+        appendValue(*packet, (std::uint16_t)frameData.people.size());
+        for (const auto& person : frameData.people)
+        {
+            appendValue(*packet, (std::uint32_t)person.index);
+            appendValue(*packet, person.centroidX);
+            appendValue(*packet, person.centroidY);
+            appendValue(*packet, person.averageLimbLength);
+            appendValue(*packet, (std::uint8_t)person.flags);
+            const auto* const keypoints = (const char*)person.keypoints.data();
+            packet->insert(packet->end(), keypoints, keypoints + sizeof(person.keypoints));
+        }
+        return packet;
+    }
+
+    // '<iqh' + compact keypoints: load size | timestamp | frame type (512) | FrameData::compactKeypoints
+    inline Packet makeCompactClosestBodyPacket(const FrameData& frameData, const std::int64_t timestamp)
+    {
+        const auto loadSize = (std::int32_t)(sizeof(std::int64_t) + sizeof(std::int16_t) + frameData.compactKeypoints.size());
+        auto packet = std::make_shared<std::vector<char>>();
+        packet->reserve(sizeof(loadSize) + loadSize);
+        appendValue(*packet, loadSize);
+        appendValue(*packet, timestamp);
+        appendValue(*packet, (std::int16_t)StreamId::ClosestBody);
+        packet->insert(packet->end(), frameData.compactKeypoints.begin(), frameData.compactKeypoints.end());
+        return packet;
+    }
+
+    // '<iqiHH' header of the color packets: load size | timestamp | frame type | width | height
+    inline std::shared_ptr<std::vector<char>> makeColorPacketHeader(const std::int32_t frameType, const int width,
+                                                                    const int height, const std::size_t payloadSize,
+                                                                    const std::int64_t timestamp)
+    {
+        const auto loadSize = (std::int32_t)(sizeof(std::int64_t) + sizeof(std::int32_t) + 2*sizeof(std::uint16_t)
+                                             + payloadSize);
+        auto packet = std::make_shared<std::vector<char>>();
+        packet->reserve(sizeof(loadSize) + loadSize);
+        appendValue(*packet, loadSize);
+        appendValue(*packet, timestamp);
+        appendValue(*packet, frameType);
+        appendValue(*packet, (std::uint16_t)width);
+        appendValue(*packet, (std::uint16_t)height);
+        return packet;
+    }
+
+    // Header + w*h*3 'H' (CropEncoding::Uint16) or 'B' (CropEncoding::Raw) BGR values.
+    // frameType is 0 for the left hand, 1 for the right hand and 4096 for the head (as in openpose_server_01.1.py).
+    // An unknown region is sent as 64x64 zeros in Uint16 (as the Python server did) and as 0x0 without payload otherwise.
+    // So is a crop without pixels (an unchanged crop that was not extracted, see CropData::unchanged).
+    inline Packet makeColorPacket(const CropData& crop, const std::int32_t frameType, const std::int64_t timestamp,
+                                  const CropEncoding encoding = CropEncoding::Uint16)
+    {
+        const auto visible = (crop.visible && crop.pixels != nullptr);
+        if (encoding == CropEncoding::Raw)
+        {
+            const auto numberValues = (visible ? crop.width * crop.height * CROP_NUMBER_CHANNELS : 0);
+            auto packet = makeColorPacketHeader(frameType, (visible ? crop.width : 0), (visible ? crop.height : 0),
+                                                numberValues, timestamp);
+            if (visible)
+                packet->insert(packet->end(), (const char*)crop.pixels, (const char*)crop.pixels + numberValues);
+            return packet;
+        }
+        const auto width = (visible ? crop.width : COLOR_PACKET_WIDTH);
+        const auto height = (visible ? crop.height : COLOR_PACKET_HEIGHT);
+        const auto numberValues = width * height * CROP_NUMBER_CHANNELS;
+        auto packet = makeColorPacketHeader(frameType, width, height, numberValues * sizeof(std::uint16_t), timestamp);
+        const auto headerSize = packet->size();
+        packet->resize(headerSize + numberValues * sizeof(std::uint16_t), 0);
+        if (visible)
+        {
+            auto* const pixels = &(*packet)[headerSize];
+            for (auto i = 0 ; i < numberValues ; i++)
+            {
+                const auto value = (std::uint16_t)crop.pixels[i];
+                std::memcpy(pixels + i*sizeof(value), &value, sizeof(value));
+            }
+        }
+        return packet;
+    }
+
+    // Header (width = height = tensor size) + 3 x size x size float32 (CropEncoding::Tensor): the B, G and R planes of
+    // the crop resampled and normalized by CropTensorizer, ready for the classifiers. 0x0 without payload if the region is
+    // unknown.
+    inline Packet makeTensorPacket(const CropTensor& tensor, const std::int32_t frameType, const std::int64_t timestamp)
+    {
+        const auto size = (tensor.valid ? tensor.size : 0);
+        const auto payloadSize = CROP_NUMBER_CHANNELS * size * size * sizeof(float);
+        auto packet = makeColorPacketHeader(frameType, size, size, payloadSize, timestamp);
+        if (tensor.valid)
+            packet->insert(packet->end(), (const char*)tensor.values, (const char*)tensor.values + payloadSize);
+        return packet;
+    }
+
+    // Option people=all: '<iqiHHH' + count x '<IB' + count x h x w x 3 'B': load size | timestamp | frame type | person
+    // count | width | height, then for each person: index (as in AllBodies) | visible, then the crops of every person as
+    // one NHWC BGR block (zeros for the people whose region is unknown)
+    inline Packet makeCropBatchPacket(const CropBatch& batch, const std::int32_t frameType, const std::int64_t timestamp)
+    {
+        const auto cropBytes = (std::size_t)(batch.width * batch.height * CROP_NUMBER_CHANNELS);
+        const auto loadSize = (std::int32_t)(sizeof(std::int64_t) + sizeof(std::int32_t) + 3*sizeof(std::uint16_t)
+                                             + batch.count * (sizeof(std::uint32_t) + sizeof(std::uint8_t) + cropBytes));
+        auto packet = std::make_shared<std::vector<char>>();
+        packet->reserve(sizeof(loadSize) + loadSize);
+        appendValue(*packet, loadSize);
+        appendValue(*packet, timestamp);
+        appendValue(*packet, frameType);
+        appendValue(*packet, (std::uint16_t)batch.count);
+        appendValue(*packet, (std::uint16_t)batch.width);
+        appendValue(*packet, (std::uint16_t)batch.height);
+        for (auto person = 0 ; person < batch.count ; person++)
+        {
+            appendValue(*packet, (std::uint32_t)batch.personIndices[person]);
+            appendValue(*packet, (std::uint8_t)batch.visible[person]);
+        }
+        if (batch.count > 0)
+            packet->insert(packet->end(), (const char*)batch.pixels, (const char*)batch.pixels + batch.count * cropBytes);
+        return packet;
+    }
+
+    // Option unchanged=1, crop that did not change: header with 0x0 (as the unknown regions) and a '<Q' payload, the frame
+    // number of the crop it is the same as (as in makeSequencedPacket). The unknown regions have no payload, or 64x64.
+    inline Packet makeUnchangedPacket(const std::int32_t frameType, const unsigned long long sameAs,
+                                      const std::int64_t timestamp)
+    {
+        auto packet = makeColorPacketHeader(frameType, 0, 0, sizeof(std::uint64_t), timestamp);
+        appendValue(*packet, (std::uint64_t)sameAs);
+        return packet;
+    }
+
+    // Option unchanged=1: '<Q' FrameData::frameNumber in front of every packet, so the client knows which crop an
+    // unchanged packet refers to. A crop is resent at least every `crop_unchanged_refresh` frames, so a client that missed
+    // the referenced crop (e.g. dropped from its queue) only waits for that.
+    inline Packet makeSequencedPacket(const Packet& packet, const unsigned long long frameNumber)
+    {
+        auto sequencedPacket = std::make_shared<std::vector<char>>();
+        sequencedPacket->reserve(sizeof(std::uint64_t) + packet->size());
+        appendValue(*sequencedPacket, (std::uint64_t)frameNumber);
+        sequencedPacket->insert(sequencedPacket->end(), packet->begin(), packet->end());
+        return sequencedPacket;
+    }
+
+    // Option track=1: '<I' FrameData::trackId in front of every packet (inside the trace), the PersonTracker id of the
+    // person whose keypoints/crops it carries (PERSON_NO_TRACK, 0xFFFFFFFF, if nobody is detected). With people=all and
+    // AllBodies, the id of every person is already in the packet: it is still the engaged (sent) person.
+    inline Packet makeTrackedPacket(const Packet& packet, const unsigned int trackId)
+    {
+        auto trackedPacket = std::make_shared<std::vector<char>>();
+        trackedPacket->reserve(sizeof(std::uint32_t) + packet->size());
+        appendValue(*trackedPacket, (std::uint32_t)trackId);
+        trackedPacket->insert(trackedPacket->end(), packet->begin(), packet->end());
+        return trackedPacket;
+    }
+
+    // Option camera=all: '<I' FrameData::cameraIndex in front of every packet (inside the trace, outside the track id),
+    // the camera whose frame it is about. The frames of one synchronized set share their trace sequence. Compact keypoints
+    // and unchanged crops refer to earlier frames of the same camera.
+    inline Packet makeCameraPacket(const Packet& packet, const unsigned int cameraIndex)
+    {
+        auto cameraPacket = std::make_shared<std::vector<char>>();
+        cameraPacket->reserve(sizeof(std::uint32_t) + packet->size());
+        appendValue(*cameraPacket, (std::uint32_t)cameraIndex);
+        cameraPacket->insert(cameraPacket->end(), packet->begin(), packet->end());
+        return cameraPacket;
+    }
+
+    // Option trace=1: '<Q6q' sequence | TraceStage times (monotonic ns, 0 if not reached) in front of the usual packet.
+    // The Serialized time is the moment this packet was built (the encoder thread builds the PNG/JPEG ones), so
+    // receiveTime - trace.getCaptureTime() is the glass-to-client latency on the same machine.
+    inline Packet makeTracedPacket(const Packet& packet, const FrameTrace& trace)
+    {
+        auto tracedPacket = std::make_shared<std::vector<char>>();
+        tracedPacket->reserve(sizeof(std::uint64_t) + sizeof(trace.stageTimes) + packet->size());
+        appendValue(*tracedPacket, (std::uint64_t)trace.sequence);
+        auto stageTimes = trace.stageTimes;
+        stageTimes[(int)TraceStage::Serialized] = getMonotonicNanoseconds();
+        for (const auto stageTime : stageTimes)
+            appendValue(*tracedPacket, stageTime);
+        tracedPacket->insert(tracedPacket->end(), packet->begin(), packet->end());
+        return tracedPacket;
+    }
+
+    // Crop region and frame type sent by each color stream. Returns false for ClosestBody and AllBodies.
+    inline bool getColorStreamRegion(const StreamId streamId, CropRegion& region, std::int32_t& frameType)
+    {
+        switch (streamId)
+        {
+            case StreamId::HandColorLH:
+                region = CropRegion::LeftHand;
+                frameType = 0;
+                return true;
+            case StreamId::HandColorRH:
+                region = CropRegion::RightHand;
+                frameType = 1;
+                return true;
+            case StreamId::HeadColor:
+                region = CropRegion::Head;
+                frameType = (std::int32_t)StreamId::HeadColor;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Bit (1 << CropRegion) of every region cut by the color streams in subscribedStreams (see
+    // StreamServer::getSubscribedStreams)
+    inline int getSubscribedRegions(const int subscribedStreams)
+    {
+        auto regions = 0;
+        for (const auto streamId : {StreamId::HandColorLH, StreamId::HandColorRH, StreamId::HeadColor})
+        {
+            CropRegion region;
+            std::int32_t frameType;
+            if ((subscribedStreams & (int)streamId) && getColorStreamRegion(streamId, region, frameType))
+                regions |= 1 << (int)region;
+        }
+        return regions;
+    }
+
+    // Compressed encodings are built by the StreamServer encoder thread instead (see cropEncoder.hpp)
+    inline Packet makeStreamPacket(const StreamId streamId, const FrameData& frameData, const std::int64_t timestamp,
+                                   const StreamOptions& options = StreamOptions{})
+    {
+        if (streamId == StreamId::ClosestBody)
+        {
+            if (options.compactKeypoints)
+                return makeCompactClosestBodyPacket(frameData, timestamp);
+            return (options.predictMilliseconds > 0
+                    ? makePredictedClosestBodyPacket(frameData, timestamp, options.predictMilliseconds)
+                    : makeClosestBodyPacket(frameData, timestamp));
+        }
+        if (streamId == StreamId::AllBodies)
+            return makeAllBodiesPacket(frameData, timestamp);
+        CropRegion region;
+        std::int32_t frameType;
+        if (!getColorStreamRegion(streamId, region, frameType))
+            return nullptr;
+        if (options.allPeople)
+            return makeCropBatchPacket(frameData.cropBatches[(int)region], frameType, timestamp);
+        const auto& crop = frameData.crops[(int)region];
+        if (options.skipUnchanged)
+        {
+            auto innerOptions = options;
+            innerOptions.skipUnchanged = false;
+            return makeSequencedPacket((crop.visible && crop.unchanged
+                                        ? makeUnchangedPacket(frameType, crop.sameAs, timestamp)
+                                        : makeStreamPacket(streamId, frameData, timestamp, innerOptions)),
+                                       frameData.frameNumber);
+        }
+        if (options.encoding == CropEncoding::Tensor)
+            return makeTensorPacket(frameData.tensors[(int)region], frameType, timestamp);
+        return makeColorPacket(crop, frameType, timestamp, options.encoding);
+    }
+}
+
+#endif // CWC_STREAM_PACKETS_HPP
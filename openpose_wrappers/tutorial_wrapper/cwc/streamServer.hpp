@@ -0,0 +1,902 @@
+#ifndef CWC_STREAM_SERVER_HPP
+#define CWC_STREAM_SERVER_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#ifdef __linux__
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+#include <openpose/headers.hpp>
+#include "cropEncoder.hpp"
+#include "streamPackets.hpp"
+
+namespace cwc
+{
+    // What publish() does when a client's send queue is full
+    enum class QueuePolicy : unsigned char
+    {
+        DropOldest = 0, // Discard the oldest queued frame (default)
+        LatestOnly,     // Keep only the newest frame: a lagging client always gets the freshest data
+        Block,          // Wait until the client catches up. It throttles the whole pipeline, so only use it for lossless recording
+    };
+
+    inline std::string getQueuePolicyName(const QueuePolicy policy)
+    {
+        if (policy == QueuePolicy::LatestOnly)
+            return "latest_only";
+        if (policy == QueuePolicy::Block)
+            return "block";
+        return "drop_oldest";
+    }
+
+    struct ClientStatistics
+    {
+        std::string address;
+        StreamId streamId;
+        QueuePolicy policy;
+        unsigned long long sent;    // Packets completely sent (a batch counts as one)
+        unsigned long long dropped; // Packets discarded because the client was lagging
+        std::size_t queued;
+        // Time from queuing to the last byte given to the socket (monotonic ns, over the `sent` packets)
+        std::int64_t sendNanosecondsTotal;
+        std::int64_t sendNanosecondsMax;
+    };
+
+    // In-process replacement of openpose_server_01.1.py. It speaks the same protocol (the client sends its 4-byte stream id
+    // right after connecting, one client per stream) and sends the same packet layouts, but the packets are serialized
+    // straight from FrameData in the waitAndPop loop and written by an epoll thread, so no frame goes through text, a pipe
+    // or Python, and the OpenPose output loop never blocks on a socket.
+    // Clients can also ask for PNG/JPEG crops with the extended handshake (see streamPackets.hpp). Those are encoded by a
+    // separate encoder thread, once per frame and (stream, encoding), so compression never delays the output loop either.
+    // Linux only (epoll). On other platforms keep using openpose_server_01.1.py.
+    class StreamServer
+    {
+    public:
+        // queueSize: maximum number of frames queued per client. queuePolicies: comma-separated list of `policy` (default for
+        // every stream) and `stream=policy` entries, e.g. "drop_oldest,HandColorLH=latest_only,ClosestBody=block". Streams can
+        // be given by name or id; policies are drop_oldest, latest_only or block.
+        explicit StreamServer(const int port, const std::size_t queueSize = 8, const std::string& queuePolicies = "") :
+            mRunning{true},
+            mListenFd{-1},
+            mEpollFd{-1},
+            mWakeFd{-1},
+            mQueueSize{(queueSize > 0 ? queueSize : 1)},
+            mDefaultPolicy{QueuePolicy::DropOldest},
+            mNextClientId{0ull}
+        {
+            try
+            {
+                parseQueuePolicies(queuePolicies);
+                #ifdef __linux__
+                    mListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                    if (mListenFd < 0)
+                        op::error("Stream server socket could not be created: " + errnoString(), __LINE__, __FUNCTION__, __FILE__);
+                    const int enable = 1;
+                    setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+                    sockaddr_in address;
+                    std::memset(&address, 0, sizeof(address));
+                    address.sin_family = AF_INET;
+                    address.sin_addr.s_addr = htonl(INADDR_ANY);
+                    address.sin_port = htons((std::uint16_t)port);
+                    if (bind(mListenFd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(mListenFd, 5) != 0)
+                        op::error("Stream server could not listen on port " + std::to_string(port) + ": " + errnoString(),
+                                  __LINE__, __FUNCTION__, __FILE__);
+                    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+                    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                    if (mEpollFd < 0 || mWakeFd < 0)
+                        op::error("Stream server epoll could not be created: " + errnoString(), __LINE__, __FUNCTION__, __FILE__);
+                    updateEpoll(EPOLL_CTL_ADD, mListenFd, EPOLLIN);
+                    updateEpoll(EPOLL_CTL_ADD, mWakeFd, EPOLLIN);
+                    mThread = std::thread{&StreamServer::run, this};
+                    mEncoderThread = std::thread{&StreamServer::encodeCrops, this};
+                    op::log("Stream server listening on port " + std::to_string(port) + ".", op::Priority::High);
+                #else
+                    op::error("The stream server needs epoll (Linux). Use openpose_server_01.1.py on this platform.",
+                              __LINE__, __FUNCTION__, __FILE__);
+                #endif
+            }
+            catch (const std::exception& e)
+            {
+                closeDescriptors();
+                op::error(e.what(), __LINE__, __FUNCTION__, __FILE__);
+            }
+        }
+
+        ~StreamServer()
+        {
+            {
+                std::lock_guard<std::mutex> lock{mMutex};
+                mRunning = false;
+            }
+            {
+                // Empty critical section: the encoder thread is either waiting or will see mRunning == false
+                std::lock_guard<std::mutex> lock{mEncodeMutex};
+            }
+            mQueueCondition.notify_all();
+            mEncodeCondition.notify_all();
+            wakeUp();
+            if (mEncoderThread.joinable())
+                mEncoderThread.join();
+            if (mThread.joinable())
+                mThread.join();
+            closeDescriptors();
+        }
+
+        // Serializes the frame once per stream that has a client and queues it for sending. Never blocks on the network,
+        // only on clients whose stream uses QueuePolicy::Block and whose queue is full.
+        void publish(const FrameData& frameData)
+        {
+            try
+            {
+                // Legacy packet timestamp: wall-clock ms of the capture (see streamPackets.hpp)
+                const auto captureTime = frameData.trace.getCaptureTime();
+                const auto timestamp = toWallMilliseconds(captureTime > 0 ? captureTime : getMonotonicNanoseconds());
+                std::vector<Receiver> receivers;
+                EncodeJob encodeJob;
+                encodeJob.timestamp = timestamp;
+                encodeJob.trace = frameData.trace;
+                encodeJob.frameNumber = frameData.frameNumber;
+                encodeJob.trackId = frameData.trackId;
+                encodeJob.cameraIndex = frameData.cameraIndex;
+                std::unique_lock<std::mutex> lock{mMutex};
+                for (const auto& fdAndClient : mClients)
+                {
+                    const auto& client = fdAndClient.second;
+                    if (client.handshakeDone && isCameraSent(client.options, frameData.cameraIndex))
+                        (isCompressed(client.options.encoding) ? encodeJob.receivers : receivers).emplace_back(
+                            Receiver{fdAndClient.first, client.id, client.streamId, client.options});
+                }
+                std::map<PacketKey, Packet> packets;
+                for (const auto& receiver : receivers)
+                {
+                    auto& packet = packets[getPacketKey(receiver)];
+                    if (packet == nullptr)
+                    {
+                        packet = makeStreamPacket(receiver.streamId, frameData, timestamp, receiver.options);
+                        if (receiver.options.tracked)
+                            packet = makeTrackedPacket(packet, frameData.trackId);
+                        if (receiver.options.camera == STREAM_ALL_CAMERAS)
+                            packet = makeCameraPacket(packet, frameData.cameraIndex);
+                        if (receiver.options.trace)
+                            packet = makeTracedPacket(packet, frameData.trace);
+                    }
+                    deliver(lock, receiver, packet);
+                }
+                if (!packets.empty())
+                    wakeUp();
+                lock.unlock();
+                if (!encodeJob.receivers.empty())
+                    queueEncodeJob(frameData, encodeJob);
+            }
+            catch (const std::exception& e)
+            {
+                op::error(e.what(), __LINE__, __FUNCTION__, __FILE__);
+            }
+        }
+
+        // Bitwise OR of the StreamId of the connected clients that receive the frames of camera cameraIndex (the ids are
+        // distinct bits and there is at most one client per stream and camera). Updated as clients connect and disconnect,
+        // so the output stage can skip what nobody receives. The options of a stream can differ from camera to camera.
+        int getSubscribedStreams(const unsigned int cameraIndex) const
+        {
+            return getStreamMasks(cameraIndex).subscribed.load(std::memory_order_relaxed);
+        }
+
+        // Same for the clients that asked for encoding=tensor (FrameData::tensors)
+        int getTensorStreams(const unsigned int cameraIndex) const
+        {
+            return getStreamMasks(cameraIndex).tensor.load(std::memory_order_relaxed);
+        }
+
+        // Same for the clients that asked for people=all (FrameData::cropBatches)
+        int getBatchStreams(const unsigned int cameraIndex) const
+        {
+            return getStreamMasks(cameraIndex).batch.load(std::memory_order_relaxed);
+        }
+
+        // Same for the clients that asked for unchanged=1 (CropData::unchanged)
+        int getUnchangedStreams(const unsigned int cameraIndex) const
+        {
+            return getStreamMasks(cameraIndex).unchanged.load(std::memory_order_relaxed);
+        }
+
+        // Same for the clients that asked for predict (FrameData::keypointVelocities)
+        int getPredictedStreams(const unsigned int cameraIndex) const
+        {
+            return getStreamMasks(cameraIndex).predicted.load(std::memory_order_relaxed);
+        }
+
+        bool isSubscribed(const StreamId streamId, const unsigned int cameraIndex) const
+        {
+            return (getSubscribedStreams(cameraIndex) & (int)streamId) != 0;
+        }
+
+        std::vector<ClientStatistics> getStatistics()
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            std::vector<ClientStatistics> statistics;
+            for (const auto& fdAndClient : mClients)
+            {
+                const auto& client = fdAndClient.second;
+                if (client.handshakeDone)
+                    statistics.emplace_back(ClientStatistics{client.address, client.streamId, client.policy, client.sent,
+                                                             client.dropped, client.queue.size(), client.sendNanosecondsTotal,
+                                                             client.sendNanosecondsMax});
+            }
+            return statistics;
+        }
+
+    private:
+        struct QueuedPacket
+        {
+            Packet packet;
+            std::int64_t queueTime; // getMonotonicNanoseconds() when it was queued
+        };
+
+        struct Client
+        {
+            unsigned long long id;      // Unique, unlike the fd that the OS reuses
+            std::string address;
+            bool handshakeDone;
+            StreamId streamId;
+            StreamOptions options;
+            QueuePolicy policy;
+            std::string handshake;
+            std::deque<QueuedPacket> queue;
+            std::size_t queueOffset;    // Bytes of queue.front() already sent
+            bool waitingWritable;       // EPOLLOUT registered
+            unsigned long long sent;
+            unsigned long long dropped;
+            std::int64_t sendNanosecondsTotal;
+            std::int64_t sendNanosecondsMax;
+            // Batch being filled (options.batchFrames / batchMilliseconds), nullptr if empty
+            std::shared_ptr<std::vector<char>> batch;
+            std::uint16_t batchCount;
+            std::chrono::steady_clock::time_point batchDeadline;
+
+            Client() :
+                id{0ull}, handshakeDone{false}, streamId{StreamId::ClosestBody}, policy{QueuePolicy::DropOldest},
+                queueOffset{0}, waitingWritable{false}, sent{0ull}, dropped{0ull}, sendNanosecondsTotal{0},
+                sendNanosecondsMax{0}, batchCount{0}
+            {}
+        };
+
+        // Snapshot of a client taken by publish(). Blocking clients and the encoder thread release mMutex, so mClients can
+        // change in the meantime: the client is looked up again by fd and id before delivering.
+        struct Receiver
+        {
+            int fd;
+            unsigned long long id;
+            StreamId streamId;
+            StreamOptions options;
+        };
+
+        // Clients with the same key get the very same packet
+        typedef std::tuple<int, int, int, bool, bool, bool, bool, bool, int, bool> PacketKey;
+
+        static PacketKey getPacketKey(const Receiver& receiver)
+        {
+            return PacketKey{(int)receiver.streamId, (int)receiver.options.encoding,
+                             (receiver.options.encoding == CropEncoding::Jpeg ? receiver.options.quality : 0),
+                             receiver.options.compactKeypoints, receiver.options.trace, receiver.options.allPeople,
+                             receiver.options.skipUnchanged, receiver.options.tracked,
+                             receiver.options.predictMilliseconds,
+                             receiver.options.camera == STREAM_ALL_CAMERAS};
+        }
+
+        // Crops of one frame waiting for the encoder thread (the FrameData pixels are only valid during publish())
+        struct EncodeJob
+        {
+            std::int64_t timestamp;
+            FrameTrace trace;
+            unsigned long long frameNumber;
+            unsigned int trackId;
+            unsigned int cameraIndex;
+            std::array<cv::Mat, CROP_NUMBER_REGIONS> crops;
+            // CropData::unchanged / sameAs of each region (the crop is not copied then)
+            std::array<bool, CROP_NUMBER_REGIONS> unchanged;
+            std::array<unsigned long long, CROP_NUMBER_REGIONS> sameAs;
+            std::vector<Receiver> receivers;
+        };
+        // Frames waiting to be encoded. If the encoder falls behind, the oldest frame is dropped for its clients.
+        static const std::size_t ENCODE_QUEUE_SIZE = 2;
+
+        // Stream bitmasks of the clients of one camera (see getSubscribedStreams)
+        struct StreamMasks
+        {
+            std::atomic<int> subscribed;
+            std::atomic<int> tensor;
+            std::atomic<int> batch;
+            std::atomic<int> unchanged;
+            std::atomic<int> predicted;
+
+            StreamMasks() :
+                subscribed{0}, tensor{0}, batch{0}, unchanged{0}, predicted{0}
+            {}
+        };
+
+        std::atomic<bool> mRunning;
+        int mListenFd;
+        int mEpollFd;
+        int mWakeFd;
+        const std::size_t mQueueSize;
+        QueuePolicy mDefaultPolicy;
+        std::map<StreamId, QueuePolicy> mPolicies;
+        unsigned long long mNextClientId;
+        // One per camera below STREAM_MAX_CAMERAS, the last one for the cameras above (only camera=all clients get those)
+        std::array<StreamMasks, STREAM_MAX_CAMERAS + 1> mStreamMasks;
+        std::thread mThread;
+        std::mutex mMutex;
+        std::condition_variable mQueueCondition;   // Signaled when a queue shrinks (QueuePolicy::Block)
+        std::map<int, Client> mClients;
+        // Encoder thread. Lock order: mMutex before mEncodeMutex, never both while encoding.
+        std::thread mEncoderThread;
+        std::mutex mEncodeMutex;
+        std::condition_variable mEncodeCondition;
+        std::deque<EncodeJob> mEncodeJobs;
+
+        StreamServer(const StreamServer&) = delete;
+        StreamServer& operator=(const StreamServer&) = delete;
+
+        static std::string errnoString()
+        {
+            return std::strerror(errno);
+        }
+
+        const StreamMasks& getStreamMasks(const unsigned int cameraIndex) const
+        {
+            return mStreamMasks[std::min(cameraIndex, (unsigned int)STREAM_MAX_CAMERAS)];
+        }
+
+        void parseQueuePolicies(const std::string& queuePolicies)
+        {
+            std::size_t begin = 0;
+            while (begin < queuePolicies.size())
+            {
+                auto end = queuePolicies.find(',', begin);
+                if (end == std::string::npos)
+                    end = queuePolicies.size();
+                const auto entry = queuePolicies.substr(begin, end - begin);
+                begin = end + 1;
+                if (entry.empty())
+                    continue;
+                const auto equal = entry.find('=');
+                const auto policyName = (equal == std::string::npos ? entry : entry.substr(equal + 1));
+                QueuePolicy policy;
+                if (policyName == "drop_oldest")
+                    policy = QueuePolicy::DropOldest;
+                else if (policyName == "latest_only")
+                    policy = QueuePolicy::LatestOnly;
+                else if (policyName == "block")
+                    policy = QueuePolicy::Block;
+                else
+                    op::error("Unknown stream queue policy: " + policyName + " (use drop_oldest, latest_only or block).",
+                              __LINE__, __FUNCTION__, __FILE__);
+                if (equal == std::string::npos)
+                    mDefaultPolicy = policy;
+                else
+                {
+                    StreamId streamId;
+                    if (!streamIdFromName(entry.substr(0, equal), streamId))
+                        op::error("Unknown stream in the queue policies: " + entry.substr(0, equal), __LINE__, __FUNCTION__,
+                                  __FILE__);
+                    mPolicies[streamId] = policy;
+                }
+            }
+        }
+
+        // Called with lock (on mMutex) locked. Blocking clients wait here (releasing the lock) until there is room.
+        void deliver(std::unique_lock<std::mutex>& lock, const Receiver& receiver, const Packet& packet)
+        {
+            auto client = mClients.find(receiver.fd);
+            if (client == mClients.end() || client->second.id != receiver.id)
+                return;
+            auto toSend = packet;
+            if (isBatched(client->second.options))
+            {
+                toSend = addToBatch(client->second, packet);
+                if (toSend == nullptr)
+                    return;
+            }
+            if (client->second.policy == QueuePolicy::Block && client->second.queue.size() >= mQueueSize)
+            {
+                wakeUp();
+                mQueueCondition.wait(lock, [&]
+                {
+                    client = mClients.find(receiver.fd);
+                    return !mRunning || client == mClients.end() || client->second.id != receiver.id
+                        || client->second.queue.size() < mQueueSize;
+                });
+                if (!mRunning || client == mClients.end() || client->second.id != receiver.id)
+                    return;
+            }
+            enqueue(client->second, toSend);
+        }
+
+        // Called with mMutex locked. Returns the batch once it is complete, nullptr while it is still being filled.
+        Packet addToBatch(Client& client, const Packet& packet)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (client.batch == nullptr)
+            {
+                client.batch = std::make_shared<std::vector<char>>();
+                client.batch->reserve(sizeof(std::int32_t) + sizeof(std::uint16_t) + client.options.batchFrames * packet->size());
+                client.batch->resize(sizeof(std::int32_t) + sizeof(std::uint16_t));
+                client.batchCount = 0;
+                client.batchDeadline = now + std::chrono::milliseconds{client.options.batchMilliseconds};
+            }
+            client.batch->insert(client.batch->end(), packet->begin(), packet->end());
+            client.batchCount++;
+            if (client.batchCount >= client.options.batchFrames
+                || (client.options.batchMilliseconds > 0 && now >= client.batchDeadline))
+                return takeBatch(client);
+            return nullptr;
+        }
+
+        // '<iH' load size | frame count, followed by the packets
+        static Packet takeBatch(Client& client)
+        {
+            auto& batch = *client.batch;
+            const auto loadSize = (std::int32_t)(batch.size() - sizeof(std::int32_t));
+            std::memcpy(batch.data(), &loadSize, sizeof(loadSize));
+            std::memcpy(batch.data() + sizeof(loadSize), &client.batchCount, sizeof(client.batchCount));
+            Packet packet = client.batch;
+            client.batch = nullptr;
+            client.batchCount = 0;
+            return packet;
+        }
+
+        // Milliseconds until the next batch_ms deadline, -1 if none (epoll_wait timeout)
+        int getBatchTimeout()
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            const auto now = std::chrono::steady_clock::now();
+            auto timeout = -1;
+            for (const auto& fdAndClient : mClients)
+            {
+                const auto& client = fdAndClient.second;
+                if (client.batch != nullptr && client.options.batchMilliseconds > 0)
+                {
+                    const auto remaining = (client.batchDeadline <= now ? 0 : (int)std::chrono::duration_cast<
+                        std::chrono::milliseconds>(client.batchDeadline - now + std::chrono::microseconds{999}).count());
+                    timeout = (timeout < 0 ? remaining : std::min(timeout, remaining));
+                }
+            }
+            return timeout;
+        }
+
+        // Copies the crops the job needs and hands it to the encoder thread
+        void queueEncodeJob(const FrameData& frameData, EncodeJob& encodeJob)
+        {
+            auto blocking = false;
+            for (const auto& receiver : encodeJob.receivers)
+            {
+                CropRegion region;
+                std::int32_t frameType;
+                const auto& crop = frameData.crops[(int)(getColorStreamRegion(receiver.streamId, region, frameType)
+                                                         ? region : CropRegion::LeftHand)];
+                auto& cropImage = encodeJob.crops[(int)region];
+                encodeJob.unchanged[(int)region] = (crop.visible && crop.unchanged && receiver.options.skipUnchanged);
+                encodeJob.sameAs[(int)region] = crop.sameAs;
+                // A crop without pixels (unchanged and not extracted) is sent as an unknown region
+                if (crop.visible && crop.pixels != nullptr && !encodeJob.unchanged[(int)region] && cropImage.empty())
+                    cropImage = cv::Mat(crop.height, crop.width, CV_8UC3, (void*)crop.pixels).clone();
+                blocking |= (mPolicies.count(receiver.streamId) > 0 ? mPolicies.at(receiver.streamId)
+                                                                      : mDefaultPolicy) == QueuePolicy::Block;
+            }
+            std::vector<Receiver> dropped;
+            {
+                std::unique_lock<std::mutex> lock{mEncodeMutex};
+                if (blocking)
+                    mEncodeCondition.wait(lock, [&]{ return !mRunning || mEncodeJobs.size() < ENCODE_QUEUE_SIZE; });
+                else if (mEncodeJobs.size() >= ENCODE_QUEUE_SIZE)
+                {
+                    dropped = mEncodeJobs.front().receivers;
+                    mEncodeJobs.pop_front();
+                }
+                mEncodeJobs.emplace_back(std::move(encodeJob));
+            }
+            mEncodeCondition.notify_all();
+            if (!dropped.empty())
+            {
+                std::lock_guard<std::mutex> lock{mMutex};
+                for (const auto& receiver : dropped)
+                {
+                    const auto client = mClients.find(receiver.fd);
+                    if (client != mClients.end() && client->second.id == receiver.id)
+                        countDropped(client->second, 1);
+                }
+            }
+        }
+
+        void encodeCrops()
+        {
+            while (true)
+            {
+                EncodeJob encodeJob;
+                {
+                    std::unique_lock<std::mutex> lock{mEncodeMutex};
+                    mEncodeCondition.wait(lock, [&]{ return !mRunning || !mEncodeJobs.empty(); });
+                    if (!mRunning)
+                        return;
+                    encodeJob = std::move(mEncodeJobs.front());
+                    mEncodeJobs.pop_front();
+                }
+                mEncodeCondition.notify_all();
+                try
+                {
+                    std::map<PacketKey, Packet> packets;
+                    for (const auto& receiver : encodeJob.receivers)
+                    {
+                        auto& packet = packets[getPacketKey(receiver)];
+                        if (packet == nullptr)
+                        {
+                            CropRegion region;
+                            std::int32_t frameType;
+                            const auto unchanged = (getColorStreamRegion(receiver.streamId, region, frameType)
+                                                    && encodeJob.unchanged[(int)region]);
+                            packet = (unchanged ? makeUnchangedPacket(frameType, encodeJob.sameAs[(int)region],
+                                                                      encodeJob.timestamp)
+                                                : makeEncodedStreamPacket(receiver.streamId, encodeJob.crops,
+                                                                          receiver.options, encodeJob.timestamp));
+                            if (receiver.options.skipUnchanged)
+                                packet = makeSequencedPacket(packet, encodeJob.frameNumber);
+                            if (receiver.options.tracked)
+                                packet = makeTrackedPacket(packet, encodeJob.trackId);
+                            if (receiver.options.camera == STREAM_ALL_CAMERAS)
+                                packet = makeCameraPacket(packet, encodeJob.cameraIndex);
+                            if (receiver.options.trace)
+                                packet = makeTracedPacket(packet, encodeJob.trace);
+                        }
+                    }
+                    std::unique_lock<std::mutex> lock{mMutex};
+                    for (const auto& receiver : encodeJob.receivers)
+                        deliver(lock, receiver, packets[getPacketKey(receiver)]);
+                    wakeUp();
+                }
+                catch (const std::exception& e)
+                {
+                    op::log(std::string{"Crop encoding failed: "} + e.what(), op::Priority::High, __LINE__, __FUNCTION__,
+                            __FILE__);
+                }
+            }
+        }
+
+        // Called with mMutex locked. The packet being sent (queueOffset > 0) is never dropped, it would corrupt the stream.
+        void enqueue(Client& client, const Packet& packet)
+        {
+            const auto inFlight = (std::size_t)(client.queueOffset > 0 ? 1 : 0);
+            auto dropped = 0ull;
+            if (client.policy == QueuePolicy::LatestOnly)
+            {
+                dropped = client.queue.size() - inFlight;
+                client.queue.erase(client.queue.begin() + inFlight, client.queue.end());
+            }
+            else if (client.policy == QueuePolicy::DropOldest)
+            {
+                while (client.queue.size() >= mQueueSize && client.queue.size() > inFlight)
+                {
+                    client.queue.erase(client.queue.begin() + inFlight);
+                    dropped++;
+                }
+            }
+            client.queue.emplace_back(QueuedPacket{packet, getMonotonicNanoseconds()});
+            countDropped(client, dropped);
+        }
+
+        void countDropped(Client& client, const unsigned long long dropped)
+        {
+            if (dropped > 0)
+            {
+                // Log the first drop and then every 100 of them, so a lagging client does not flood the console
+                if (client.dropped / 100 != (client.dropped + dropped) / 100 || client.dropped == 0)
+                    op::log("Client " + client.address + " (" + getStreamName(client.streamId) + ") is lagging: "
+                            + std::to_string(client.dropped + dropped) + " frames dropped so far.", op::Priority::High);
+                client.dropped += dropped;
+            }
+        }
+
+        #ifdef __linux__
+            void updateEpoll(const int operation, const int fd, const std::uint32_t events)
+            {
+                epoll_event event;
+                std::memset(&event, 0, sizeof(event));
+                event.events = events;
+                event.data.fd = fd;
+                if (epoll_ctl(mEpollFd, operation, fd, &event) != 0)
+                    op::log("epoll_ctl failed: " + errnoString(), op::Priority::High, __LINE__, __FUNCTION__, __FILE__);
+            }
+
+            void wakeUp()
+            {
+                if (mWakeFd >= 0)
+                {
+                    const std::uint64_t one = 1;
+                    if (write(mWakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                        op::log("Stream server could not be woken up: " + errnoString(), op::Priority::High);
+                }
+            }
+
+            void closeDescriptors()
+            {
+                for (const auto& fdAndClient : mClients)
+                    close(fdAndClient.first);
+                mClients.clear();
+                updateStreamMasks();
+                for (auto* fd : {&mWakeFd, &mEpollFd, &mListenFd})
+                {
+                    if (*fd >= 0)
+                        close(*fd);
+                    *fd = -1;
+                }
+            }
+
+            void run()
+            {
+                std::array<epoll_event, 64> events;
+                while (mRunning)
+                {
+                    const auto numberEvents = epoll_wait(mEpollFd, events.data(), (int)events.size(), getBatchTimeout());
+                    if (numberEvents < 0)
+                    {
+                        if (errno == EINTR)
+                            continue;
+                        op::log("Stream server stopped, epoll_wait failed: " + errnoString(), op::Priority::High,
+                                __LINE__, __FUNCTION__, __FILE__);
+                        break;
+                    }
+                    std::lock_guard<std::mutex> lock{mMutex};
+                    for (auto i = 0 ; i < numberEvents ; i++)
+                    {
+                        const auto fd = events[i].data.fd;
+                        if (fd == mListenFd)
+                            acceptClients();
+                        else if (fd == mWakeFd)
+                        {
+                            std::uint64_t count;
+                            while (read(mWakeFd, &count, sizeof(count)) > 0) {}
+                            for (auto client = mClients.begin() ; client != mClients.end() ; )
+                                client = (sendQueued(client->first, client->second) ? std::next(client)
+                                                                                     : closeClient(client));
+                        }
+                        else
+                        {
+                            auto client = mClients.find(fd);
+                            if (client == mClients.end())
+                                continue;
+                            auto keepOpen = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                            if (keepOpen && (events[i].events & EPOLLIN))
+                                keepOpen = receive(fd, client->second);
+                            if (keepOpen && (events[i].events & EPOLLOUT))
+                                keepOpen = sendQueued(fd, client->second);
+                            if (!keepOpen)
+                                closeClient(client);
+                        }
+                    }
+                    flushExpiredBatches();
+                }
+            }
+
+            // Called with mMutex locked. Sends the batches whose batch_ms elapsed before they got full.
+            void flushExpiredBatches()
+            {
+                const auto now = std::chrono::steady_clock::now();
+                for (auto client = mClients.begin() ; client != mClients.end() ; )
+                {
+                    auto keepOpen = true;
+                    if (client->second.batch != nullptr && client->second.options.batchMilliseconds > 0
+                        && now >= client->second.batchDeadline)
+                    {
+                        enqueue(client->second, takeBatch(client->second));
+                        keepOpen = sendQueued(client->first, client->second);
+                    }
+                    client = (keepOpen ? std::next(client) : closeClient(client));
+                }
+            }
+
+            void acceptClients()
+            {
+                while (true)
+                {
+                    sockaddr_in address;
+                    socklen_t addressSize = sizeof(address);
+                    const auto fd = accept4(mListenFd, (sockaddr*)&address, &addressSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0)
+                    {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                            op::log("Stream server accept failed: " + errnoString(), op::Priority::High);
+                        return;
+                    }
+                    Client client;
+                    client.id = mNextClientId++;
+                    client.address = std::string{inet_ntoa(address.sin_addr)} + ":" + std::to_string(ntohs(address.sin_port));
+                    op::log("Client " + client.address + " connected.", op::Priority::High);
+                    mClients[fd] = client;
+                    updateEpoll(EPOLL_CTL_ADD, fd, EPOLLIN);
+                }
+            }
+
+            // Reads the 4-byte stream id (and options, see getHandshakeSize). Anything a client sends after that is ignored.
+            bool receive(const int fd, Client& client)
+            {
+                std::array<char, 256> buffer;
+                while (true)
+                {
+                    const auto received = recv(fd, buffer.data(), buffer.size(), 0);
+                    if (received == 0)
+                        return false;
+                    if (received < 0)
+                        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+                    auto used = (std::size_t)0;
+                    while (!client.handshakeDone && used < (std::size_t)received)
+                    {
+                        client.handshake.push_back(buffer[used++]);
+                        const auto handshakeSize = getHandshakeSize(client.handshake);
+                        if (handshakeSize == 0)
+                        {
+                            op::log("Rejecting client " + client.address + ": handshake options too long.", op::Priority::High);
+                            return false;
+                        }
+                        if (handshakeSize == client.handshake.size() && !acceptHandshake(fd, client))
+                            return false;
+                    }
+                }
+            }
+
+            bool acceptHandshake(const int fd, Client& client)
+            {
+                int streamId;
+                StreamOptions options;
+                std::string errorMessage;
+                if (!parseHandshake(client.handshake, streamId, options, errorMessage))
+                {
+                    op::log("Rejecting stream " + std::to_string(streamId) + ": " + errorMessage + ".", op::Priority::High);
+                    return false;
+                }
+                if (!isValidStreamId(streamId))
+                {
+                    op::log("Rejecting invalid stream with stream id: " + std::to_string(streamId), op::Priority::High);
+                    return false;
+                }
+                for (const auto& fdAndClient : mClients)
+                {
+                    // One client per stream and camera (camera=all takes every camera of the stream)
+                    const auto& other = fdAndClient.second.options;
+                    if (fdAndClient.first != fd && fdAndClient.second.handshakeDone
+                        && fdAndClient.second.streamId == (StreamId)streamId
+                        && (other.camera == STREAM_ALL_CAMERAS || options.camera == STREAM_ALL_CAMERAS
+                            || other.camera == options.camera))
+                    {
+                        op::log("Stream " + std::to_string(streamId) + " already exists. Rejecting the connection.",
+                                op::Priority::High);
+                        return false;
+                    }
+                }
+                client.streamId = (StreamId)streamId;
+                client.options = options;
+                const auto policy = mPolicies.find(client.streamId);
+                client.policy = (policy != mPolicies.end() ? policy->second : mDefaultPolicy);
+                client.handshakeDone = true;
+                updateStreamMasks();
+                op::log("New stream " + std::to_string(streamId) + " accepted (" + getQueuePolicyName(client.policy)
+                        + getStreamOptionsDescription(streamId, options) + ").",
+                        op::Priority::High);
+                return true;
+            }
+
+            // Writes as much of the queue as the socket takes without blocking. Returns false if the client is gone.
+            bool sendQueued(const int fd, Client& client)
+            {
+                while (!client.queue.empty())
+                {
+                    const auto& packet = *client.queue.front().packet;
+                    const auto sent = send(fd, packet.data() + client.queueOffset, packet.size() - client.queueOffset,
+                                           MSG_NOSIGNAL);
+                    if (sent < 0)
+                    {
+                        if (errno == EINTR)
+                            continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                            return false;
+                        if (!client.waitingWritable)
+                        {
+                            updateEpoll(EPOLL_CTL_MOD, fd, EPOLLIN | EPOLLOUT);
+                            client.waitingWritable = true;
+                        }
+                        return true;
+                    }
+                    client.queueOffset += sent;
+                    if (client.queueOffset == packet.size())
+                    {
+                        const auto sendNanoseconds = getMonotonicNanoseconds() - client.queue.front().queueTime;
+                        client.sendNanosecondsTotal += sendNanoseconds;
+                        client.sendNanosecondsMax = std::max(client.sendNanosecondsMax, sendNanoseconds);
+                        client.queue.pop_front();
+                        client.queueOffset = 0;
+                        client.sent++;
+                        if (client.policy == QueuePolicy::Block)
+                            mQueueCondition.notify_all();
+                    }
+                }
+                if (client.waitingWritable)
+                {
+                    updateEpoll(EPOLL_CTL_MOD, fd, EPOLLIN);
+                    client.waitingWritable = false;
+                }
+                return true;
+            }
+
+            // Rebuilds the stream bitmasks of every camera from the clients (a stream can have one client per camera)
+            void updateStreamMasks()
+            {
+                for (auto camera = 0u ; camera < mStreamMasks.size() ; camera++)
+                {
+                    auto subscribedStreams = 0, tensorStreams = 0, batchStreams = 0, unchangedStreams = 0, predictedStreams = 0;
+                    for (const auto& fdAndClient : mClients)
+                    {
+                        const auto& client = fdAndClient.second;
+                        if (!client.handshakeDone || !isCameraSent(client.options, camera))
+                            continue;
+                        subscribedStreams |= (int)client.streamId;
+                        if (client.options.encoding == CropEncoding::Tensor)
+                            tensorStreams |= (int)client.streamId;
+                        if (client.options.allPeople)
+                            batchStreams |= (int)client.streamId;
+                        if (client.options.skipUnchanged)
+                            unchangedStreams |= (int)client.streamId;
+                        if (client.options.predictMilliseconds > 0)
+                            predictedStreams |= (int)client.streamId;
+                    }
+                    auto& masks = mStreamMasks[camera];
+                    masks.subscribed.store(subscribedStreams, std::memory_order_relaxed);
+                    masks.tensor.store(tensorStreams, std::memory_order_relaxed);
+                    masks.batch.store(batchStreams, std::memory_order_relaxed);
+                    masks.unchanged.store(unchangedStreams, std::memory_order_relaxed);
+                    masks.predicted.store(predictedStreams, std::memory_order_relaxed);
+                }
+            }
+
+            std::map<int, Client>::iterator closeClient(const std::map<int, Client>::iterator& client)
+            {
+                const auto& closed = client->second;
+                op::log("Client " + closed.address + " disconnected"
+                        + (closed.handshakeDone ? " (" + getStreamName(closed.streamId) + ": " + std::to_string(closed.sent)
+                                                  + " frames sent, " + std::to_string(closed.dropped) + " dropped)." : "."),
+                        op::Priority::High);
+                const auto handshakeDone = closed.handshakeDone;
+                epoll_ctl(mEpollFd, EPOLL_CTL_DEL, client->first, nullptr);
+                close(client->first);
+                const auto next = mClients.erase(client);
+                if (handshakeDone)
+                    updateStreamMasks();
+                mQueueCondition.notify_all();
+                return next;
+            }
+        #else
+            void wakeUp() {}
+            void closeDescriptors() {}
+            void run() {}
+        #endif
+    };
+}
+
+#endif // CWC_STREAM_SERVER_HPP